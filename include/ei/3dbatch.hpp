@@ -0,0 +1,237 @@
+#pragma once
+
+#include "3dintersection.hpp"
+#include "details/simd.hpp"
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                          BATCHED INTERSECTIONS                            //
+    // ************************************************************************* //
+    // The functions in this file test many primitives against a single one. They
+    // process 8 primitives at once using the SIMD wrappers from details/simd.hpp
+    // and give the same results as the single tests from 3dintersection.hpp.
+    // The kernels exist for each instruction set and the best one supported
+    // by the CPU is chosen at runtime (see simdLevel() and forceSimdLevel()).
+    //
+    // Results are either written as bitmask or as compacted index list:
+    //  * A bitmask has (_num+31)/32 words. Bit i%32 of word i/32 belongs to
+    //    primitive i. Unused bits of the last word are 0.
+    //  * An index list must have space for _num indices. The indices of the
+    //    positive tests are written in ascending order.
+    //  * A pair list has space for _maxPairs pairs. The functions return the
+    //    total number of pairs, which can be larger than _maxPairs. In that
+    //    case only the first _maxPairs pairs are written.
+
+    namespace details {
+        inline uint32 countBits( uint32 _x )
+        {
+            _x = _x - ((_x >> 1) & 0x55555555);
+            _x = (_x & 0x33333333) + ((_x >> 2) & 0x33333333);
+            return (((_x + (_x >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+        }
+
+        // The ellipsoid tests divide by the radii or multiply with the
+        // largest float if a radius is 0.
+        inline Vec3 ellipsoidScale( const Vec3& _radii )
+        {
+            return Vec3(_radii.x != 0.0f ? 1.0f / _radii.x : 3.402823466e+38f,
+                        _radii.y != 0.0f ? 1.0f / _radii.y : 3.402823466e+38f,
+                        _radii.z != 0.0f ? 1.0f / _radii.z : 3.402823466e+38f);
+        }
+
+        // Number of elements of the second set which are converted to SoA at
+        // once in the NxM kernels. All elements of the first set are tested
+        // against one tile before the next tile is loaded.
+        const uint32 OVERLAP_TILE_SIZE = 256;
+
+        // Append the pairs (_i, _j + k) for all set bits k of _mask.
+        inline void emitPairs( uint32 _i, uint32 _j, uint32 _mask, UVec2* _pairs, uint32 _maxPairs, uint32& _count )
+        {
+            for(; _mask; _mask &= _mask - 1)
+            {
+                if(_count < _maxPairs)
+                    _pairs[_count] = UVec2(_i, _j + countBits((_mask & (0 - _mask)) - 1));
+                ++_count;
+            }
+        }
+    }
+}
+
+// Kernels in ei::details::scalar, sse2, sse41 and avx2.
+#define EI_SIMD_KERNELS "batchkernels.hpp"
+#include "details/simddispatch.hpp"
+
+namespace ei {
+
+    /// \brief Visibility test for many spheres (frustum culling).
+    /// \details Gives the same results as intersects(Sphere, FastFrustum) for
+    ///     each sphere. All spheres are tested against the planes with SIMD
+    ///     and only spheres close to the frustum border need the exact test.
+    /// \param [out] _visibleMask Bitmask with (_num+31)/32 words. Bit i%32 of
+    ///     word i/32 is set if sphere i intersects the frustum.
+    /// \return Number of visible spheres.
+    inline uint32 intersects( const Sphere* _spheres, uint32 _num, const FastFrustum& _frustum, uint32* _visibleMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(visibleSpheres( _spheres, _num, _frustum, _visibleMask ));
+    }
+
+    /// \brief Visibility test for many spheres (frustum culling) with compacted
+    ///     output.
+    /// \details Gives the same results as intersects(Sphere, FastFrustum) for
+    ///     each sphere.
+    /// \param [out] _visibleIndices Array with space for _num indices. Receives
+    ///     the indices of all visible spheres in ascending order.
+    /// \return Number of visible spheres (number of written indices).
+    inline uint32 intersectsIndices( const Sphere* _spheres, uint32 _num, const FastFrustum& _frustum, uint32* _visibleIndices ) // TESTED
+    {
+        EI_SIMD_DISPATCH(visibleSphereIndices( _spheres, _num, _frustum, _visibleIndices ));
+    }
+
+    inline uint32 intersects( const FastFrustum& _frustum, const Sphere* _spheres, uint32 _num, uint32* _visibleMask )  { return intersects( _spheres, _num, _frustum, _visibleMask ); }
+    inline uint32 intersectsIndices( const FastFrustum& _frustum, const Sphere* _spheres, uint32 _num, uint32* _visibleIndices )  { return intersectsIndices( _spheres, _num, _frustum, _visibleIndices ); }
+
+    /// \brief Test many points for containment in a volume.
+    /// \details The points are either given as array of Vec3 or as three
+    ///     coordinate arrays (SoA, faster). The result for each point is the
+    ///     same as intersects(Vec3, X). For the oriented shapes the rotation
+    ///     is applied as matrix and the ellipsoid equation is evaluated in
+    ///     single precision. Thus, these can differ by rounding for points
+    ///     directly at the boundary.
+    /// \param [out,opt] _insideMask Bitmask with (_num+31)/32 words. Bit i%32
+    ///     of word i/32 is set if point i is inside. Pass nullptr if only the
+    ///     count is required.
+    /// \return Number of points inside the volume.
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const Box& _box, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _box, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const Sphere& _sphere, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _sphere, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const OBox& _obox, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _obox, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const Ellipsoid& _ellipsoid, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _ellipsoid, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const OEllipsoid& _oellipsoid, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _oellipsoid, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const Tetrahedron& _tetrahedron, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _tetrahedron, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const FastCone& _cone, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _cone, _insideMask ));
+    }
+
+    inline uint32 intersects( const Vec3* _points, uint32 _num, const FastFrustum& _frustum, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _points, _num, _frustum, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const Box& _box, uint32* _insideMask ) // TESTED
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _box, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const Sphere& _sphere, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _sphere, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const OBox& _obox, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _obox, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const Ellipsoid& _ellipsoid, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _ellipsoid, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const OEllipsoid& _oellipsoid, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _oellipsoid, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const Tetrahedron& _tetrahedron, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _tetrahedron, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const FastCone& _cone, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _cone, _insideMask ));
+    }
+
+    inline uint32 intersects( const float* _x, const float* _y, const float* _z, uint32 _num, const FastFrustum& _frustum, uint32* _insideMask )
+    {
+        EI_SIMD_DISPATCH(pointsInside( _x, _y, _z, _num, _frustum, _insideMask ));
+    }
+
+    /// \brief Classify many boxes against one plane (e.g. split candidates in
+    ///     kd-tree or BSP builders).
+    /// \details Gives the same result as classify(Plane, Box) for each box.
+    /// \param [out] _sides Array with _num entries. Receives the side of each box.
+    inline void classify( const Plane& _plane, const Box* _boxes, uint32 _num, PlaneSide* _sides ) // TESTED
+    {
+        EI_SIMD_DISPATCH(classifyBoxes( _plane, _boxes, _num, _sides ));
+    }
+
+    inline void classify( const Box* _boxes, uint32 _num, const Plane& _plane, PlaneSide* _sides )  { classify( _plane, _boxes, _num, _sides ); }
+
+    /// \brief Find all overlapping pairs in a set of spheres (broadphase).
+    /// \details Gives the same results as intersects(Sphere, Sphere) for
+    ///     each pair. The set is processed in tiles: the pairs are sorted by
+    ///     the tile of the second index, then by the first index and then by
+    ///     the second index.
+    /// \param [out] _pairs Receives pairs (i,j) with i < j.
+    /// \return Total number of overlapping pairs.
+    inline uint32 intersects( const Sphere* _spheres, uint32 _num, UVec2* _pairs, uint32 _maxPairs ) // TESTED
+    {
+        EI_SIMD_DISPATCH(overlapPairs( _spheres, _num, (const Sphere*)nullptr, 0, _pairs, _maxPairs ));
+    }
+
+    /// \brief Find all overlapping pairs between two sets of spheres.
+    /// \param [out] _pairs Receives pairs (i,j) where i indexes _spheres0 and
+    ///     j _spheres1.
+    /// \return Total number of overlapping pairs.
+    inline uint32 intersects( const Sphere* _spheres0, uint32 _num0, const Sphere* _spheres1, uint32 _num1, UVec2* _pairs, uint32 _maxPairs ) // TESTED
+    {
+        EI_SIMD_DISPATCH(overlapPairs( _spheres0, _num0, _spheres1, _num1, _pairs, _maxPairs ));
+    }
+
+    /// \brief Find all overlapping pairs in a set of boxes (broadphase).
+    /// \details Gives the same results as intersects(Box, Box) for each pair.
+    ///     The pair order is the same as for spheres.
+    /// \param [out] _pairs Receives pairs (i,j) with i < j.
+    /// \return Total number of overlapping pairs.
+    inline uint32 intersects( const Box* _boxes, uint32 _num, UVec2* _pairs, uint32 _maxPairs ) // TESTED
+    {
+        EI_SIMD_DISPATCH(overlapPairs( _boxes, _num, (const Box*)nullptr, 0, _pairs, _maxPairs ));
+    }
+
+    /// \brief Find all overlapping pairs between two sets of boxes.
+    /// \param [out] _pairs Receives pairs (i,j) where i indexes _boxes0 and
+    ///     j _boxes1.
+    /// \return Total number of overlapping pairs.
+    inline uint32 intersects( const Box* _boxes0, uint32 _num0, const Box* _boxes1, uint32 _num1, UVec2* _pairs, uint32 _maxPairs ) // TESTED
+    {
+        EI_SIMD_DISPATCH(overlapPairs( _boxes0, _num0, _boxes1, _num1, _pairs, _maxPairs ));
+    }
+
+}
+
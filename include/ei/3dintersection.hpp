@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "3dtypes.hpp"
+#include "details/simd.hpp"
 
 namespace ei {
 
@@ -21,6 +22,26 @@ namespace ei {
         Z     = 0x30,         ///< Any side in z-direction
     };
 
+    /// \brief Result of a frustum classification.
+    enum struct Visibility
+    {
+        OUTSIDE,              ///< No common point (certain).
+        INTERSECTING,         ///< Crosses at least one plane. Can still be outside near edges and corners.
+        INSIDE,               ///< Completely contained (certain).
+    };
+
+    /// \brief Side of a volume relative to a plane.
+    enum struct PlaneSide : int8
+    {
+        BACK = -1,            ///< Completely on the negative side (opposite to the normal).
+        STRADDLING = 0,       ///< Intersects or touches the plane.
+        FRONT = 1,            ///< Completely on the positive side.
+    };
+
+    /// \brief Plane mask with all 6 frustum planes active.
+    /// \details The bits are: 0 near, 1 far, 2 left, 3 right, 4 bottom, 5 top.
+    const uint32 FRUSTUM_ALL_PLANES = 0x3f;
+
     // ********************************************************************* //
     // DISTANCE FUNCTIONS                                                    //
     // ********************************************************************* //
@@ -61,11 +82,13 @@ namespace ei {
             // Distance to the plane
             return dot(normalize(n), _point-_triangle.v0);
 
-        // Minimum is somewhere on the three edges.
+        // Minimum is somewhere on the three edges. The projections must be
+        // clamped to the segments, otherwise the distance to the infinite
+        // lines would be too small near the vertices.
         float dist;
-        dist =           lensq(p_v0) - sq(dot(p_v0, a)) / lensq(a);
-        dist = min(dist, lensq(p_v1) - sq(dot(p_v1, b)) / lensq(b));
-        dist = min(dist, lensq(p_v0) - sq(dot(p_v0, c)) / lensq(c));
+        dist =           lensq(a * saturate(dot(p_v0, a) / lensq(a)) - p_v0);
+        dist = min(dist, lensq(b * saturate(dot(p_v1, b) / lensq(b)) - p_v1));
+        dist = min(dist, lensq(c * saturate(dot(p_v0, c) / lensq(c)) - p_v0));
         return sqrt(dist);
     }
 
@@ -657,6 +680,110 @@ namespace ei {
     inline bool intersects( const Box& _box, const Ray& _ray, float& _distance, float& _distanceExit )  { return intersects( _ray, _box, _distance, _distanceExit ); }
     inline bool intersects( const Box& _box, const FastRay& _ray, float& _distance )  { return intersects( _ray, _box, _distance ); }
 
+    namespace details {
+        // Packet slab test for 4 and 8 lanes (see intersects(RayPacket8, Box, float*)).
+        template<uint N>
+        inline uint32 intersectsPacket( const RayPacket<N>& _rays, const Box& _box, float* _distance )
+        {
+            typedef typename FloatN<N>::type Float;
+            // Slab distances without the sign dependent selection of the bounds.
+            // Since the inverse direction is clamped, min/max of the two planes
+            // is the same as the selection in the FastRay variant.
+            Float t0 = Float(_box.min.x) * Float::load(_rays.invDirection.x) - Float::load(_rays.oDivDir.x);
+            Float t1 = Float(_box.max.x) * Float::load(_rays.invDirection.x) - Float::load(_rays.oDivDir.x);
+            Float tmin = min(t0, t1);
+            Float tmax = max(t0, t1);
+            t0 = Float(_box.min.y) * Float::load(_rays.invDirection.y) - Float::load(_rays.oDivDir.y);
+            t1 = Float(_box.max.y) * Float::load(_rays.invDirection.y) - Float::load(_rays.oDivDir.y);
+            tmin = max(tmin, min(t0, t1));
+            tmax = min(tmax, max(t0, t1));
+            t0 = Float(_box.min.z) * Float::load(_rays.invDirection.z) - Float::load(_rays.oDivDir.z);
+            t1 = Float(_box.max.z) * Float::load(_rays.invDirection.z) - Float::load(_rays.oDivDir.z);
+            tmin = max(tmin, min(t0, t1));
+            tmax = min(tmax, max(t0, t1));
+
+            Float zero(0.0f);
+            Float dist = max(tmin, zero);
+            dist.storeu(_distance);
+            return bits((tmin <= tmax) & (tmax >= zero) & (dist <= Float::load(_rays.tMax)));
+        }
+    }
+
+    /// \brief Test a packet of 4 or 8 rays against one box (slab test).
+    /// \details Each lane gives the same result as intersects(FastRay, Box, float&)
+    ///     with the additional condition that the hit must not be farther
+    ///     away than the lane's tMax.
+    /// \param [out] _distance Array with 4 or 8 entries. Receives the entry
+    ///     distance of each hitting ray (0 if the ray starts inside). The
+    ///     entries of missing rays are undefined.
+    /// \return A hit mask: bit i is set if ray i hits the box.
+    inline uint32 intersects( const RayPacket8& _rays, const Box& _box, float* _distance )   // TESTED
+    {
+        return details::intersectsPacket( _rays, _box, _distance );
+    }
+
+    inline uint32 intersects( const RayPacket4& _rays, const Box& _box, float* _distance )
+    {
+        return details::intersectsPacket( _rays, _box, _distance );
+    }
+
+    inline uint32 intersects( const Box& _box, const RayPacket8& _rays, float* _distance )  { return intersects( _rays, _box, _distance ); }
+    inline uint32 intersects( const Box& _box, const RayPacket4& _rays, float* _distance )  { return intersects( _rays, _box, _distance ); }
+
+    namespace details {
+        // Single ray against 4 or 8 boxes (see intersects(FastRay, Box8, float*, float)).
+        template<uint N>
+        inline uint32 intersectsWide( const FastRay& _ray, const BoxSoA<N>& _boxes, float* _distance, float _tMax )
+        {
+            typedef typename FloatN<N>::type Float;
+            // The direction is the same for all boxes. Therefore, the near and far
+            // planes can be chosen once per axis like in the FastRay-Box test.
+            // This also rejects the inverted bounds of cleared lanes.
+            bool negX = _ray.invDirection.x < 0.0f;
+            bool negY = _ray.invDirection.y < 0.0f;
+            bool negZ = _ray.invDirection.z < 0.0f;
+            Float invX(_ray.invDirection.x), invY(_ray.invDirection.y), invZ(_ray.invDirection.z);
+            Float oDivDirX(_ray.oDivDir.x), oDivDirY(_ray.oDivDir.y), oDivDirZ(_ray.oDivDir.z);
+            Float tmin = Float::load(negX ? _boxes.max.x : _boxes.min.x) * invX - oDivDirX;
+            Float tmax = Float::load(negX ? _boxes.min.x : _boxes.max.x) * invX - oDivDirX;
+            tmin = max(tmin, Float::load(negY ? _boxes.max.y : _boxes.min.y) * invY - oDivDirY);
+            tmax = min(tmax, Float::load(negY ? _boxes.min.y : _boxes.max.y) * invY - oDivDirY);
+            tmin = max(tmin, Float::load(negZ ? _boxes.max.z : _boxes.min.z) * invZ - oDivDirZ);
+            tmax = min(tmax, Float::load(negZ ? _boxes.min.z : _boxes.max.z) * invZ - oDivDirZ);
+
+            Float zero(0.0f);
+            Float dist = max(tmin, zero);
+            auto hit = (tmin <= tmax) & (tmax >= zero) & (dist <= Float(_tMax));
+            select(hit, dist, Float(INF)).storeu(_distance);
+            return bits(hit);
+        }
+    }
+
+    /// \brief Test a single ray against 4 or 8 boxes (e.g. children of a wide
+    ///     BVH node).
+    /// \details Each lane gives the same result as
+    ///     intersects(FastRay, Box, float&) with the additional condition that
+    ///     the hit must not be farther away than _tMax.
+    /// \param [out] _distance Array with 4 or 8 entries. Receives the entry
+    ///     distance of each box (0 if the ray starts inside). Missed boxes get
+    ///     INF, so the array can be sorted directly for a front to back
+    ///     traversal.
+    /// \param [in,opt] _tMax Hits farther away are discarded (e.g. the closest
+    ///     hit so far).
+    /// \return A hit mask: bit i is set if the ray hits box i.
+    inline uint32 intersects( const FastRay& _ray, const Box8& _boxes, float* _distance, float _tMax = INF )   // TESTED
+    {
+        return details::intersectsWide( _ray, _boxes, _distance, _tMax );
+    }
+
+    inline uint32 intersects( const FastRay& _ray, const Box4& _boxes, float* _distance, float _tMax = INF )   // TESTED
+    {
+        return details::intersectsWide( _ray, _boxes, _distance, _tMax );
+    }
+
+    inline uint32 intersects( const Box8& _boxes, const FastRay& _ray, float* _distance, float _tMax = INF )  { return intersects( _ray, _boxes, _distance, _tMax ); }
+    inline uint32 intersects( const Box4& _boxes, const FastRay& _ray, float* _distance, float _tMax = INF )  { return intersects( _ray, _boxes, _distance, _tMax ); }
+
     /// \brief Do an oriented box and a ray intersect or touch?
     inline bool intersects( const Ray& _ray, const OBox& _obox )               // TESTED
     {
@@ -797,6 +924,88 @@ namespace ei {
     inline bool intersects( const Triangle& _triangle, const Ray& _ray, float& _distance, Vec3& _barycentric )  { return intersects( _ray, _triangle, _distance, _barycentric ); }
     inline bool intersects( const FastTriangle& _triangle, const Ray& _ray, float& _distance, Vec3& _barycentric )  { return intersects( _ray, _triangle, _distance, _barycentric ); }
 
+    namespace details {
+        // Packet Möller and Trumbore for 4 and 8 lanes (see intersects(RayPacket8, FastTriangle, float*, Vec3SoA<8>&)).
+        // The operation order is the same as in the scalar FastTriangle
+        // variant. Both give bitwise identical results as long as the
+        // compiler does not contract multiplications and additions to FMAs
+        // (GCC and Clang do so by default with -mfma or -march=native). Use
+        // -ffp-contract=off to mix both paths without image differences.
+        template<uint N>
+        inline uint32 intersectsPacket( const RayPacket<N>& _rays, const FastTriangle& _triangle, float* _distance, Vec3SoA<N>* _barycentric )
+        {
+            typedef typename FloatN<N>::type Float;
+            Float dirX = Float::load(_rays.direction.x);
+            Float dirY = Float::load(_rays.direction.y);
+            Float dirZ = Float::load(_rays.direction.z);
+            Float cosT = Float(_triangle.normal.x) * dirX + Float(_triangle.normal.y) * dirY + Float(_triangle.normal.z) * dirZ;
+            Float cosT2AInv = Float(0.5f) / (cosT * Float(_triangle.area));
+            Float oX = Float(_triangle.v0.x) - Float::load(_rays.origin.x);
+            Float oY = Float(_triangle.v0.y) - Float::load(_rays.origin.y);
+            Float oZ = Float(_triangle.v0.z) - Float::load(_rays.origin.z);
+            // d = cross(direction, o)
+            Float dX = dirY * oZ - dirZ * oY;
+            Float dY = dirZ * oX - dirX * oZ;
+            Float dZ = dirX * oY - dirY * oX;
+
+            Float baryY = -(dX * Float(_triangle.e02.x) + dY * Float(_triangle.e02.y) + dZ * Float(_triangle.e02.z)) * cosT2AInv;
+            Float baryZ = (dX * Float(_triangle.e01.x) + dY * Float(_triangle.e01.y) + dZ * Float(_triangle.e01.z)) * cosT2AInv;
+            Float baryX = Float(1.0f) - (baryY + baryZ);
+            Float dist = (Float(_triangle.normal.x) * oX + Float(_triangle.normal.y) * oY + Float(_triangle.normal.z) * oZ) / cosT;
+
+            dist.storeu(_distance);
+            if(_barycentric)
+            {
+                baryX.store(_barycentric->x);
+                baryY.store(_barycentric->y);
+                baryZ.store(_barycentric->z);
+            }
+            // The ordered comparisons fail for NaN. A NaN in y or z propagates
+            // to x, so this is the same as the NaN test of the scalar variant.
+            Float minBary(-EPSILON);
+            return bits((baryY >= minBary) & (baryZ >= minBary) & (baryX >= minBary)
+                & (dist >= Float(0.0f)) & (dist <= Float::load(_rays.tMax)));
+        }
+    }
+
+    /// \brief Test a packet of 4 or 8 rays against one triangle.
+    /// \details Each lane gives the same result as
+    ///     intersects(Ray, FastTriangle, float&, Vec3&) (including the handling
+    ///     of edges and degenerated cases) with the additional condition that
+    ///     the hit must not be farther away than the lane's tMax. With FMA
+    ///     contraction enabled the results may differ in the last bits and
+    ///     in the hit decision of rays through the edges.
+    /// \param [out] _distance Array with 4 or 8 entries. Receives the ray
+    ///     parameter of each hitting ray. The entries of missing rays are
+    ///     undefined.
+    /// \param [out,opt] _barycentric The barycentric coordinates of the hit
+    ///     points. The entries of missing rays are undefined.
+    /// \return A hit mask: bit i is set if ray i hits the triangle.
+    inline uint32 intersects( const RayPacket8& _rays, const FastTriangle& _triangle, float* _distance )   // TESTED
+    {
+        return details::intersectsPacket<8>( _rays, _triangle, _distance, nullptr );
+    }
+
+    inline uint32 intersects( const RayPacket8& _rays, const FastTriangle& _triangle, float* _distance, Vec3SoA<8>& _barycentric )   // TESTED
+    {
+        return details::intersectsPacket<8>( _rays, _triangle, _distance, &_barycentric );
+    }
+
+    inline uint32 intersects( const RayPacket4& _rays, const FastTriangle& _triangle, float* _distance )
+    {
+        return details::intersectsPacket<4>( _rays, _triangle, _distance, nullptr );
+    }
+
+    inline uint32 intersects( const RayPacket4& _rays, const FastTriangle& _triangle, float* _distance, Vec3SoA<4>& _barycentric )   // TESTED
+    {
+        return details::intersectsPacket<4>( _rays, _triangle, _distance, &_barycentric );
+    }
+
+    inline uint32 intersects( const FastTriangle& _triangle, const RayPacket8& _rays, float* _distance )  { return intersects( _rays, _triangle, _distance ); }
+    inline uint32 intersects( const FastTriangle& _triangle, const RayPacket8& _rays, float* _distance, Vec3SoA<8>& _barycentric )  { return intersects( _rays, _triangle, _distance, _barycentric ); }
+    inline uint32 intersects( const FastTriangle& _triangle, const RayPacket4& _rays, float* _distance )  { return intersects( _rays, _triangle, _distance ); }
+    inline uint32 intersects( const FastTriangle& _triangle, const RayPacket4& _rays, float* _distance, Vec3SoA<4>& _barycentric )  { return intersects( _rays, _triangle, _distance, _barycentric ); }
+
     /// \brief Do a sphere and a plane intersect or touch?
     /// \return true if there is at least one point in common.
     inline bool intersects( const Sphere& _sphere, const Plane& _plane )       // TESTED
@@ -1115,6 +1324,83 @@ namespace ei {
 
     inline bool intersects( const FastFrustum& _frustum, const Box& _box )     { return intersects(_box, _frustum); }
 
+    namespace details {
+        // Get plane _i of the frustum with inward normal (0 near, 1 far, 2-5 l r b t).
+        inline void frustumPlane( const FastFrustum& _frustum, uint32 _i, Vec3& _n, float& _d )
+        {
+            switch(_i)
+            {
+            case 0: _n = _frustum.nf.n; _d = _frustum.nf.d0; break;
+            case 1: _n = -_frustum.nf.n; _d = -_frustum.nf.d1; break;
+            case 2: _n = _frustum.l.n; _d = _frustum.l.d; break;
+            case 3: _n = _frustum.r.n; _d = _frustum.r.d; break;
+            case 4: _n = _frustum.b.n; _d = _frustum.b.d; break;
+            default: _n = _frustum.t.n; _d = _frustum.t.d; break;
+            }
+        }
+
+        // Returns -1 if the box is completely on the negative side of the
+        // plane, 1 if it is on the positive side and 0 if it straddles it.
+        inline int sideOfPlane( const Box& _box, const Vec3& _n, float _d )
+        {
+            // The farthest corner in normal direction (p-vertex) decides
+            // about outside, the nearest (n-vertex) about inside.
+            Vec3 pVertex(_n.x >= 0.0f ? _box.max.x : _box.min.x,
+                         _n.y >= 0.0f ? _box.max.y : _box.min.y,
+                         _n.z >= 0.0f ? _box.max.z : _box.min.z);
+            if(dot(_n, pVertex) + _d < 0.0f) return -1;
+            Vec3 nVertex(_n.x >= 0.0f ? _box.min.x : _box.max.x,
+                         _n.y >= 0.0f ? _box.min.y : _box.max.y,
+                         _n.z >= 0.0f ? _box.min.z : _box.max.z);
+            return dot(_n, nVertex) + _d >= 0.0f ? 1 : 0;
+        }
+    }
+
+    /// \brief Classify a box against a frustum for hierarchical culling.
+    /// \details In contrast to intersects(Box, FastFrustum) this is only a
+    ///     plane test. It is cheaper, but INTERSECTING is conservative (see
+    ///     Visibility). OUTSIDE and INSIDE are exact.
+    /// \param [inout] _planeMask Planes which must be tested (see
+    ///     FRUSTUM_ALL_PLANES). On return, the planes which the box straddles.
+    ///     Pass this to the tests of the children of a hierarchy: everything
+    ///     inside a box is on the positive side of the removed planes.
+    ///     If the result is OUTSIDE the mask is unchanged.
+    /// \param [inout] _lastRejectingPlane Index of the plane which is tested
+    ///     first. On return, the plane which culled the box (if OUTSIDE).
+    ///     Storing this per object exploits temporal coherence, because an
+    ///     invisible object is usually culled by the same plane in the next
+    ///     frame. Must be in [0,5].
+    inline Visibility classify( const Box& _box, const FastFrustum& _frustum, uint32& _planeMask, uint32& _lastRejectingPlane ) // TESTED
+    {
+        eiAssertWeak(_lastRejectingPlane < 6, "Invalid plane index!");
+        uint32 mask = _planeMask;
+        for(uint32 j = 0; j < 6; ++j)
+        {
+            // Start with the hint and test the others in their usual order.
+            uint32 i = j == 0 ? _lastRejectingPlane : (j <= _lastRejectingPlane ? j - 1 : j);
+            uint32 bit = 1 << i;
+            if(!(_planeMask & bit)) continue;
+            Vec3 n; float d;
+            details::frustumPlane(_frustum, i, n, d);
+            int side = details::sideOfPlane(_box, n, d);
+            if(side < 0)
+            {
+                _lastRejectingPlane = i;
+                return Visibility::OUTSIDE;
+            }
+            if(side > 0) mask &= ~bit;
+        }
+        _planeMask = mask;
+        return mask ? Visibility::INTERSECTING : Visibility::INSIDE;
+    }
+
+    inline Visibility classify( const Box& _box, const FastFrustum& _frustum )
+    {
+        uint32 planeMask = FRUSTUM_ALL_PLANES;
+        uint32 lastRejectingPlane = 0;
+        return classify(_box, _frustum, planeMask, lastRejectingPlane);
+    }
+
     /// \brief Intersection test between point and tetrahedron.
     /// \return true if the point and the tetrahedron have at least one point in common.
     inline bool intersects( const Vec3& _point, const Tetrahedron& _tetrahedron )    // TESTED
@@ -1230,6 +1516,73 @@ namespace ei {
 
     inline bool intersects( const Box& _box, const Triangle& _triangle ) { return intersects(_triangle, _box); }
 
+    namespace details {
+        // One triangle against 4 or 8 boxes (see intersects(TriangleSAT, Box8)).
+        template<uint N>
+        inline uint32 intersectsWide( const TriangleSAT& _triangle, const BoxSoA<N>& _boxes )
+        {
+            typedef typename FloatN<N>::type Float;
+            typedef typename FloatN<N>::mask Mask;
+            Float minX = Float::load(_boxes.min.x), minY = Float::load(_boxes.min.y), minZ = Float::load(_boxes.min.z);
+            Float maxX = Float::load(_boxes.max.x), maxY = Float::load(_boxes.max.y), maxZ = Float::load(_boxes.max.z);
+
+            // *** Case: A box face separates the triangle.
+            Mask separated = (Float(_triangle.max.x) < minX) | (Float(_triangle.max.y) < minY) | (Float(_triangle.max.z) < minZ)
+                           | (Float(_triangle.min.x) > maxX) | (Float(_triangle.min.y) > maxY) | (Float(_triangle.min.z) > maxZ);
+
+            Float half(0.5f);
+            Float cX = (minX + maxX) * half, cY = (minY + maxY) * half, cZ = (minZ + maxZ) * half;
+            Float hX = (maxX - minX) * half, hY = (maxY - minY) * half, hZ = (maxZ - minZ) * half;
+
+            // *** Case: The triangle plane separates the box.
+            Float offset = Float(_triangle.planeOffset) - (Float(_triangle.normal.x) * cX + Float(_triangle.normal.y) * cY + Float(_triangle.normal.z) * cZ);
+            Float projMax = Float(ei::abs(_triangle.normal.x)) * hX + Float(ei::abs(_triangle.normal.y)) * hY + Float(ei::abs(_triangle.normal.z)) * hZ;
+            separated = separated | (abs(offset) > projMax);
+
+            // *** Case: One of the 9 edge axes separates. Each axis has one 0
+            // component which is skipped.
+            for(int i = 0; i < 9; ++i)
+            {
+                const Vec3& a = _triangle.axes[i];
+                Float center, radius;
+                if(i < 3) {
+                    center = Float(a.y) * cY + Float(a.z) * cZ;
+                    radius = Float(ei::abs(a.y)) * hY + Float(ei::abs(a.z)) * hZ;
+                } else if(i < 6) {
+                    center = Float(a.x) * cX + Float(a.z) * cZ;
+                    radius = Float(ei::abs(a.x)) * hX + Float(ei::abs(a.z)) * hZ;
+                } else {
+                    center = Float(a.x) * cX + Float(a.y) * cY;
+                    radius = Float(ei::abs(a.x)) * hX + Float(ei::abs(a.y)) * hY;
+                }
+                separated = separated | ((Float(_triangle.projMin[i]) - center) > radius)
+                                      | ((Float(_triangle.projMax[i]) - center) < -radius);
+            }
+
+            return bits(~separated);
+        }
+    }
+
+    /// \brief Test one triangle against 4 or 8 boxes (e.g. voxels) with SAT.
+    /// \details The result is the same as from intersects(Triangle, Box) except
+    ///     for rounding differences in exactly touching configurations. The
+    ///     projections are computed relative to the origin instead of the box
+    ///     center to reuse the precomputed triangle extents.
+    ///     Cleared lanes of the box array are never hit.
+    /// \return A hit mask: bit i is set if the triangle intersects box i.
+    inline uint32 intersects( const TriangleSAT& _triangle, const Box8& _boxes )   // TESTED
+    {
+        return details::intersectsWide( _triangle, _boxes );
+    }
+
+    inline uint32 intersects( const TriangleSAT& _triangle, const Box4& _boxes )   // TESTED
+    {
+        return details::intersectsWide( _triangle, _boxes );
+    }
+
+    inline uint32 intersects( const Box8& _boxes, const TriangleSAT& _triangle ) { return intersects(_triangle, _boxes); }
+    inline uint32 intersects( const Box4& _boxes, const TriangleSAT& _triangle ) { return intersects(_triangle, _boxes); }
+
     /// \brief Intersection test between triangle and oriented box (based on SAT).
     /// \return true if the triangle and the box have at least one point in common.
     inline bool intersects( const Triangle& _triangle, const OBox& _obox )     // TESTED
@@ -1286,6 +1639,141 @@ namespace ei {
 
     inline bool intersects( const OBox& _obox, const Triangle& _triangle ) { return intersects(_triangle, _obox); }
 
+    namespace details {
+        // Do two segments in a plane have a point in common?
+        inline bool intersectsSegments( const Vec2& _a0, const Vec2& _a1, const Vec2& _b0, const Vec2& _b1 )
+        {
+            float oa0 = cross(_b1 - _b0, _a0 - _b0);
+            float oa1 = cross(_b1 - _b0, _a1 - _b0);
+            float ob0 = cross(_a1 - _a0, _b0 - _a0);
+            float ob1 = cross(_a1 - _a0, _b1 - _a0);
+            if(oa0 * oa1 > 0.0f || ob0 * ob1 > 0.0f) return false;
+            if(oa0 != 0.0f || oa1 != 0.0f || ob0 != 0.0f || ob1 != 0.0f) return true;
+            // Collinear: the intervals on the dominant coordinate must overlap
+            Vec2 dir = abs(_a1 - _a0) + abs(_b1 - _b0);
+            int c = dir.x >= dir.y ? 0 : 1;
+            return ei::max(ei::min(_a0[c], _a1[c]), ei::min(_b0[c], _b1[c]))
+                <= ei::min(ei::max(_a0[c], _a1[c]), ei::max(_b0[c], _b1[c]));
+        }
+
+        // Is a point inside or on the border of a triangle in the plane?
+        inline bool inside( const Vec2& _p, const Vec2* _t )
+        {
+            float o0 = cross(_t[1] - _t[0], _p - _t[0]);
+            float o1 = cross(_t[2] - _t[1], _p - _t[1]);
+            float o2 = cross(_t[0] - _t[2], _p - _t[2]);
+            return (o0 >= 0.0f && o1 >= 0.0f && o2 >= 0.0f)
+                || (o0 <= 0.0f && o1 <= 0.0f && o2 <= 0.0f);
+        }
+
+        // Triangles in the same plane overlap if two edges intersect or one
+        // triangle contains the other.
+        inline bool intersectsCoplanar( const Vec3* _a, const Vec3* _b, const Vec3& _normal )
+        {
+            // Project to the coordinate plane where the triangles are largest
+            // by dropping the largest normal component.
+            Vec3 n = abs(_normal);
+            int drop = n.x >= n.y && n.x >= n.z ? 0 : (n.y >= n.z ? 1 : 2);
+            int x = (drop + 1) % 3;
+            int y = (drop + 2) % 3;
+            Vec2 a[3], b[3];
+            for(int i = 0; i < 3; ++i)
+            {
+                a[i] = Vec2(_a[i][x], _a[i][y]);
+                b[i] = Vec2(_b[i][x], _b[i][y]);
+            }
+            for(int i = 0; i < 3; ++i)
+                for(int j = 0; j < 3; ++j)
+                    if(intersectsSegments( a[i], a[(i + 1) % 3], b[j], b[(j + 1) % 3] ))
+                        return true;
+            return inside(a[0], b) || inside(b[0], a);
+        }
+
+        // Signed distances of the vertices to the plane of the other triangle.
+        // Distances which are below the rounding error of the coordinates are
+        // snapped to 0. Returns false if all vertices are strictly on one side.
+        inline bool planeDistances( const Vec3* _v, const Vec3& _normal, const Vec3& _origin, float* _dist )
+        {
+            float threshold = 1e-12f * lensq(_normal);
+            for(int i = 0; i < 3; ++i)
+            {
+                Vec3 d = _v[i] - _origin;
+                _dist[i] = dot(_normal, d);
+                if(_dist[i] * _dist[i] <= threshold * lensq(d))
+                    _dist[i] = 0.0f;
+            }
+            return !((_dist[0] > 0.0f && _dist[1] > 0.0f && _dist[2] > 0.0f)
+                  || (_dist[0] < 0.0f && _dist[1] < 0.0f && _dist[2] < 0.0f));
+        }
+
+        // Interval of a triangle on the intersection line of the two planes,
+        // where _p are the projections of the vertices onto the line.
+        inline void lineInterval( const float* _p, const float* _dist, float& _min, float& _max )
+        {
+            // Find the vertex which is alone on its side of the plane
+            int a;
+            if(_dist[0] * _dist[1] > 0.0f) a = 2;
+            else if(_dist[0] * _dist[2] > 0.0f) a = 1;
+            else if(_dist[1] * _dist[2] > 0.0f || _dist[0] != 0.0f) a = 0;
+            else if(_dist[1] != 0.0f) a = 1;
+            else a = 2;
+            int b = (a + 1) % 3;
+            int c = (a + 2) % 3;
+            float t0 = _p[a] + (_p[b] - _p[a]) * _dist[a] / (_dist[a] - _dist[b]);
+            float t1 = _p[a] + (_p[c] - _p[a]) * _dist[a] / (_dist[a] - _dist[c]);
+            _min = ei::min(t0, t1);
+            _max = ei::max(t0, t1);
+        }
+
+        // Interval overlap test from Tomas Möller "A Fast Triangle-Triangle
+        // Intersection Test" (1997). The normals need not be normalized.
+        inline bool intersectsTriangles( const Vec3* _a, const Vec3& _normalA, const Vec3* _b, const Vec3& _normalB )
+        {
+            // *** Case: A triangle is on one side of the plane of the other
+            float distB[3], distA[3];
+            if(!planeDistances( _b, _normalA, _a[0], distB )) return false;
+            if(!planeDistances( _a, _normalB, _b[0], distA )) return false;
+
+            if((distA[0] == 0.0f && distA[1] == 0.0f && distA[2] == 0.0f)
+                || (distB[0] == 0.0f && distB[1] == 0.0f && distB[2] == 0.0f))
+                return intersectsCoplanar( _a, _b, lensq(_normalA) >= lensq(_normalB) ? _normalA : _normalB );
+
+            // *** Case: Both triangles cut the intersection line of the
+            // planes. They intersect if the intervals on this line overlap.
+            // Projecting onto the dominant axis of the line instead of the
+            // line itself changes the scale only.
+            Vec3 dir = abs(cross(_normalA, _normalB));
+            int axis = dir.x >= dir.y && dir.x >= dir.z ? 0 : (dir.y >= dir.z ? 1 : 2);
+            float pa[3] = {_a[0][axis], _a[1][axis], _a[2][axis]};
+            float pb[3] = {_b[0][axis], _b[1][axis], _b[2][axis]};
+            float minA, maxA, minB, maxB;
+            lineInterval( pa, distA, minA, maxA );
+            lineInterval( pb, distB, minB, maxB );
+            return ei::max(minA, minB) <= ei::min(maxA, maxB);
+        }
+    }
+
+    /// \brief Intersection test between two triangles.
+    /// \details Based on the interval overlap method of Tomas Möller. Coplanar
+    ///     triangles are tested in 2D.
+    /// \return true if the triangles have at least one point in common.
+    inline bool intersects( const Triangle& _triangle0, const Triangle& _triangle1 )  // TESTED
+    {
+        const Vec3* a = &_triangle0.v(0);
+        const Vec3* b = &_triangle1.v(0);
+        return details::intersectsTriangles( a, cross(a[1] - a[0], a[2] - a[0]), b, cross(b[1] - b[0], b[2] - b[0]) );
+    }
+
+    /// \brief Intersection test between two triangles with precomputed
+    ///     normals. Gives the same results as intersects(Triangle, Triangle)
+    ///     up to rounding.
+    inline bool intersects( const FastTriangle& _triangle0, const FastTriangle& _triangle1 )  // TESTED
+    {
+        const Vec3 a[3] = {_triangle0.v0, _triangle0.v0 + _triangle0.e01, _triangle0.v0 + _triangle0.e02};
+        const Vec3 b[3] = {_triangle1.v0, _triangle1.v0 + _triangle1.e01, _triangle1.v0 + _triangle1.e02};
+        return details::intersectsTriangles( a, _triangle0.normal, b, _triangle1.normal );
+    }
+
     /// \brief Intersection test between plane and box.
     /// \return true if the plane and the box have at least one point in common.
     inline bool intersects( const Plane& _plane, const Box& _box )
@@ -1326,6 +1814,32 @@ namespace ei {
 
     inline bool intersects( const OBox& _obox, const Plane& _plane ) { return intersects(_plane, _obox); }
 
+    /// \brief On which side of the plane is the box?
+    /// \details Uses the same computation as intersects(Plane, Box), i.e. the
+    ///     result is STRADDLING if and only if intersects() returns true.
+    inline PlaneSide classify( const Plane& _plane, const Box& _box )   // TESTED
+    {
+        float boxLocalPlaneOffset = _plane.d + dot(_plane.n, center(_box));
+        float projMax = dot(abs(_plane.n), _box.max - _box.min) * 0.5f;
+        if(abs(boxLocalPlaneOffset) <= projMax) return PlaneSide::STRADDLING;
+        return boxLocalPlaneOffset > 0.0f ? PlaneSide::FRONT : PlaneSide::BACK;
+    }
+
+    /// \brief On which side of the plane is the oriented box?
+    /// \details Uses the same computation as intersects(Plane, OBox), i.e. the
+    ///     result is STRADDLING if and only if intersects() returns true.
+    inline PlaneSide classify( const Plane& _plane, const OBox& _obox )   // TESTED
+    {
+        float boxLocalPlaneOffset = _plane.d + dot(_plane.n, _obox.center);
+        Vec3 boxLocalPlaneNormal = transform(_plane.n, conjugate(_obox.orientation));
+        float projMax = dot(abs(boxLocalPlaneNormal), _obox.halfSides);
+        if(abs(boxLocalPlaneOffset) <= projMax) return PlaneSide::STRADDLING;
+        return boxLocalPlaneOffset > 0.0f ? PlaneSide::FRONT : PlaneSide::BACK;
+    }
+
+    inline PlaneSide classify( const Box& _box, const Plane& _plane ) { return classify(_plane, _box); }
+    inline PlaneSide classify( const OBox& _obox, const Plane& _plane ) { return classify(_plane, _obox); }
+
     /// \brief Intersection test between cone and point.
     inline bool intersects( const Vec3& _point, const Cone& _cone )
     {
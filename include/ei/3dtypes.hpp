@@ -843,6 +843,132 @@ namespace ei {
         }
     };
 
+    /// \brief N vectors in a structure of arrays layout.
+    /// \details Packet types use this to load one coordinate of all N
+    ///     elements at once.
+    template<uint N>
+    struct alignas(N * sizeof(float)) Vec3SoA
+    {
+        float x[N];
+        float y[N];
+        float z[N];
+
+        /// \brief Extract the i-th vector.
+        Vec3 get(uint _i) const noexcept
+        {
+            eiAssertWeak(_i < N, "Index out of bounds!");
+            return Vec3(x[_i], y[_i], z[_i]);
+        }
+
+        /// \brief Overwrite the i-th vector.
+        void set(uint _i, const Vec3& _v) noexcept
+        {
+            eiAssertWeak(_i < N, "Index out of bounds!");
+            x[_i] = _v.x;
+            y[_i] = _v.y;
+            z[_i] = _v.z;
+        }
+    };
+
+    /// \brief A packet of N (4 or 8) rays for coherent ray tests.
+    /// \details Like FastRay the packet contains the precomputed reciprocal
+    ///     directions. Additionally, each ray has a maximum distance (e.g. the
+    ///     closest hit so far) to discard farther hits in the packet tests.
+    template<uint N>
+    struct RayPacket
+    {
+        static_assert(N == 4 || N == 8, "Only packets of 4 and 8 rays are supported.");
+
+        Vec3SoA<N> origin;
+        Vec3SoA<N> direction;       ///< Normalized directions
+        Vec3SoA<N> invDirection;    ///< 1/direction
+        Vec3SoA<N> oDivDir;         ///< origin / direction
+        alignas(N * sizeof(float)) float tMax[N];
+
+        /// \brief Create uninitialized packet.
+        RayPacket() noexcept {}
+
+        /// \brief Create from N rays which all have the same maximum distance.
+        RayPacket(const Ray* _rays, float _tMax = INF) noexcept
+        {
+            for(uint i = 0; i < N; ++i)
+                set(i, _rays[i], _tMax);
+        }
+
+        /// \brief Overwrite a single ray in the packet.
+        void set(uint _lane, const Ray& _ray, float _tMax = INF) noexcept
+        {
+            // Same precomputation as in FastRay
+            Vec3 invDir = ei::clamp(1.0f / _ray.direction, -1e19f, 1e19f);
+            origin.set(_lane, _ray.origin);
+            direction.set(_lane, _ray.direction);
+            invDirection.set(_lane, invDir);
+            oDivDir.set(_lane, _ray.origin * invDir);
+            tMax[_lane] = _tMax;
+        }
+
+        /// \brief Extract a single ray.
+        Ray get(uint _lane) const noexcept
+        {
+            return Ray(origin.get(_lane), direction.get(_lane));
+        }
+    };
+
+    typedef RayPacket<4> RayPacket4;
+    typedef RayPacket<8> RayPacket8;
+
+    /// \brief N axis aligned boxes in a structure of arrays layout.
+    /// \details This is the child bounds layout of wide BVH nodes which are
+    ///     tested against a single FastRay at once. Unused lanes should be
+    ///     cleared. An empty lane has inverted infinite bounds and is never hit.
+    template<uint N>
+    struct BoxSoA
+    {
+        static_assert(N == 4 || N == 8, "Only 4 and 8 boxes are supported.");
+
+        Vec3SoA<N> min;
+        Vec3SoA<N> max;
+
+        /// \brief Create uninitialized boxes.
+        BoxSoA() noexcept {}
+
+        /// \brief Create from _num <= N boxes. The remaining lanes are cleared.
+        BoxSoA(const Box* _boxes, uint _num = N) noexcept
+        {
+            eiAssertWeak(_num <= N, "Too many boxes!");
+            for(uint i = 0; i < _num; ++i)
+                set(i, _boxes[i]);
+            for(uint i = _num; i < N; ++i)
+                clear(i);
+        }
+
+        /// \brief Overwrite a single box.
+        void set(uint _lane, const Box& _box) noexcept
+        {
+            min.set(_lane, _box.min);
+            max.set(_lane, _box.max);
+        }
+
+        /// \brief Make a lane empty such that it is never hit.
+        void clear(uint _lane) noexcept
+        {
+            min.set(_lane, Vec3(INF));
+            max.set(_lane, Vec3(-INF));
+        }
+
+        /// \brief Extract a single box.
+        Box get(uint _lane) const noexcept
+        {
+            Box box;
+            box.min = min.get(_lane);
+            box.max = max.get(_lane);
+            return box;
+        }
+    };
+
+    typedef BoxSoA<4> Box4;
+    typedef BoxSoA<8> Box8;
+
     struct FastFrustum
     {
         const DOP nf;         ///< Parallel near and far planes
@@ -961,6 +1087,71 @@ namespace ei {
         }
     };
 
+    /// \brief Triangle with precomputed separating axes for box tests.
+    /// \details Contains all triangle dependent parts of the SAT in
+    ///     intersects(Triangle, Box): the bounding box, the plane and the 9
+    ///     edge axes with the projected extents of the triangle. This is
+    ///     useful if one triangle is tested against many boxes (voxelization).
+    struct TriangleSAT
+    {
+        const Vec3 min;             ///< Bounding box of the triangle
+        const Vec3 max;             ///< Bounding box of the triangle
+        const Vec3 normal;          ///< Not normalized normal
+        const float planeOffset;    ///< dot(normal, v0)
+        /// Axes cross(unit axis, edge) in the order x (e0, e1, e2), y (...), z (...).
+        /// The component of the unit axis is 0.
+        const Vec3 axes[9];
+        const float projMin[9];     ///< Minimum of dot(axis, v) over the three vertices
+        const float projMax[9];     ///< Maximum of dot(axis, v) over the three vertices
+
+        /// \brief Construction from dynamic variant.
+        explicit TriangleSAT(const Triangle & _triangle) noexcept :
+            min(ei::min(_triangle.v0, _triangle.v1, _triangle.v2)),
+            max(ei::max(_triangle.v0, _triangle.v1, _triangle.v2)),
+            normal(cross(_triangle.v1 - _triangle.v0, _triangle.v2 - _triangle.v0)),
+            planeOffset(dot(normal, _triangle.v0)),
+            axes{}, projMin{}, projMax{}
+        {
+            Vec3 e0 = _triangle.v1 - _triangle.v0;
+            Vec3 e1 = _triangle.v2 - _triangle.v0;
+            Vec3 e2 = _triangle.v2 - _triangle.v1;
+            Vec3* axis = const_cast<Vec3*>(axes);
+            axis[0] = Vec3(0.0f, e0.z, -e0.y);
+            axis[1] = Vec3(0.0f, e1.z, -e1.y);
+            axis[2] = Vec3(0.0f, e2.z, -e2.y);
+            axis[3] = Vec3(-e0.z, 0.0f, e0.x);
+            axis[4] = Vec3(-e1.z, 0.0f, e1.x);
+            axis[5] = Vec3(-e2.z, 0.0f, e2.x);
+            axis[6] = Vec3(e0.y, -e0.x, 0.0f);
+            axis[7] = Vec3(e1.y, -e1.x, 0.0f);
+            axis[8] = Vec3(e2.y, -e2.x, 0.0f);
+            for(int i = 0; i < 9; ++i)
+            {
+                float p0 = dot(axes[i], _triangle.v0);
+                float p1 = dot(axes[i], _triangle.v1);
+                float p2 = dot(axes[i], _triangle.v2);
+                const_cast<float&>(projMin[i]) = ei::min(p0, p1, p2);
+                const_cast<float&>(projMax[i]) = ei::max(p0, p1, p2);
+            }
+        }
+
+        /// \brief Overwrite the current data (auto generation not possible because of const members)
+        TriangleSAT& operator = (const TriangleSAT& _triangle) noexcept
+        {
+            const_cast<Vec3&>(min) = _triangle.min;
+            const_cast<Vec3&>(max) = _triangle.max;
+            const_cast<Vec3&>(normal) = _triangle.normal;
+            const_cast<float&>(planeOffset) = _triangle.planeOffset;
+            for(int i = 0; i < 9; ++i)
+            {
+                const_cast<Vec3&>(axes[i]) = _triangle.axes[i];
+                const_cast<float&>(projMin[i]) = _triangle.projMin[i];
+                const_cast<float&>(projMax[i]) = _triangle.projMax[i];
+            }
+            return *this;
+        }
+    };
+
 
     // ************************************************************************* //
     // VOLUME AND SURFACE METHODS                                                //
@@ -0,0 +1,2059 @@
+#pragma once
+
+#include "3dintersection.hpp"
+#include "details/parallel.hpp"
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                       BOUNDING VOLUME HIERARCHY                           //
+    // ************************************************************************* //
+    // A binary BVH over arbitrary primitives which are only given by their
+    // bounding boxes. The nodes are stored in one flat array. The two children
+    // of an inner node are always stored next to each other, so a traversal
+    // finds both child boxes in the same cache line. Leaves reference a range
+    // of the index array, which contains indices into the primitive array of
+    // the user.
+
+    /// \brief Node of a binary BVH (32 bytes).
+    struct BVHNode
+    {
+        Box bounds;
+        uint32 first;       ///< Inner node: index of the left child, the right child is first+1. Leaf: first entry in BVH::indices.
+        uint32 count;       ///< Number of primitives of a leaf, 0 for inner nodes.
+
+        bool isLeaf() const noexcept { return count != 0; }
+    };
+
+    /// \brief Binary BVH in a flat node array.
+    /// \details An empty BVH has no nodes. Otherwise nodes[0] is the root.
+    struct BVH
+    {
+        std::vector<BVHNode> nodes;
+        std::vector<uint32> indices;    ///< Primitive indices referenced by the leaves.
+    };
+
+    namespace details {
+        // Number of bins per axis for the SAH split search.
+        const uint32 BVH_NUM_BINS = 16;
+        // Deeper nodes become leaves, regardless of their size. This bounds
+        // the traversal stack for any input. The LBVH is never deeper than
+        // the number of code bits plus 32.
+        const uint32 BVH_MAX_DEPTH = 128;
+        // Cost of a traversal step relative to one primitive test.
+        const float BVH_TRAVERSAL_COST = 1.0f;
+
+        inline Box emptyBox()
+        {
+            Box box;
+            box.min = Vec3(INF);
+            box.max = Vec3(-INF);
+            return box;
+        }
+
+        // Component wise to avoid the temporary vectors in the build loops.
+        inline void extend( Box& _box, const Box& _other )
+        {
+            _box.min.x = ei::min(_box.min.x, _other.min.x); _box.max.x = ei::max(_box.max.x, _other.max.x);
+            _box.min.y = ei::min(_box.min.y, _other.min.y); _box.max.y = ei::max(_box.max.y, _other.max.y);
+            _box.min.z = ei::min(_box.min.z, _other.min.z); _box.max.z = ei::max(_box.max.z, _other.max.z);
+        }
+
+        // Extend by the center of _other (same as center(Box)).
+        inline void extendByCenter( Box& _box, const Box& _other )
+        {
+            float cx = (_other.min.x + _other.max.x) * 0.5f;
+            float cy = (_other.min.y + _other.max.y) * 0.5f;
+            float cz = (_other.min.z + _other.max.z) * 0.5f;
+            _box.min.x = ei::min(_box.min.x, cx); _box.max.x = ei::max(_box.max.x, cx);
+            _box.min.y = ei::min(_box.min.y, cy); _box.max.y = ei::max(_box.max.y, cy);
+            _box.min.z = ei::min(_box.min.z, cz); _box.max.z = ei::max(_box.max.z, cz);
+        }
+
+        struct SAHBin
+        {
+            Box bounds;
+            uint32 count;
+        };
+
+        // Bounding boxes of triangles for the builders and the refit. The
+        // sequential parallel pass is cheaper than computing the boxes where
+        // they are needed, because the tree accesses them in random order.
+        inline void triangleBounds( const Triangle* _triangles, uint32 _num, uint32 _numThreads, std::vector<Box>& _bounds )
+        {
+            _bounds.resize(_num);
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), _num / 16384));
+            runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                uint32 begin, end;
+                threadRange(_num, _thread, _numThreads, begin, end);
+                for(uint32 i = begin; i < end; ++i)
+                    _bounds[i] = Box(_triangles[i]);
+            });
+        }
+
+        // Primitive bounds with the index of the primitive. The builder sorts
+        // these instead of indices to access the bounds sequentially.
+        struct BVHPrimRef
+        {
+            Box bounds;
+            uint32 index;
+        };
+
+        inline uint32 sahBin( const Box& _bounds, const Box& _centerBounds, const Vec3& _scale, int _axis )
+        {
+            float c = (_bounds.min[_axis] + _bounds.max[_axis]) * 0.5f;
+            return ei::min(BVH_NUM_BINS - 1, uint32((c - _centerBounds.min[_axis]) * _scale[_axis]));
+        }
+
+        // Bin scale of each axis. Flat axes have one filled bin and thus no
+        // valid split.
+        inline Vec3 sahScale( const Box& _centerBounds )
+        {
+            Vec3 extent = _centerBounds.max - _centerBounds.min;
+            Vec3 scale;
+            for(int a = 0; a < 3; ++a)
+                scale[a] = extent[a] > 0.0f ? BVH_NUM_BINS / extent[a] : 0.0f;
+            return scale;
+        }
+
+        inline void clearBins( SAHBin* _bins )
+        {
+            for(uint32 b = 0; b < 3 * BVH_NUM_BINS; ++b)
+            {
+                _bins[b].bounds = emptyBox();
+                _bins[b].count = 0;
+            }
+        }
+
+        // Bin the centroids along all axes at once. _bins has BVH_NUM_BINS
+        // entries per axis.
+        inline void binSAH( const BVHPrimRef* _refs, uint32 _num, const Box& _centerBounds, const Vec3& _scale, SAHBin* _bins )
+        {
+            for(uint32 i = 0; i < _num; ++i)
+            {
+                // Local copy, the bins could alias the references otherwise
+                Box bounds = _refs[i].bounds;
+                for(int a = 0; a < 3; ++a)
+                {
+                    SAHBin& bin = _bins[a * BVH_NUM_BINS + sahBin(bounds, _centerBounds, _scale, a)];
+                    extend(bin.bounds, bounds);
+                    bin.count++;
+                }
+            }
+        }
+
+        // Decide if a node with _num primitives is split and find the best
+        // binned SAH split. Returns false for a leaf. _axis is -1 if the node
+        // must be split in the middle of its range (all centroids are equal,
+        // but the node is too large).
+        inline bool bestSplitSAH( const SAHBin* _bins, uint32 _num, const Box& _bounds, uint32 _maxLeafSize, int& _axis, uint32& _bin )
+        {
+            if(_num == 1) return false;
+            // Sweep from the right to get the cost of all right sides, then
+            // from the left to evaluate the splits behind each bin.
+            float bestCost = INF;
+            int bestAxis = 0;
+            uint32 bestBin = 0;
+            for(int a = 0; a < 3; ++a)
+            {
+                const SAHBin* bins = _bins + a * BVH_NUM_BINS;
+                float rightCost[BVH_NUM_BINS];
+                Box accum = emptyBox();
+                uint32 count = 0;
+                for(uint32 b = BVH_NUM_BINS - 1; b > 0; --b)
+                {
+                    extend(accum, bins[b].bounds);
+                    count += bins[b].count;
+                    rightCost[b] = count ? count * surface(accum) : 0.0f;
+                }
+                accum = emptyBox();
+                count = 0;
+                for(uint32 b = 0; b < BVH_NUM_BINS - 1; ++b)
+                {
+                    extend(accum, bins[b].bounds);
+                    count += bins[b].count;
+                    if(count == 0 || count == _num) continue;
+                    float cost = count * surface(accum) + rightCost[b+1];
+                    if(cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = a;
+                        bestBin = b;
+                    }
+                }
+            }
+
+            // Compare against a leaf: C_trav + (A_l N_l + A_r N_r) / A < N
+            float area = surface(_bounds);
+            bool cheaper = BVH_TRAVERSAL_COST * area + bestCost < _num * area;
+            if(bestCost < INF && (cheaper || _num > _maxLeafSize))
+            {
+                _axis = bestAxis;
+                _bin = bestBin;
+                return true;
+            }
+            _axis = -1;
+            return _num > _maxLeafSize;
+        }
+
+        // Decide if the node with the primitives _refs[0, _num) is split and
+        // partition the primitives by the best binned SAH split.
+        // Returns the number of primitives of the left child or 0 for a leaf.
+        inline uint32 splitSAH( BVHPrimRef* _refs, uint32 _num, const Box& _bounds, const Box& _centerBounds, uint32 _maxLeafSize )
+        {
+            if(_num == 1) return 0;
+            Vec3 scale = sahScale(_centerBounds);
+            SAHBin bins[3 * BVH_NUM_BINS];
+            clearBins(bins);
+            binSAH(_refs, _num, _centerBounds, scale, bins);
+            int axis;
+            uint32 bin;
+            if(!bestSplitSAH(bins, _num, _bounds, _maxLeafSize, axis, bin))
+                return 0;
+            if(axis < 0)
+                return _num / 2;
+            BVHPrimRef* left = _refs;
+            BVHPrimRef* right = _refs + _num;
+            while(left < right)
+            {
+                if(sahBin(left->bounds, _centerBounds, scale, axis) <= bin) ++left;
+                else std::swap(*left, *--right);
+            }
+            return uint32(left - _refs);
+        }
+
+        // Serial SAH build of the primitives _refs[_begin, _end) with a depth
+        // limit. The root is _nodes[0] and the leaves reference the range
+        // in _refs.
+        inline void buildSAHSubtree( BVHPrimRef* _refs, uint32 _begin, uint32 _end, uint32 _maxLeafSize, uint32 _maxDepth, std::vector<BVHNode>& _nodes )
+        {
+            _nodes.clear();
+            _nodes.reserve(2 * ((_end - _begin) / _maxLeafSize) + 1);
+            _nodes.resize(1);
+
+            struct Task { uint32 node, begin, end, depth; };
+            Task stack[BVH_MAX_DEPTH + 1];
+            stack[0] = Task{0, _begin, _end, 0};
+            int stackSize = 1;
+            while(stackSize > 0)
+            {
+                Task task = stack[--stackSize];
+                Box bounds = emptyBox(), centerBounds = emptyBox();
+                for(uint32 i = task.begin; i < task.end; ++i)
+                {
+                    extend(bounds, _refs[i].bounds);
+                    extendByCenter(centerBounds, _refs[i].bounds);
+                }
+                _nodes[task.node].bounds = bounds;
+                _nodes[task.node].first = task.begin;
+                _nodes[task.node].count = task.end - task.begin;
+                if(task.depth >= _maxDepth) continue;
+                uint32 numLeft = splitSAH( _refs + task.begin, task.end - task.begin, bounds, centerBounds, _maxLeafSize );
+                if(numLeft == 0) continue;
+
+                uint32 children = (uint32)_nodes.size();
+                _nodes[task.node].first = children;
+                _nodes[task.node].count = 0;
+                _nodes.resize(children + 2);
+                // Left child on top: it is processed first
+                stack[stackSize++] = Task{children + 1, task.begin + numLeft, task.end, task.depth + 1};
+                stack[stackSize++] = Task{children, task.begin, task.begin + numLeft, task.depth + 1};
+            }
+        }
+
+        // Nodes with more primitives are split by all threads together.
+        // Smaller ones are roots of subtrees which are built by one thread
+        // each. This is a constant, such that the tree does not depend on
+        // the number of threads.
+        const uint32 BVH_PARALLEL_SPLIT_SIZE = 1 << 16;
+
+        struct SAHTask
+        {
+            uint32 node;            ///< Index in the nodes above the subtrees
+            uint32 begin, end;      ///< Range of primitive references
+            uint32 depth;
+            Box bounds;
+            Box centerBounds;
+        };
+
+        // SAH build with a depth limit, such that subtrees can be rebuilt
+        // without exceeding BVH_MAX_DEPTH in total.
+        // The large nodes at the top are split one after another by all
+        // threads: each thread bins a part of the primitives and the
+        // partition is a stable parallel scatter. Below, the subtrees are
+        // built in parallel by one thread each into their own node arrays.
+        // Finally, the nodes are concatenated in a fixed order. Binning and
+        // partitioning give the same results for any number of threads, so
+        // the tree is deterministic.
+        inline BVH buildSAH( const Box* _bounds, uint32 _num, uint32 _maxLeafSize, uint32 _maxDepth, uint32 _numThreads = 1 )
+        {
+            eiAssert( _maxLeafSize > 0, "A leaf must be allowed to contain primitives." );
+            BVH bvh;
+            if(_num == 0) return bvh;
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), _num / 16384));
+            std::vector<BVHPrimRef> refs(_num);
+            std::vector<BVHPrimRef> scattered(_num > BVH_PARALLEL_SPLIT_SIZE ? _num : 0);
+            std::vector<uint8> isLeft(scattered.size());
+            std::vector<BVHNode> top(1);
+            std::vector<SAHTask> large, subtrees;
+            std::vector<std::vector<BVHNode>> subtreeNodes;
+            std::vector<uint32> subtreeOffsets;
+            // Partial results of each thread
+            std::vector<SAHBin> threadBins(size_t(numThreads) * 3 * BVH_NUM_BINS);
+            std::vector<Box> threadBounds(4 * numThreads);
+            std::vector<uint32> threadNumLeft(numThreads);
+            // Split of the current large node
+            bool split = false;
+            int splitAxis = 0;
+            uint32 splitBin = 0;
+            Vec3 splitScale;
+            std::atomic<uint32> nextSubtree(0);
+            Barrier barrier(numThreads);
+
+            // Make a child task of a large node. Only called by thread 0.
+            auto addTask = [&](const SAHTask& _task) {
+                if(_task.end - _task.begin > BVH_PARALLEL_SPLIT_SIZE && _task.depth < _maxDepth)
+                    large.push_back(_task);
+                else
+                    subtrees.push_back(_task);
+            };
+
+            runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                Box* bounds = &threadBounds[4 * _thread];
+                uint32 begin, end;
+                threadRange(_num, _thread, _numThreads, begin, end);
+                bounds[0] = emptyBox();
+                bounds[1] = emptyBox();
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    refs[i] = BVHPrimRef{_bounds[i], i};
+                    extend(bounds[0], _bounds[i]);
+                    extendByCenter(bounds[1], _bounds[i]);
+                }
+                barrier.wait();
+                if(_thread == 0)
+                {
+                    SAHTask root{0, 0, _num, 0, emptyBox(), emptyBox()};
+                    for(uint32 t = 0; t < _numThreads; ++t)
+                    {
+                        extend(root.bounds, threadBounds[4 * t]);
+                        extend(root.centerBounds, threadBounds[4 * t + 1]);
+                    }
+                    addTask(root);
+                }
+                barrier.wait();
+
+                // All threads split the large nodes in breadth first order.
+                // Only thread 0 changes the shared state between two waits.
+                for(size_t k = 0; k < large.size(); ++k)
+                {
+                    const SAHTask task = large[k];
+                    uint32 num = task.end - task.begin;
+                    threadRange(num, _thread, _numThreads, begin, end);
+                    begin += task.begin;
+                    end += task.begin;
+                    Vec3 scale = sahScale(task.centerBounds);
+                    SAHBin* bins = &threadBins[size_t(_thread) * 3 * BVH_NUM_BINS];
+                    clearBins(bins);
+                    binSAH(refs.data() + begin, end - begin, task.centerBounds, scale, bins);
+                    barrier.wait();
+                    if(_thread == 0)
+                    {
+                        for(uint32 t = 1; t < _numThreads; ++t)
+                            for(uint32 b = 0; b < 3 * BVH_NUM_BINS; ++b)
+                            {
+                                extend(bins[b].bounds, threadBins[size_t(t) * 3 * BVH_NUM_BINS + b].bounds);
+                                bins[b].count += threadBins[size_t(t) * 3 * BVH_NUM_BINS + b].count;
+                            }
+                        split = bestSplitSAH(bins, num, task.bounds, _maxLeafSize, splitAxis, splitBin);
+                        splitScale = scale;
+                        top[task.node].bounds = task.bounds;
+                        top[task.node].first = task.begin;
+                        top[task.node].count = num;
+                    }
+                    barrier.wait();
+                    if(!split) continue;
+
+                    // Stable partition: count, then scatter behind the
+                    // references of the previous threads.
+                    uint32 numLeft = 0;
+                    for(uint32 i = begin; i < end; ++i)
+                    {
+                        isLeft[i] = splitAxis < 0 ? i < task.begin + num / 2
+                            : sahBin(refs[i].bounds, task.centerBounds, splitScale, splitAxis) <= splitBin;
+                        numLeft += isLeft[i];
+                    }
+                    threadNumLeft[_thread] = numLeft;
+                    barrier.wait();
+                    uint32 left = task.begin, right = task.begin;
+                    for(uint32 t = 0; t < _numThreads; ++t)
+                        right += threadNumLeft[t];
+                    uint32 totalLeft = right - task.begin;
+                    for(uint32 t = 0; t < _thread; ++t)
+                    {
+                        uint32 b, e;
+                        threadRange(num, t, _numThreads, b, e);
+                        left += threadNumLeft[t];
+                        right += e - b - threadNumLeft[t];
+                    }
+                    for(int c = 0; c < 4; ++c)
+                        bounds[c] = emptyBox();
+                    for(uint32 i = begin; i < end; ++i)
+                    {
+                        int side = isLeft[i] ? 0 : 2;
+                        extend(bounds[side], refs[i].bounds);
+                        extendByCenter(bounds[side + 1], refs[i].bounds);
+                        scattered[side ? right++ : left++] = refs[i];
+                    }
+                    barrier.wait();
+                    std::copy(scattered.begin() + begin, scattered.begin() + end, refs.begin() + begin);
+                    if(_thread == 0)
+                    {
+                        SAHTask leftTask{uint32(top.size()), task.begin, task.begin + totalLeft, task.depth + 1, emptyBox(), emptyBox()};
+                        SAHTask rightTask{uint32(top.size() + 1), task.begin + totalLeft, task.end, task.depth + 1, emptyBox(), emptyBox()};
+                        for(uint32 t = 0; t < _numThreads; ++t)
+                        {
+                            extend(leftTask.bounds, threadBounds[4 * t]);
+                            extend(leftTask.centerBounds, threadBounds[4 * t + 1]);
+                            extend(rightTask.bounds, threadBounds[4 * t + 2]);
+                            extend(rightTask.centerBounds, threadBounds[4 * t + 3]);
+                        }
+                        top[task.node].first = uint32(top.size());
+                        top[task.node].count = 0;
+                        top.resize(top.size() + 2);
+                        addTask(leftTask);
+                        addTask(rightTask);
+                    }
+                    barrier.wait();
+                }
+
+                // Independent subtrees
+                if(_thread == 0) subtreeNodes.resize(subtrees.size());
+                barrier.wait();
+                for(uint32 s = nextSubtree++; s < subtrees.size(); s = nextSubtree++)
+                    buildSAHSubtree( refs.data(), subtrees[s].begin, subtrees[s].end, _maxLeafSize, _maxDepth - subtrees[s].depth, subtreeNodes[s] );
+                barrier.wait();
+
+                // Concatenate: the nodes above the subtrees come first, then
+                // all subtrees without their roots in task order.
+                if(_thread == 0)
+                {
+                    subtreeOffsets.resize(subtrees.size());
+                    uint32 numNodes = uint32(top.size());
+                    for(size_t s = 0; s < subtrees.size(); ++s)
+                    {
+                        subtreeOffsets[s] = numNodes - 1;
+                        numNodes += uint32(subtreeNodes[s].size()) - 1;
+                    }
+                    bvh.nodes.resize(numNodes);
+                    std::copy(top.begin(), top.end(), bvh.nodes.begin());
+                    bvh.indices.resize(_num);
+                }
+                barrier.wait();
+                threadRange(uint32(subtrees.size()), _thread, _numThreads, begin, end);
+                for(uint32 s = begin; s < end; ++s)
+                {
+                    const std::vector<BVHNode>& nodes = subtreeNodes[s];
+                    for(size_t i = 0; i < nodes.size(); ++i)
+                    {
+                        BVHNode node = nodes[i];
+                        if(!node.isLeaf()) node.first += subtreeOffsets[s];
+                        bvh.nodes[i ? subtreeOffsets[s] + i : subtrees[s].node] = node;
+                    }
+                }
+                threadRange(_num, _thread, _numThreads, begin, end);
+                for(uint32 i = begin; i < end; ++i)
+                    bvh.indices[i] = refs[i].index;
+            });
+            return bvh;
+        }
+    }
+
+    /// \brief Build a BVH with the binned surface area heuristic (SAH).
+    /// \details Each node is split at the best of 16 bins per axis by the
+    ///     centroids of the primitives. Nodes with more than _maxLeafSize
+    ///     primitives are always split, smaller ones only if the SAH
+    ///     estimates the split to be cheaper than the leaf.
+    ///     The build runs in parallel. The tree is the same for any number
+    ///     of threads.
+    /// \param _bounds Bounding boxes of the primitives. The leaves contain
+    ///     indices into this array.
+    /// \param _maxLeafSize Maximum number of primitives per leaf. It is only
+    ///     exceeded for nodes at the maximum depth of 128.
+    /// \param [in] _numThreads Number of threads or 0 for all hardware
+    ///     threads.
+    inline BVH buildBVH( const Box* _bounds, uint32 _num, uint32 _maxLeafSize = 4, uint32 _numThreads = 0 )
+    {
+        return details::buildSAH( _bounds, _num, _maxLeafSize, details::BVH_MAX_DEPTH, _numThreads );
+    }
+
+    /// \brief Build a BVH over triangles with the binned SAH.
+    /// \details The leaves contain indices into _triangles.
+    inline BVH buildBVH( const Triangle* _triangles, uint32 _num, uint32 _maxLeafSize = 4, uint32 _numThreads = 0 )
+    {
+        std::vector<Box> bounds;
+        details::triangleBounds( _triangles, _num, _numThreads, bounds );
+        return buildBVH( bounds.data(), _num, _maxLeafSize, _numThreads );
+    }
+
+    namespace details {
+        // Spread the lowest 10 bits such that there are two zeros between
+        // each two bits.
+        inline uint32 expandBits( uint32 _x )
+        {
+            _x &= 0x3ff;
+            _x = (_x | (_x << 16)) & 0x030000ff;
+            _x = (_x | (_x << 8)) & 0x0300f00f;
+            _x = (_x | (_x << 4)) & 0x030c30c3;
+            _x = (_x | (_x << 2)) & 0x09249249;
+            return _x;
+        }
+
+        // Spread the lowest 21 bits.
+        inline uint64 expandBits( uint64 _x )
+        {
+            _x &= 0x1fffff;
+            _x = (_x | (_x << 32)) & 0x001f00000000ffffull;
+            _x = (_x | (_x << 16)) & 0x001f0000ff0000ffull;
+            _x = (_x | (_x << 8)) & 0x100f00f00f00f00full;
+            _x = (_x | (_x << 4)) & 0x10c30c30c30c30c3ull;
+            _x = (_x | (_x << 2)) & 0x1249249249249249ull;
+            return _x;
+        }
+
+        // Morton code of a point which is quantized relative to a box. Code
+        // is uint32 (30 bit) or uint64 (63 bit).
+        template<typename Code>
+        inline Code mortonCode( const Vec3& _point, const Vec3& _min, const Vec3& _scale )
+        {
+            const float maxCell = float((1u << (sizeof(Code) == 4 ? 10 : 21)) - 1);
+            Code code = 0;
+            for(int a = 0; a < 3; ++a)
+            {
+                float cell = ei::clamp((_point[a] - _min[a]) * _scale[a], 0.0f, maxCell);
+                code |= expandBits(Code(cell)) << (2 - a);
+            }
+            return code;
+        }
+
+        inline uint32 countLeadingZeros( uint32 _x )
+        {
+            if(_x == 0) return 32;
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanReverse(&index, _x);
+            return 31 - index;
+#else
+            return __builtin_clz(_x);
+#endif
+        }
+
+        inline uint32 countLeadingZeros( uint64 _x )
+        {
+            uint32 hi = uint32(_x >> 32);
+            return hi ? countLeadingZeros(hi) : 32 + countLeadingZeros(uint32(_x));
+        }
+
+        inline uint32 countTrailingZeros( uint32 _x )
+        {
+            if(_x == 0) return 32;
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward(&index, _x);
+            return index;
+#else
+            return __builtin_ctz(_x);
+#endif
+        }
+
+        // Length of the common prefix of the keys i and j, where the index
+        // is appended to the code to make all keys unique. -1 outside of the
+        // array.
+        template<typename Code>
+        inline int commonPrefix( const Code* _codes, int64 _num, int64 _i, int64 _j )
+        {
+            if(_j < 0 || _j >= _num) return -1;
+            Code diff = _codes[_i] ^ _codes[_j];
+            if(diff) return int(countLeadingZeros(diff));
+            return int(sizeof(Code) * 8 + countLeadingZeros(uint32(_i ^ _j)));
+        }
+
+        // One pass of a stable parallel LSD radix sort for 8 bits. Each thread
+        // counts the digits of its part, then scatters it behind the parts of
+        // the lower threads.
+        template<typename Code>
+        inline void radixSortPass( const Code* _keys, const uint32* _values, Code* _keysOut, uint32* _valuesOut, uint32 _num, uint32 _shift,
+            uint32* _histograms, uint32 _thread, uint32 _numThreads, Barrier& _barrier )
+        {
+            uint32 begin, end;
+            threadRange(_num, _thread, _numThreads, begin, end);
+            uint32* histogram = _histograms + _thread * 256;
+            for(uint32 d = 0; d < 256; ++d) histogram[d] = 0;
+            for(uint32 i = begin; i < end; ++i)
+                histogram[(_keys[i] >> _shift) & 0xff]++;
+            _barrier.wait();
+            uint32 offsets[256];
+            uint32 sum = 0;
+            for(uint32 d = 0; d < 256; ++d)
+            {
+                for(uint32 t = 0; t < _numThreads; ++t)
+                {
+                    if(t == _thread) offsets[d] = sum;
+                    sum += _histograms[t * 256 + d];
+                }
+            }
+            for(uint32 i = begin; i < end; ++i)
+            {
+                uint32 pos = offsets[(_keys[i] >> _shift) & 0xff]++;
+                _keysOut[pos] = _keys[i];
+                _valuesOut[pos] = _values[i];
+            }
+            _barrier.wait();
+        }
+
+        template<typename Code>
+        inline BVH buildLBVH( const Box* _bounds, uint32 _num, uint32 _numThreads )
+        {
+            BVH bvh;
+            if(_num == 0) return bvh;
+            bvh.nodes.resize(2 * _num - 1);
+            bvh.indices.resize(_num);
+            if(_num == 1)
+            {
+                bvh.nodes[0] = BVHNode{_bounds[0], 0, 1};
+                bvh.indices[0] = 0;
+                return bvh;
+            }
+
+            // Small inputs are not worth the threads
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), _num / 4096));
+            std::vector<Box> threadBounds(numThreads);
+            std::vector<Code> codes(_num), codesTmp(_num);
+            std::vector<uint32> order(_num), orderTmp(_num);
+            std::vector<uint32> histograms(numThreads * 256);
+            // Karras' layout: n-1 inner nodes and n leaves. The inner node with
+            // split s stores its children at the output nodes 1+2s and 2+2s.
+            std::vector<uint32> split(_num - 1), innerOut(_num - 1), innerParent(_num - 1), leafOut(_num), leafParent(_num);
+            std::unique_ptr<std::atomic<uint32>[]> visits(new std::atomic<uint32>[_num - 1]);
+            Barrier barrier(numThreads);
+
+            runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                uint32 begin, end;
+                // Bounds of the centers to quantize the codes
+                threadRange(_num, _thread, _numThreads, begin, end);
+                Box centerBounds = emptyBox();
+                for(uint32 i = begin; i < end; ++i)
+                    extendByCenter(centerBounds, _bounds[i]);
+                threadBounds[_thread] = centerBounds;
+                barrier.wait();
+                centerBounds = threadBounds[0];
+                for(uint32 t = 1; t < _numThreads; ++t)
+                    extend(centerBounds, threadBounds[t]);
+
+                const float numCells = float(1u << (sizeof(Code) == 4 ? 10 : 21));
+                Vec3 extent = centerBounds.max - centerBounds.min;
+                Vec3 scale;
+                for(int a = 0; a < 3; ++a)
+                    scale[a] = extent[a] > 0.0f ? numCells / extent[a] : 0.0f;
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    codes[i] = mortonCode<Code>(center(_bounds[i]), centerBounds.min, scale);
+                    order[i] = i;
+                }
+                barrier.wait();
+
+                Code* keys = codes.data(); Code* keysTmp = codesTmp.data();
+                uint32* values = order.data(); uint32* valuesTmp = orderTmp.data();
+                for(uint32 shift = 0; shift < (sizeof(Code) == 4 ? 30u : 63u); shift += 8)
+                {
+                    radixSortPass( keys, values, keysTmp, valuesTmp, _num, shift, histograms.data(), _thread, _numThreads, barrier );
+                    std::swap(keys, keysTmp);
+                    std::swap(values, valuesTmp);
+                }
+
+                // Hierarchy (Karras 2012): each inner node finds its range and
+                // split independently.
+                threadRange(_num - 1, _thread, _numThreads, begin, end);
+                if(_thread == 0) innerOut[0] = 0;
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    visits[i].store(0, std::memory_order_relaxed);
+                    int64 n = _num;
+                    int64 d = commonPrefix(keys, n, i, i + 1) > commonPrefix(keys, n, i, int64(i) - 1) ? 1 : -1;
+                    int minPrefix = commonPrefix(keys, n, i, i - d);
+                    int64 maxLength = 2;
+                    while(commonPrefix(keys, n, i, i + maxLength * d) > minPrefix)
+                        maxLength *= 2;
+                    int64 length = 0;
+                    for(int64 t = maxLength / 2; t >= 1; t /= 2)
+                        if(commonPrefix(keys, n, i, i + (length + t) * d) > minPrefix)
+                            length += t;
+                    int64 j = i + length * d;
+                    int nodePrefix = commonPrefix(keys, n, i, j);
+                    int64 s = 0;
+                    for(int64 div = 2, t = length; t > 1; div *= 2)
+                    {
+                        t = (length + div - 1) / div;
+                        if(commonPrefix(keys, n, i, i + (s + t) * d) > nodePrefix)
+                            s += t;
+                    }
+                    uint32 gamma = uint32(i + s * d + ei::min(d, int64(0)));
+                    split[i] = gamma;
+                    if(ei::min(int64(i), j) == gamma) { leafOut[gamma] = 1 + 2 * gamma; leafParent[gamma] = i; }
+                    else { innerOut[gamma] = 1 + 2 * gamma; innerParent[gamma] = i; }
+                    if(ei::max(int64(i), j) == gamma + 1) { leafOut[gamma + 1] = 2 + 2 * gamma; leafParent[gamma + 1] = i; }
+                    else { innerOut[gamma + 1] = 2 + 2 * gamma; innerParent[gamma + 1] = i; }
+                }
+                barrier.wait();
+
+                // Leaves and bottom-up bounds: the second child which arrives
+                // at an inner node computes its bounds and continues upwards.
+                threadRange(_num, _thread, _numThreads, begin, end);
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    bvh.indices[i] = values[i];
+                    bvh.nodes[leafOut[i]] = BVHNode{_bounds[values[i]], i, 1};
+                    uint32 p = leafParent[i];
+                    while(visits[p].fetch_add(1, std::memory_order_acq_rel) == 1)
+                    {
+                        uint32 first = 1 + 2 * split[p];
+                        BVHNode& node = bvh.nodes[innerOut[p]];
+                        node.bounds = bvh.nodes[first].bounds;
+                        extend(node.bounds, bvh.nodes[first + 1].bounds);
+                        node.first = first;
+                        node.count = 0;
+                        if(p == 0) break;
+                        p = innerParent[p];
+                    }
+                }
+            });
+            return bvh;
+        }
+    }
+
+    /// \brief Build a linear BVH (LBVH) in parallel.
+    /// \details The primitives are sorted by the Morton codes of their
+    ///     centers. All inner nodes are then built independently (Karras 2012)
+    ///     and the bounds are computed bottom-up. This is much faster than
+    ///     buildBVH(), but the tree is of lower quality. Each leaf contains
+    ///     one primitive.
+    /// \param _bounds Bounding boxes of the primitives. The leaves contain
+    ///     indices into this array.
+    /// \param _mortonBits 30 (10 bits per axis) or 63 (21 bits per axis, for
+    ///     large scenes with small primitives).
+    /// \param _numThreads Number of threads or 0 for all hardware threads.
+    inline BVH buildLBVH( const Box* _bounds, uint32 _num, uint32 _mortonBits = 30, uint32 _numThreads = 0 )
+    {
+        eiAssert( _mortonBits == 30 || _mortonBits == 63, "Only 30 and 63 bit Morton codes are supported." );
+        if(_mortonBits == 63)
+            return details::buildLBVH<uint64>( _bounds, _num, _numThreads );
+        return details::buildLBVH<uint32>( _bounds, _num, _numThreads );
+    }
+
+    /// \brief Build a linear BVH over triangles in parallel.
+    inline BVH buildLBVH( const Triangle* _triangles, uint32 _num, uint32 _mortonBits = 30, uint32 _numThreads = 0 )
+    {
+        std::vector<Box> bounds;
+        details::triangleBounds( _triangles, _num, _numThreads, bounds );
+        return buildLBVH( bounds.data(), _num, _mortonBits, _numThreads );
+    }
+
+    // ************************************************************************* //
+    //                                REFIT                                      //
+    // ************************************************************************* //
+    // Deforming meshes keep their topology, so the tree can be kept and only
+    // the bounds are recomputed. The nodes down to BVH_REFIT_CUT_DEPTH form
+    // the top of the tree. The subtrees below this cut are refitted in
+    // parallel and each of them can be rebuilt on its own if its SAH cost grew
+    // too much.
+
+    namespace details {
+        // Depth of the subtrees which are refitted and rebuilt independently.
+        // This gives up to 64 subtrees.
+        const uint32 BVH_REFIT_CUT_DEPTH = 6;
+
+        // Find the roots of all subtrees at BVH_REFIT_CUT_DEPTH (or leaves
+        // above) and the inner nodes above them, both in depth first order.
+        inline void refitCut( const BVH& _bvh, std::vector<uint32>& _subtrees, std::vector<uint32>& _top )
+        {
+            _subtrees.clear();
+            _top.clear();
+            if(_bvh.nodes.empty()) return;
+            struct Item { uint32 node, depth; };
+            Item stack[BVH_REFIT_CUT_DEPTH + 2];
+            int stackSize = 0;
+            stack[stackSize++] = Item{0, 0};
+            while(stackSize > 0)
+            {
+                Item item = stack[--stackSize];
+                const BVHNode& node = _bvh.nodes[item.node];
+                if(node.isLeaf() || item.depth == BVH_REFIT_CUT_DEPTH)
+                    _subtrees.push_back(item.node);
+                else {
+                    _top.push_back(item.node);
+                    stack[stackSize++] = Item{node.first + 1, item.depth + 1};
+                    stack[stackSize++] = Item{node.first, item.depth + 1};
+                }
+            }
+        }
+
+        // Refit the subtree below _root. Returns its SAH cost relative to the
+        // surface of the root.
+        inline float refitSubtree( BVH& _bvh, const Box* _bounds, uint32 _root, std::vector<uint32>& _order )
+        {
+            // Breadth first order, in reverse it visits all children before
+            // their parent
+            _order.clear();
+            _order.push_back(_root);
+            for(size_t i = 0; i < _order.size(); ++i)
+                if(!_bvh.nodes[_order[i]].isLeaf())
+                {
+                    _order.push_back(_bvh.nodes[_order[i]].first);
+                    _order.push_back(_bvh.nodes[_order[i]].first + 1);
+                }
+            float cost = 0.0f;
+            for(size_t i = _order.size(); i-- > 0; )
+            {
+                BVHNode& node = _bvh.nodes[_order[i]];
+                if(node.isLeaf())
+                {
+                    node.bounds = _bounds[_bvh.indices[node.first]];
+                    for(uint32 j = node.first + 1; j < node.first + node.count; ++j)
+                        extend(node.bounds, _bounds[_bvh.indices[j]]);
+                    cost += surface(node.bounds) * node.count;
+                } else {
+                    node.bounds = _bvh.nodes[node.first].bounds;
+                    extend(node.bounds, _bvh.nodes[node.first + 1].bounds);
+                    cost += surface(node.bounds) * BVH_TRAVERSAL_COST;
+                }
+            }
+            float rootSurface = surface(_bvh.nodes[_root].bounds);
+            return rootSurface > 0.0f ? cost / rootSurface : 0.0f;
+        }
+
+        // Range of BVH::indices which is referenced by the subtree (_order
+        // contains the subtree nodes from refitSubtree()). All builders
+        // give each subtree a contiguous range.
+        inline void subtreeRange( const BVH& _bvh, const std::vector<uint32>& _order, uint32& _begin, uint32& _end )
+        {
+            _begin = 0xffffffff;
+            _end = 0;
+            for(uint32 n : _order)
+                if(_bvh.nodes[n].isLeaf())
+                {
+                    _begin = ei::min(_begin, _bvh.nodes[n].first);
+                    _end = ei::max(_end, _bvh.nodes[n].first + _bvh.nodes[n].count);
+                }
+        }
+
+        // Copy the tree in depth first order and replace the subtrees which
+        // have an entry in _rebuilt. Their leaves are offset by _rangeBegin.
+        inline void spliceSubtrees( BVH& _bvh, const std::vector<uint32>& _subtrees, const std::vector<BVH>& _rebuilt, const std::vector<uint32>& _rangeBegin )
+        {
+            std::vector<int32> replacement(_bvh.nodes.size(), -1);
+            size_t numNodes = _bvh.nodes.size();
+            for(size_t i = 0; i < _subtrees.size(); ++i)
+                if(!_rebuilt[i].nodes.empty())
+                {
+                    replacement[_subtrees[i]] = int32(i);
+                    numNodes += _rebuilt[i].nodes.size();
+                }
+            std::vector<BVHNode> nodes;
+            nodes.reserve(numNodes);
+            nodes.resize(1);
+            struct Item { const BVH* tree; uint32 src, dst, offset; };
+            std::vector<Item> stack;
+            stack.push_back(Item{&_bvh, 0, 0, 0});
+            while(!stack.empty())
+            {
+                Item item = stack.back();
+                stack.pop_back();
+                if(item.tree == &_bvh && replacement[item.src] != -1)
+                {
+                    int32 i = replacement[item.src];
+                    item = Item{&_rebuilt[i], 0, item.dst, _rangeBegin[i]};
+                }
+                const BVHNode& node = item.tree->nodes[item.src];
+                if(node.isLeaf())
+                    nodes[item.dst] = BVHNode{node.bounds, node.first + item.offset, node.count};
+                else {
+                    uint32 children = uint32(nodes.size());
+                    nodes[item.dst] = BVHNode{node.bounds, children, 0};
+                    nodes.resize(children + 2);
+                    stack.push_back(Item{item.tree, node.first + 1, children + 1, item.offset});
+                    stack.push_back(Item{item.tree, node.first, children, item.offset});
+                }
+            }
+            _bvh.nodes.swap(nodes);
+        }
+
+        // Refit all subtrees in parallel, rebuild the degraded ones (if
+        // _referenceCost is given) and refit the top of the tree.
+        inline uint32 refit( BVH& _bvh, const Box* _bounds, std::vector<float>* _referenceCost, float _maxCostGrowth, uint32 _maxLeafSize, uint32 _numThreads )
+        {
+            std::vector<uint32> subtrees, top;
+            refitCut(_bvh, subtrees, top);
+            if(subtrees.empty()) return 0;
+            uint32 numSubtrees = uint32(subtrees.size());
+            bool monitor = _referenceCost != nullptr;
+            if(monitor && _referenceCost->size() != numSubtrees)
+                // No reference yet: the current state is the reference.
+                _referenceCost->assign(numSubtrees, 0.0f);
+            std::vector<float> cost(numSubtrees);
+            std::vector<BVH> rebuilt(monitor ? numSubtrees : 0);
+            std::vector<uint32> rangeBegin(monitor ? numSubtrees : 0);
+
+            // Small trees are not worth the threads
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), ei::min(numSubtrees, uint32(_bvh.nodes.size() / 8192))));
+            std::atomic<uint32> nextSubtree(0);
+            runParallel(numThreads, [&](uint32, uint32) {
+                std::vector<uint32> order;
+                std::vector<Box> bounds;
+                // The subtrees differ in size, so they are taken dynamically
+                for(uint32 i = nextSubtree++; i < numSubtrees; i = nextSubtree++)
+                {
+                    cost[i] = refitSubtree(_bvh, _bounds, subtrees[i], order);
+                    if(!monitor) continue;
+                    float& reference = (*_referenceCost)[i];
+                    if(reference > 0.0f && cost[i] > reference * _maxCostGrowth)
+                    {
+                        // Rebuild over the same index range and keep the
+                        // total depth below BVH_MAX_DEPTH.
+                        uint32 begin, end;
+                        subtreeRange(_bvh, order, begin, end);
+                        bounds.resize(end - begin);
+                        for(uint32 j = begin; j < end; ++j)
+                            bounds[j - begin] = _bounds[_bvh.indices[j]];
+                        rebuilt[i] = buildSAH(bounds.data(), end - begin, _maxLeafSize, BVH_MAX_DEPTH - BVH_REFIT_CUT_DEPTH);
+                        for(uint32& index : rebuilt[i].indices)
+                            index = _bvh.indices[begin + index];
+                        std::copy(rebuilt[i].indices.begin(), rebuilt[i].indices.end(), _bvh.indices.begin() + begin);
+                        rangeBegin[i] = begin;
+                        cost[i] = refitSubtree(rebuilt[i], _bounds, 0, order);
+                    }
+                    if(reference <= 0.0f || !rebuilt[i].nodes.empty())
+                        reference = cost[i];
+                }
+            });
+
+            for(size_t i = top.size(); i-- > 0; )
+            {
+                BVHNode& node = _bvh.nodes[top[i]];
+                node.bounds = _bvh.nodes[node.first].bounds;
+                extend(node.bounds, _bvh.nodes[node.first + 1].bounds);
+            }
+
+            uint32 numRebuilt = 0;
+            for(const BVH& subtree : rebuilt)
+                if(!subtree.nodes.empty()) ++numRebuilt;
+            if(numRebuilt)
+                spliceSubtrees(_bvh, subtrees, rebuilt, rangeBegin);
+            return numRebuilt;
+        }
+    }
+
+    /// \brief Recompute all bounds of a BVH after the primitives moved.
+    /// \details The tree structure is kept, so this is much cheaper than a
+    ///     new build, but the tree quality degrades with large deformations
+    ///     (see BVHQualityMonitor). The subtrees are refitted in parallel.
+    /// \param _bounds The new bounds of the primitives the BVH was built for.
+    /// \param _numThreads Number of threads or 0 for all hardware threads.
+    inline void refitBVH( BVH& _bvh, const Box* _bounds, uint32 _numThreads = 0 )
+    {
+        details::refit( _bvh, _bounds, nullptr, 0.0f, 0, _numThreads );
+    }
+
+    inline void refitBVH( BVH& _bvh, const Triangle* _triangles, uint32 _numThreads = 0 )
+    {
+        std::vector<Box> bounds;
+        details::triangleBounds( _triangles, uint32(_bvh.indices.size()), _numThreads, bounds );
+        refitBVH( _bvh, bounds.data(), _numThreads );
+    }
+
+    /// \brief Reference SAH costs of the subtrees of a BVH to detect where
+    ///     refitting degraded the tree.
+    /// \details The first refitBVH() with the monitor stores the costs of
+    ///     the fresh tree. Only the subtrees below the top 6 levels are
+    ///     monitored and rebuilt; the top of the tree is always refitted.
+    struct BVHQualityMonitor
+    {
+        std::vector<float> referenceCost;       ///< SAH cost of each subtree relative to its root surface.
+        float maxCostGrowth;                    ///< A subtree is rebuilt if its cost exceeds the reference by this factor.
+        uint32 maxLeafSize;                     ///< Leaf size for the rebuilt subtrees.
+
+        explicit BVHQualityMonitor( float _maxCostGrowth = 1.5f, uint32 _maxLeafSize = 4 ) :
+            maxCostGrowth(_maxCostGrowth),
+            maxLeafSize(_maxLeafSize)
+        {}
+    };
+
+    /// \brief Refit a BVH and rebuild the subtrees whose SAH cost grew too
+    ///     much.
+    /// \details The rebuilt subtrees use the binned SAH builder. The node
+    ///     array is reordered if any subtree was rebuilt, but the leaves still
+    ///     reference the same primitives.
+    /// \return Number of rebuilt subtrees.
+    inline uint32 refitBVH( BVH& _bvh, BVHQualityMonitor& _monitor, const Box* _bounds, uint32 _numThreads = 0 )
+    {
+        return details::refit( _bvh, _bounds, &_monitor.referenceCost, _monitor.maxCostGrowth, _monitor.maxLeafSize, _numThreads );
+    }
+
+    inline uint32 refitBVH( BVH& _bvh, BVHQualityMonitor& _monitor, const Triangle* _triangles, uint32 _numThreads = 0 )
+    {
+        std::vector<Box> bounds;
+        details::triangleBounds( _triangles, uint32(_bvh.indices.size()), _numThreads, bounds );
+        return refitBVH( _bvh, _monitor, bounds.data(), _numThreads );
+    }
+
+    namespace details {
+        // Leaf test of the closest hit traversals for triangle arrays.
+        template<typename T>
+        struct TriangleHit
+        {
+            const Ray& ray;
+            const T* triangles;
+
+            bool operator () (uint32 _i, float& _closest) const
+            {
+                float dist;
+                if(intersects( ray, triangles[_i], dist ) && dist < _closest)
+                {
+                    _closest = dist;
+                    return true;
+                }
+                return false;
+            }
+        };
+
+        // Closest hit traversal. The children are visited front to back and
+        // nodes behind the current hit are skipped. _leafTest(index, distance)
+        // tests one primitive and must return true and update distance if
+        // there is a hit closer than distance.
+        template<typename LeafTest>
+        inline bool closestHit( const BVH& _bvh, const FastRay& _ray, float& _distance, uint32& _index, LeafTest _leafTest )
+        {
+            if(_bvh.nodes.empty()) return false;
+            _distance = INF;
+            bool hit = false;
+            float rootDist;
+            if(!intersects( _ray, _bvh.nodes[0].bounds, rootDist )) return false;
+            uint32 stack[BVH_MAX_DEPTH + 1];
+            float stackDist[BVH_MAX_DEPTH + 1];
+            int stackSize = 0;
+            uint32 current = 0;
+            while(true)
+            {
+                const BVHNode& node = _bvh.nodes[current];
+                if(node.isLeaf())
+                {
+                    for(uint32 i = node.first; i < node.first + node.count; ++i)
+                        if(_leafTest( _bvh.indices[i], _distance ))
+                        {
+                            _index = _bvh.indices[i];
+                            hit = true;
+                        }
+                } else {
+                    float dist0 = INF, dist1 = INF;
+                    bool hit0 = intersects( _ray, _bvh.nodes[node.first].bounds, dist0 ) && dist0 <= _distance;
+                    bool hit1 = intersects( _ray, _bvh.nodes[node.first + 1].bounds, dist1 ) && dist1 <= _distance;
+                    if(hit0 && hit1)
+                    {
+                        // Continue with the closer child
+                        uint32 closer = dist1 < dist0 ? 1 : 0;
+                        stack[stackSize] = node.first + 1 - closer;
+                        stackDist[stackSize++] = closer ? dist0 : dist1;
+                        current = node.first + closer;
+                        continue;
+                    }
+                    if(hit0 || hit1)
+                    {
+                        current = node.first + (hit0 ? 0 : 1);
+                        continue;
+                    }
+                }
+                // Pop the next node which is not behind the closest hit
+                do {
+                    if(stackSize == 0) return hit;
+                    current = stack[--stackSize];
+                } while(stackDist[stackSize] > _distance);
+            }
+        }
+    }
+
+    /// \brief Closest hit of a ray with a triangle mesh.
+    /// \param _bvh A BVH which was built for _triangles.
+    /// \param [out] _distance Ray parameter of the closest hit.
+    /// \param [out] _triangle Index of the hit triangle.
+    /// \return true if any triangle is hit.
+    inline bool intersects( const Ray& _ray, const BVH& _bvh, const Triangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<Triangle>{_ray, _triangles} );
+    }
+
+    /// \brief Closest hit of a ray with a triangle mesh using the precomputed
+    ///     triangles.
+    inline bool intersects( const Ray& _ray, const BVH& _bvh, const FastTriangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<FastTriangle>{_ray, _triangles} );
+    }
+
+    // ************************************************************************* //
+    //                             CLOSEST POINT                                 //
+    // ************************************************************************* //
+    // Best-first search for the closest point on a triangle mesh. The nodes
+    // are visited in order of their lower bound (the distance to the box) and
+    // the search ends as soon as the closest remaining node is farther away
+    // than the best triangle found so far.
+
+    /// \brief Result of a closest point query on a triangle mesh.
+    struct MeshPoint
+    {
+        /// \brief Marker for a missing triangle.
+        static const uint32 NONE = 0xffffffff;
+
+        float distance;         ///< Unsigned distance of the query point, INF if there is no triangle.
+        uint32 triangle;        ///< Index of the closest triangle or NONE.
+        Vec3 barycentric;       ///< Weights of v0, v1 and v2 of the closest point.
+        Vec3 position;          ///< The closest point itself.
+    };
+
+    namespace details {
+        // Squared distance of a point to a box (0 inside). This is the
+        // square of max(0, distance(Vec3, Box)) without the root.
+        inline float distanceSq( const Vec3& _point, const Box& _box )
+        {
+            return lensq(max(max(_box.min - _point, _point - _box.max), Vec3(0.0f)));
+        }
+
+        // Barycentric coordinates of the closest point on a segment a-b.
+        inline float closestOnSegment( const Vec3& _point, const Vec3& _a, const Vec3& _b )
+        {
+            Vec3 ab = _b - _a;
+            float l = lensq(ab);
+            return l > 0.0f ? saturate(dot(_point - _a, ab) / l) : 0.0f;
+        }
+
+        // Barycentric coordinates of the closest point on a triangle. The
+        // Voronoi regions of the vertices and edges are tested first (see
+        // Ericson, Real-Time Collision Detection, 5.1.5).
+        inline Vec3 closestBarycentric( const Vec3& _point, const Triangle& _triangle )
+        {
+            Vec3 ab = _triangle.v1 - _triangle.v0;
+            Vec3 ac = _triangle.v2 - _triangle.v0;
+            if(!(lensq(cross(ab, ac)) > 0.0f))
+            {
+                // Degenerated triangle: closest point of the three edges
+                float t0 = closestOnSegment(_point, _triangle.v0, _triangle.v1);
+                float t1 = closestOnSegment(_point, _triangle.v1, _triangle.v2);
+                float t2 = closestOnSegment(_point, _triangle.v2, _triangle.v0);
+                float d0 = lensq(_triangle.v0 + ab * t0 - _point);
+                float d1 = lensq(_triangle.v1 + (_triangle.v2 - _triangle.v1) * t1 - _point);
+                float d2 = lensq(_triangle.v2 - ac * t2 - _point);
+                if(d0 <= d1 && d0 <= d2) return Vec3(1.0f - t0, t0, 0.0f);
+                if(d1 <= d2) return Vec3(0.0f, 1.0f - t1, t1);
+                return Vec3(t2, 0.0f, 1.0f - t2);
+            }
+            Vec3 ap = _point - _triangle.v0;
+            float d1 = dot(ab, ap);
+            float d2 = dot(ac, ap);
+            if(d1 <= 0.0f && d2 <= 0.0f) return Vec3(1.0f, 0.0f, 0.0f);
+            Vec3 bp = _point - _triangle.v1;
+            float d3 = dot(ab, bp);
+            float d4 = dot(ac, bp);
+            if(d3 >= 0.0f && d4 <= d3) return Vec3(0.0f, 1.0f, 0.0f);
+            float vc = d1 * d4 - d3 * d2;
+            if(vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+            {
+                float v = d1 / (d1 - d3);
+                return Vec3(1.0f - v, v, 0.0f);
+            }
+            Vec3 cp = _point - _triangle.v2;
+            float d5 = dot(ab, cp);
+            float d6 = dot(ac, cp);
+            if(d6 >= 0.0f && d5 <= d6) return Vec3(0.0f, 0.0f, 1.0f);
+            float vb = d5 * d2 - d1 * d6;
+            if(vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+            {
+                float w = d2 / (d2 - d6);
+                return Vec3(1.0f - w, 0.0f, w);
+            }
+            float va = d3 * d6 - d5 * d4;
+            if(va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+            {
+                float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+                return Vec3(0.0f, 1.0f - w, w);
+            }
+            // Inside the face
+            float denom = 1.0f / (va + vb + vc);
+            float v = vb * denom;
+            float w = vc * denom;
+            return Vec3(1.0f - v - w, v, w);
+        }
+
+        struct NodeDistance
+        {
+            float distSq;
+            uint32 node;
+        };
+
+        // Order for a min-heap with the std heap functions
+        inline bool fartherNode( const NodeDistance& _a, const NodeDistance& _b )
+        {
+            return _a.distSq > _b.distSq;
+        }
+
+        // Best-first closest point search. The open nodes are kept in the
+        // min-heap _heap, which is given by the caller to reuse its memory.
+        // From each popped node the search descends into the closer child
+        // directly and only queues the other one.
+        inline bool closestPoint( const BVH& _bvh, const Triangle* _triangles, const Vec3& _point, float _maxDistance,
+            MeshPoint& _result, std::vector<NodeDistance>& _heap )
+        {
+            _result.distance = INF;
+            _result.triangle = MeshPoint::NONE;
+            if(_bvh.nodes.empty()) return false;
+            float best = _maxDistance * _maxDistance;
+            _heap.clear();
+            _heap.push_back(NodeDistance{distanceSq(_point, _bvh.nodes[0].bounds), 0});
+            while(!_heap.empty())
+            {
+                std::pop_heap(_heap.begin(), _heap.end(), fartherNode);
+                NodeDistance entry = _heap.back();
+                _heap.pop_back();
+                // All other open nodes are even farther away
+                if(entry.distSq > best) break;
+                uint32 current = entry.node;
+                while(!_bvh.nodes[current].isLeaf())
+                {
+                    uint32 first = _bvh.nodes[current].first;
+                    float dist0 = distanceSq(_point, _bvh.nodes[first].bounds);
+                    float dist1 = distanceSq(_point, _bvh.nodes[first + 1].bounds);
+                    uint32 closer = dist1 < dist0 ? 1 : 0;
+                    float closerDist = closer ? dist1 : dist0;
+                    float fartherDist = closer ? dist0 : dist1;
+                    if(fartherDist <= best)
+                    {
+                        _heap.push_back(NodeDistance{fartherDist, first + 1 - closer});
+                        std::push_heap(_heap.begin(), _heap.end(), fartherNode);
+                    }
+                    if(closerDist > best)
+                    {
+                        current = MeshPoint::NONE;
+                        break;
+                    }
+                    current = first + closer;
+                }
+                if(current == MeshPoint::NONE) continue;
+                const BVHNode& leaf = _bvh.nodes[current];
+                for(uint32 i = leaf.first; i < leaf.first + leaf.count; ++i)
+                {
+                    const Triangle& triangle = _triangles[_bvh.indices[i]];
+                    Vec3 barycentric = closestBarycentric(_point, triangle);
+                    Vec3 position = triangle.v0 * barycentric.x + triangle.v1 * barycentric.y + triangle.v2 * barycentric.z;
+                    float distSq = lensq(position - _point);
+                    // The first hit may be exactly at _maxDistance
+                    if(distSq < best || (distSq == best && _result.triangle == MeshPoint::NONE))
+                    {
+                        best = distSq;
+                        _result.triangle = _bvh.indices[i];
+                        _result.barycentric = barycentric;
+                        _result.position = position;
+                    }
+                }
+            }
+            if(_result.triangle == MeshPoint::NONE) return false;
+            _result.distance = ei::sqrt(best);
+            return true;
+        }
+    }
+
+    /// \brief Closest point on a triangle mesh.
+    /// \param _bvh A BVH which was built for _triangles.
+    /// \param [out] _result The closest point. If nothing is found the
+    ///     triangle is MeshPoint::NONE and the distance INF.
+    /// \param [in] _maxDistance Triangles which are farther away are ignored.
+    ///     A good bound makes the query much faster.
+    /// \return true if there is a triangle within _maxDistance.
+    inline bool closestPoint( const Vec3& _point, const BVH& _bvh, const Triangle* _triangles, MeshPoint& _result, float _maxDistance = INF ) // TESTED
+    {
+        std::vector<details::NodeDistance> heap;
+        heap.reserve(64);
+        return details::closestPoint( _bvh, _triangles, _point, _maxDistance, _result, heap );
+    }
+
+    /// \brief Unsigned distance of a point to a triangle mesh (INF for an
+    ///     empty mesh).
+    inline float distance( const Vec3& _point, const BVH& _bvh, const Triangle* _triangles ) // TESTED
+    {
+        MeshPoint result;
+        closestPoint( _point, _bvh, _triangles, result );
+        return result.distance;
+    }
+
+    /// \brief Closest points on a triangle mesh for many query points on
+    ///     multiple threads.
+    /// \details Each thread reuses the memory of its search, so there is no
+    ///     allocation per query.
+    /// \param [out] _results Array of _num entries with the result of each
+    ///     query point (see closestPoint()).
+    /// \param [in] _numThreads Number of threads or 0 for all hardware
+    ///     threads.
+    /// \return Number of query points with a triangle within _maxDistance.
+    inline uint32 closestPoints( const Vec3* _points, uint32 _num, const BVH& _bvh, const Triangle* _triangles, MeshPoint* _results, float _maxDistance = INF, uint32 _numThreads = 0 ) // TESTED
+    {
+        uint32 numThreads = ei::max(1u, ei::min(details::numWorkers(_numThreads), _num / 256));
+        std::vector<uint32> numFound(numThreads, 0);
+        details::runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+            std::vector<details::NodeDistance> heap;
+            heap.reserve(64);
+            uint32 begin, end;
+            details::threadRange(_num, _thread, _numThreads, begin, end);
+            for(uint32 i = begin; i < end; ++i)
+                if(details::closestPoint( _bvh, _triangles, _points[i], _maxDistance, _results[i], heap ))
+                    ++numFound[_thread];
+        });
+        uint32 total = 0;
+        for(uint32 n : numFound) total += n;
+        return total;
+    }
+
+    // ************************************************************************* //
+    //                              WIDE BVH                                     //
+    // ************************************************************************* //
+    // A BVH with 4 or 8 children per node, collapsed from a binary BVH. The
+    // child bounds are stored in a BoxSoA, so a ray is tested against all
+    // children of a node at once and each node fetch replaces about two
+    // levels of the binary tree.
+
+    namespace details {
+        // The wide nodes need their SIMD alignment, which std::allocator does
+        // not guarantee for over-aligned types before C++17.
+        template<typename T>
+        struct AlignedAllocator
+        {
+            typedef T value_type;
+
+            AlignedAllocator() noexcept {}
+            template<typename U> AlignedAllocator(const AlignedAllocator<U>&) noexcept {}
+
+            T* allocate(size_t _num)
+            {
+                // Over-allocate and store the original pointer in front of
+                // the aligned block.
+                void* raw = ::operator new(_num * sizeof(T) + alignof(T) + sizeof(void*));
+                uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignof(T) - 1) & ~uintptr_t(alignof(T) - 1);
+                reinterpret_cast<void**>(aligned)[-1] = raw;
+                return reinterpret_cast<T*>(aligned);
+            }
+
+            void deallocate(T* _ptr, size_t) noexcept
+            {
+                ::operator delete(reinterpret_cast<void**>(_ptr)[-1]);
+            }
+
+            template<typename U> bool operator == (const AlignedAllocator<U>&) const noexcept { return true; }
+            template<typename U> bool operator != (const AlignedAllocator<U>&) const noexcept { return false; }
+        };
+    }
+
+    /// \brief Node of a 4 or 8 wide BVH.
+    /// \details Unused lanes have cleared bounds which are never hit.
+    template<uint N>
+    struct WideBVHNode
+    {
+        BoxSoA<N> bounds;   ///< Bounds of all children
+        uint32 child[N];    ///< Inner child: index of the node. Leaf child: first entry in WideBVH::indices.
+        uint32 count[N];    ///< Number of primitives of a leaf child, 0 for inner children and unused lanes.
+    };
+
+    /// \brief Wide BVH in a flat node array.
+    /// \details An empty BVH has no nodes. Otherwise nodes[0] is the root.
+    ///     The primitive indices are the same as in the binary BVH it was
+    ///     collapsed from.
+    template<uint N>
+    struct WideBVH
+    {
+        std::vector<WideBVHNode<N>, details::AlignedAllocator<WideBVHNode<N>>> nodes;
+        std::vector<uint32> indices;    ///< Primitive indices referenced by the leaves.
+    };
+
+    typedef WideBVH<4> BVH4;
+    typedef WideBVH<8> BVH8;
+
+    /// \brief Collapse a binary BVH into a 4 or 8 wide BVH.
+    /// \details Each wide node takes the children of a binary inner node and
+    ///     repeatedly replaces the inner child with the largest surface by its
+    ///     own two children until N lanes are used. The leaves are kept as
+    ///     they are. Usage: BVH8 wide = collapseBVH<8>(bvh);
+    template<uint N>
+    inline WideBVH<N> collapseBVH( const BVH& _bvh )
+    {
+        static_assert(N == 4 || N == 8, "Only 4 and 8 wide BVHs are supported.");
+        WideBVH<N> wide;
+        wide.indices = _bvh.indices;
+        if(_bvh.nodes.empty()) return wide;
+
+        struct Task { uint32 binary; uint32 wide; };
+        std::vector<Task> stack;
+        wide.nodes.emplace_back();
+        stack.push_back(Task{0, 0});
+        while(!stack.empty())
+        {
+            Task task = stack.back();
+            stack.pop_back();
+            // Gather the children. A root which is a leaf becomes a single lane.
+            uint32 lanes[N];
+            uint32 numLanes = 0;
+            const BVHNode& node = _bvh.nodes[task.binary];
+            if(node.isLeaf())
+                lanes[numLanes++] = task.binary;
+            else {
+                lanes[numLanes++] = node.first;
+                lanes[numLanes++] = node.first + 1;
+            }
+            while(numLanes < N)
+            {
+                int largest = -1;
+                float largestSurface = -1.0f;
+                for(uint32 i = 0; i < numLanes; ++i)
+                {
+                    const BVHNode& lane = _bvh.nodes[lanes[i]];
+                    if(!lane.isLeaf() && surface(lane.bounds) > largestSurface)
+                    {
+                        largest = int(i);
+                        largestSurface = surface(lane.bounds);
+                    }
+                }
+                if(largest == -1) break;
+                uint32 first = _bvh.nodes[lanes[largest]].first;
+                lanes[largest] = first;
+                lanes[numLanes++] = first + 1;
+            }
+
+            WideBVHNode<N> result;
+            for(uint32 i = 0; i < N; ++i)
+            {
+                if(i >= numLanes)
+                {
+                    result.bounds.clear(i);
+                    result.child[i] = 0;
+                    result.count[i] = 0;
+                    continue;
+                }
+                const BVHNode& lane = _bvh.nodes[lanes[i]];
+                result.bounds.set(i, lane.bounds);
+                if(lane.isLeaf())
+                {
+                    result.child[i] = lane.first;
+                    result.count[i] = lane.count;
+                } else {
+                    result.child[i] = uint32(wide.nodes.size());
+                    result.count[i] = 0;
+                    wide.nodes.emplace_back();
+                    stack.push_back(Task{lanes[i], result.child[i]});
+                }
+            }
+            wide.nodes[task.wide] = result;
+        }
+        return wide;
+    }
+
+    namespace details {
+        // Closest hit traversal of a wide BVH (see closestHit(BVH...)). All
+        // children are tested at once and the hit ones are pushed far to
+        // near, so the closest child is processed next.
+        template<uint N, typename LeafTest>
+        inline bool closestHit( const WideBVH<N>& _bvh, const FastRay& _ray, float& _distance, uint32& _index, LeafTest _leafTest )
+        {
+            _distance = INF;
+            if(_bvh.nodes.empty()) return false;
+            bool hit = false;
+            // Each wide level consumes at least one binary level and pushes
+            // at most N entries.
+            struct Entry { uint32 child; uint32 count; float dist; };
+            Entry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+            int stackSize = 0;
+            stack[stackSize++] = Entry{0, 0, 0.0f};
+            alignas(N * sizeof(float)) float dist[N];
+            while(stackSize > 0)
+            {
+                Entry entry = stack[--stackSize];
+                if(entry.dist > _distance) continue;
+                if(entry.count)
+                {
+                    for(uint32 i = entry.child; i < entry.child + entry.count; ++i)
+                        if(_leafTest( _bvh.indices[i], _distance ))
+                        {
+                            _index = _bvh.indices[i];
+                            hit = true;
+                        }
+                    continue;
+                }
+                const WideBVHNode<N>& node = _bvh.nodes[entry.child];
+                uint32 mask = intersects( _ray, node.bounds, dist, _distance );
+                // Insertion sort of the hit children by descending distance
+                int first = stackSize;
+                while(mask)
+                {
+                    uint32 lane = countTrailingZeros(mask);
+                    mask &= mask - 1;
+                    Entry child{node.child[lane], node.count[lane], dist[lane]};
+                    int i = stackSize++;
+                    for(; i > first && stack[i - 1].dist < child.dist; --i)
+                        stack[i] = stack[i - 1];
+                    stack[i] = child;
+                }
+            }
+            return hit;
+        }
+    }
+
+    /// \brief Closest hit of a ray with a triangle mesh in a wide BVH.
+    /// \param _bvh A BVH which was collapsed from a BVH for _triangles.
+    /// \param [out] _distance Ray parameter of the closest hit.
+    /// \param [out] _triangle Index of the hit triangle.
+    /// \return true if any triangle is hit.
+    inline bool intersects( const Ray& _ray, const BVH8& _bvh, const Triangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<Triangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH4& _bvh, const Triangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<Triangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH8& _bvh, const FastTriangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<FastTriangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH4& _bvh, const FastTriangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<FastTriangle>{_ray, _triangles} );
+    }
+
+    // ************************************************************************* //
+    //                               OCCLUSION                                   //
+    // ************************************************************************* //
+    // Any hit traversals for shadow and visibility rays. They stop at the
+    // first primitive which is hit below the maximum ray parameter, so the
+    // hits need no distance ordering and the nodes need no distance pruning.
+
+    namespace details {
+        // Without a maximum distance the cheaper boolean test is sufficient.
+        inline bool occludes( const Ray& _ray, const Triangle& _triangle, float _tMax )
+        {
+            if(_tMax == INF) return intersects( _ray, _triangle );
+            float dist;
+            return intersects( _ray, _triangle, dist ) && dist <= _tMax;
+        }
+
+        inline bool occludes( const Ray& _ray, const FastTriangle& _triangle, float _tMax )
+        {
+            float dist;
+            return intersects( _ray, _triangle, dist ) && dist <= _tMax;
+        }
+
+        // Leaf test of the any hit traversals for triangle arrays.
+        template<typename T>
+        struct TriangleOcclusion
+        {
+            const Ray& ray;
+            const T* triangles;
+            float tMax;
+
+            bool operator () (uint32 _i) const
+            {
+                return occludes( ray, triangles[_i], tMax );
+            }
+        };
+
+        // Any hit traversal. The child with the larger surface is visited
+        // first, because it is more likely to contain an occluder. This
+        // was faster than a near to far order.
+        template<typename LeafTest>
+        inline bool anyHit( const BVH& _bvh, const FastRay& _ray, float _tMax, LeafTest _leafTest )
+        {
+            if(_bvh.nodes.empty()) return false;
+            float dist0, dist1;
+            if(!intersects( _ray, _bvh.nodes[0].bounds, dist0 ) || dist0 > _tMax) return false;
+            uint32 stack[BVH_MAX_DEPTH + 1];
+            int stackSize = 0;
+            uint32 current = 0;
+            while(true)
+            {
+                const BVHNode& node = _bvh.nodes[current];
+                if(node.isLeaf())
+                {
+                    for(uint32 i = node.first; i < node.first + node.count; ++i)
+                        if(_leafTest( _bvh.indices[i] ))
+                            return true;
+                } else {
+                    bool hit0 = intersects( _ray, _bvh.nodes[node.first].bounds, dist0 ) && dist0 <= _tMax;
+                    bool hit1 = intersects( _ray, _bvh.nodes[node.first + 1].bounds, dist1 ) && dist1 <= _tMax;
+                    if(hit0 && hit1)
+                    {
+                        uint32 larger = surface(_bvh.nodes[node.first + 1].bounds) > surface(_bvh.nodes[node.first].bounds) ? 1 : 0;
+                        stack[stackSize++] = node.first + 1 - larger;
+                        current = node.first + larger;
+                        continue;
+                    }
+                    if(hit0 || hit1)
+                    {
+                        current = node.first + (hit0 ? 0 : 1);
+                        continue;
+                    }
+                }
+                if(stackSize == 0) return false;
+                current = stack[--stackSize];
+            }
+        }
+
+        // Any hit traversal of a wide BVH. The hit leaf children are tested
+        // before any inner child is entered, the inner children are
+        // visited near to far.
+        template<uint N, typename LeafTest>
+        inline bool anyHit( const WideBVH<N>& _bvh, const FastRay& _ray, float _tMax, LeafTest _leafTest )
+        {
+            if(_bvh.nodes.empty()) return false;
+            struct Entry { uint32 node; float dist; };
+            Entry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+            int stackSize = 0;
+            stack[stackSize++] = Entry{0, 0.0f};
+            alignas(N * sizeof(float)) float dist[N];
+            while(stackSize > 0)
+            {
+                const WideBVHNode<N>& node = _bvh.nodes[stack[--stackSize].node];
+                uint32 mask = intersects( _ray, node.bounds, dist, _tMax );
+                int first = stackSize;
+                while(mask)
+                {
+                    uint32 lane = countTrailingZeros(mask);
+                    mask &= mask - 1;
+                    if(node.count[lane])
+                    {
+                        for(uint32 i = node.child[lane]; i < node.child[lane] + node.count[lane]; ++i)
+                            if(_leafTest( _bvh.indices[i] ))
+                                return true;
+                        continue;
+                    }
+                    Entry child{node.child[lane], dist[lane]};
+                    int i = stackSize++;
+                    for(; i > first && stack[i - 1].dist < child.dist; --i)
+                        stack[i] = stack[i - 1];
+                    stack[i] = child;
+                }
+            }
+            return false;
+        }
+
+        // Batched any hit queries on multiple threads. Each thread writes
+        // whole words of the mask.
+        template<typename BVHType, typename T>
+        inline uint32 anyHits( const Ray* _rays, const float* _tMax, uint32 _num, const BVHType& _bvh, const T* _triangles, uint32* _hitMask, uint32 _numThreads )
+        {
+            uint32 numWords = (_num + 31) / 32;
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), _num / 256));
+            std::vector<uint32> numHits(numThreads, 0);
+            runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                uint32 begin, end;
+                threadRange(numWords, _thread, _numThreads, begin, end);
+                uint32 count = 0;
+                for(uint32 w = begin; w < end; ++w)
+                {
+                    uint32 word = 0;
+                    for(uint32 i = w * 32; i < ei::min(_num, w * 32 + 32); ++i)
+                    {
+                        float tMax = _tMax ? _tMax[i] : INF;
+                        if(anyHit( _bvh, FastRay(_rays[i]), tMax, TriangleOcclusion<T>{_rays[i], _triangles, tMax} ))
+                        {
+                            word |= 1u << (i % 32);
+                            ++count;
+                        }
+                    }
+                    if(_hitMask) _hitMask[w] = word;
+                }
+                numHits[_thread] = count;
+            });
+            uint32 total = 0;
+            for(uint32 n : numHits) total += n;
+            return total;
+        }
+    }
+
+    /// \brief Is any triangle of a mesh hit by a ray (shadow or visibility
+    ///     test)?
+    /// \details The traversal stops at the first hit. This is much cheaper
+    ///     than a closest hit query.
+    /// \param _bvh A BVH which was built for _triangles.
+    /// \param [in] _tMax Only hits with a ray parameter <= _tMax count, e.g.
+    ///     the distance to a light source.
+    inline bool intersects( const Ray& _ray, const BVH& _bvh, const Triangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<Triangle>{_ray, _triangles, _tMax} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH& _bvh, const FastTriangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<FastTriangle>{_ray, _triangles, _tMax} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH8& _bvh, const Triangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<Triangle>{_ray, _triangles, _tMax} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH4& _bvh, const Triangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<Triangle>{_ray, _triangles, _tMax} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH8& _bvh, const FastTriangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<FastTriangle>{_ray, _triangles, _tMax} );
+    }
+
+    inline bool intersects( const Ray& _ray, const BVH4& _bvh, const FastTriangle* _triangles, float _tMax = INF ) // TESTED
+    {
+        return details::anyHit( _bvh, FastRay(_ray), _tMax, details::TriangleOcclusion<FastTriangle>{_ray, _triangles, _tMax} );
+    }
+
+    /// \brief Any hit test for many rays on multiple threads.
+    /// \details Gives the same results as intersects(Ray, BVH, Triangle*, float)
+    ///     for each ray.
+    /// \param [in,opt] _tMax Maximum ray parameter of each ray. Pass nullptr
+    ///     for unlimited rays.
+    /// \param [out,opt] _hitMask Bitmask with (_num+31)/32 words. Bit i%32 of
+    ///     word i/32 is set if ray i hits a triangle. Pass nullptr if only the
+    ///     count is required.
+    /// \param [in] _numThreads Number of threads or 0 for all hardware
+    ///     threads.
+    /// \return Number of rays which hit a triangle.
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH& _bvh, const Triangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH& _bvh, const FastTriangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 )
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH8& _bvh, const Triangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH4& _bvh, const Triangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 )
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH8& _bvh, const FastTriangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 )
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    inline uint32 intersects( const Ray* _rays, const float* _tMax, uint32 _num, const BVH4& _bvh, const FastTriangle* _triangles, uint32* _hitMask, uint32 _numThreads = 0 )
+    {
+        return details::anyHits( _rays, _tMax, _num, _bvh, _triangles, _hitMask, _numThreads );
+    }
+
+    // ************************************************************************* //
+    //                             MESH OVERLAP                                  //
+    // ************************************************************************* //
+    // Tandem traversal of two BVHs which finds the intersecting triangles of
+    // two meshes, e.g. for interference checks. The second mesh may be placed
+    // by a rigid transformation relative to the first one. Its boxes are then
+    // tested as oriented boxes against the boxes of the first mesh. The top
+    // of the traversal is expanded into many independent node pairs which
+    // are processed in parallel.
+
+    /// \brief A pair of intersecting triangles of two meshes.
+    struct TrianglePair
+    {
+        uint32 a;   ///< Index into the triangles of the first mesh
+        uint32 b;   ///< Index into the triangles of the second mesh
+    };
+
+    namespace details {
+        // Number of independent node pairs for the parallel traversal. This
+        // is fixed, such that the order of the results does not depend on the
+        // number of threads.
+        const uint32 BVH_OVERLAP_TASKS = 1024;
+
+        // Both meshes in the same space.
+        struct IdentityFrame
+        {
+            bool overlap( const Box& _a, const Box& _b ) const  { return intersects( _a, _b ); }
+            const Triangle& operator () ( const Triangle& _triangle ) const  { return _triangle; }
+        };
+
+        // The second mesh is rotated and then translated into the space of
+        // the first mesh.
+        struct RigidFrame
+        {
+            Mat3x3 rotation;
+            Mat3x3 absRotation;
+            Vec3 translation;
+
+            RigidFrame( const Quaternion& _rotation, const Vec3& _translation ) :
+                rotation(ei::rotation(_rotation)),
+                absRotation(abs(rotation)),
+                translation(_translation)
+            {}
+
+            // SAT with the face normals of both boxes. The 9 edge axes are
+            // skipped: they rarely separate boxes of a tandem traversal and
+            // made the traversal slower. The scalar code is much faster than
+            // the matrix-vector products.
+            bool overlap( const Box& _a, const Box& _b ) const
+            {
+                Vec3 halfA = (_a.max - _a.min) * 0.5f;
+                Vec3 halfB = (_b.max - _b.min) * 0.5f;
+                Vec3 centerB = (_b.min + _b.max) * 0.5f;
+                Vec3 d;
+                for(int i = 0; i < 3; ++i)
+                {
+                    d[i] = rotation(i, 0) * centerB.x + rotation(i, 1) * centerB.y + rotation(i, 2) * centerB.z
+                         + translation[i] - (_a.min[i] + _a.max[i]) * 0.5f;
+                    float r = halfA[i] + absRotation(i, 0) * halfB.x + absRotation(i, 1) * halfB.y + absRotation(i, 2) * halfB.z;
+                    if(d[i] > r || d[i] < -r) return false;
+                }
+                for(int j = 0; j < 3; ++j)
+                {
+                    float p = rotation(0, j) * d.x + rotation(1, j) * d.y + rotation(2, j) * d.z;
+                    float r = halfB[j] + absRotation(0, j) * halfA.x + absRotation(1, j) * halfA.y + absRotation(2, j) * halfA.z;
+                    if(p > r || p < -r) return false;
+                }
+                return true;
+            }
+
+            Triangle operator () ( const Triangle& _triangle ) const
+            {
+                return Triangle(rotation * _triangle.v0 + translation,
+                                rotation * _triangle.v1 + translation,
+                                rotation * _triangle.v2 + translation);
+            }
+        };
+
+        struct NodePair
+        {
+            uint32 a;
+            uint32 b;
+        };
+
+        // Push the overlapping child pairs of an inner pair. The node with
+        // the larger surface is split, leaves are never split.
+        template<typename Frame, typename NodePairs>
+        inline void splitPair( const BVH& _bvhA, const BVH& _bvhB, const Frame& _frame, const NodePair& _pair, NodePairs& _out )
+        {
+            const BVHNode& a = _bvhA.nodes[_pair.a];
+            const BVHNode& b = _bvhB.nodes[_pair.b];
+            if(b.isLeaf() || (!a.isLeaf() && surface(a.bounds) >= surface(b.bounds)))
+            {
+                for(uint32 c = a.first; c < a.first + 2; ++c)
+                    if(_frame.overlap( _bvhA.nodes[c].bounds, b.bounds ))
+                        _out.push( NodePair{c, _pair.b} );
+            } else {
+                for(uint32 c = b.first; c < b.first + 2; ++c)
+                    if(_frame.overlap( a.bounds, _bvhB.nodes[c].bounds ))
+                        _out.push( NodePair{_pair.a, c} );
+            }
+        }
+
+        // Depth first traversal below an overlapping node pair. _report(a, b)
+        // is called for each intersecting triangle pair and returns false to
+        // stop. Returns false if stopped.
+        template<typename Frame, typename Report>
+        inline bool overlapTraversal( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB,
+            const Frame& _frame, const NodePair& _root, Report _report )
+        {
+            struct Stack
+            {
+                NodePair entries[2 * BVH_MAX_DEPTH + 2];
+                int size;
+                void push( const NodePair& _pair ) { entries[size++] = _pair; }
+            } stack;
+            stack.size = 0;
+            stack.push( _root );
+            while(stack.size > 0)
+            {
+                NodePair pair = stack.entries[--stack.size];
+                const BVHNode& a = _bvhA.nodes[pair.a];
+                const BVHNode& b = _bvhB.nodes[pair.b];
+                if(!(a.isLeaf() && b.isLeaf()))
+                {
+                    splitPair( _bvhA, _bvhB, _frame, pair, stack );
+                    continue;
+                }
+                for(uint32 j = b.first; j < b.first + b.count; ++j)
+                {
+                    Triangle triangleB = _frame( _trianglesB[_bvhB.indices[j]] );
+                    if(!intersects( a.bounds, Box(triangleB) ))
+                        continue;
+                    for(uint32 i = a.first; i < a.first + a.count; ++i)
+                        if(intersects( _trianglesA[_bvhA.indices[i]], triangleB )
+                            && !_report( _bvhA.indices[i], _bvhB.indices[j] ))
+                            return false;
+                }
+            }
+            return true;
+        }
+
+        template<typename Frame>
+        inline uint32 overlappingTriangles( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB,
+            const Frame& _frame, std::vector<TrianglePair>* _pairs, uint32 _numThreads )
+        {
+            if(_pairs) _pairs->clear();
+            if(_bvhA.nodes.empty() || _bvhB.nodes.empty() || !_frame.overlap( _bvhA.nodes[0].bounds, _bvhB.nodes[0].bounds ))
+                return 0;
+
+            // Expand the top of the traversal breadth first
+            struct Tasks
+            {
+                std::vector<NodePair> pairs;
+                void push( const NodePair& _pair ) { pairs.push_back(_pair); }
+            } tasks, next;
+            tasks.push( NodePair{0, 0} );
+            bool expanded = true;
+            while(expanded && tasks.pairs.size() < BVH_OVERLAP_TASKS)
+            {
+                expanded = false;
+                next.pairs.clear();
+                for(const NodePair& pair : tasks.pairs)
+                {
+                    if(_bvhA.nodes[pair.a].isLeaf() && _bvhB.nodes[pair.b].isLeaf())
+                        next.push( pair );
+                    else {
+                        splitPair( _bvhA, _bvhB, _frame, pair, next );
+                        expanded = true;
+                    }
+                }
+                std::swap(tasks.pairs, next.pairs);
+            }
+
+            // Process the tasks in any order, but store the results per task
+            // to keep the output order deterministic.
+            uint32 numTasks = uint32(tasks.pairs.size());
+            uint32 numThreads = ei::max(1u, ei::min(numWorkers(_numThreads), numTasks / 16,
+                uint32(_bvhA.nodes.size() + _bvhB.nodes.size()) / 4096));
+            std::vector<std::vector<TrianglePair>> results(_pairs ? numTasks : 0);
+            std::atomic<uint32> nextTask(0);
+            std::atomic<bool> found(false);
+            runParallel(numThreads, [&](uint32, uint32) {
+                for(uint32 task = nextTask++; task < numTasks; task = nextTask++)
+                {
+                    if(_pairs)
+                    {
+                        std::vector<TrianglePair>& result = results[task];
+                        overlapTraversal( _bvhA, _trianglesA, _bvhB, _trianglesB, _frame, tasks.pairs[task],
+                            [&result](uint32 _a, uint32 _b) { result.push_back(TrianglePair{_a, _b}); return true; } );
+                    } else {
+                        // Early out: all threads stop at the first pair
+                        if(found.load(std::memory_order_relaxed)) return;
+                        overlapTraversal( _bvhA, _trianglesA, _bvhB, _trianglesB, _frame, tasks.pairs[task],
+                            [&found](uint32, uint32) { found = true; return false; } );
+                    }
+                }
+            });
+            if(!_pairs) return found ? 1 : 0;
+            for(const std::vector<TrianglePair>& result : results)
+                _pairs->insert(_pairs->end(), result.begin(), result.end());
+            return uint32(_pairs->size());
+        }
+    }
+
+    /// \brief Do two triangle meshes intersect?
+    /// \details Stops at the first intersecting triangle pair.
+    /// \param _bvhA A BVH which was built for _trianglesA.
+    /// \param _bvhB A BVH which was built for _trianglesB.
+    /// \param [in] _numThreads Number of threads or 0 for all hardware
+    ///     threads.
+    inline bool intersects( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::overlappingTriangles( _bvhA, _trianglesA, _bvhB, _trianglesB, details::IdentityFrame(), nullptr, _numThreads ) != 0;
+    }
+
+    /// \brief Do two triangle meshes intersect if the second one is rotated
+    ///     and then translated into the space of the first one?
+    inline bool intersects( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB,
+        const Quaternion& _rotation, const Vec3& _translation, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::overlappingTriangles( _bvhA, _trianglesA, _bvhB, _trianglesB, details::RigidFrame(_rotation, _translation), nullptr, _numThreads ) != 0;
+    }
+
+    /// \brief Find all intersecting triangle pairs of two meshes.
+    /// \param [out] _pairs Cleared and filled with the pairs. The order is
+    ///     the same for any number of threads.
+    /// \return Number of pairs.
+    inline uint32 overlappingTriangles( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB,
+        std::vector<TrianglePair>& _pairs, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::overlappingTriangles( _bvhA, _trianglesA, _bvhB, _trianglesB, details::IdentityFrame(), &_pairs, _numThreads );
+    }
+
+    /// \brief Find all intersecting triangle pairs of two meshes, where the
+    ///     second one is rotated and then translated into the space of the
+    ///     first one.
+    inline uint32 overlappingTriangles( const BVH& _bvhA, const Triangle* _trianglesA, const BVH& _bvhB, const Triangle* _trianglesB,
+        const Quaternion& _rotation, const Vec3& _translation, std::vector<TrianglePair>& _pairs, uint32 _numThreads = 0 ) // TESTED
+    {
+        return details::overlappingTriangles( _bvhA, _trianglesA, _bvhB, _trianglesB, details::RigidFrame(_rotation, _translation), &_pairs, _numThreads );
+    }
+
+    // ************************************************************************* //
+    //                            FRUSTUM CULLING                                //
+    // ************************************************************************* //
+
+    /// \brief Hierarchical frustum culling of the primitives of a BVH.
+    /// \details Each node is classified against the planes which its parent
+    ///     straddles only (see classify(Box, FastFrustum, uint32&, uint32&)).
+    ///     Subtrees which are completely inside are accepted without any
+    ///     further test. Primitives in straddling leaves are classified by
+    ///     their own boxes. The result is the same as
+    ///     classify(_bounds[i], _frustum) != Visibility::OUTSIDE for each
+    ///     primitive i.
+    /// \param _bounds The boxes the BVH was built from.
+    /// \param [out] _visibleIndices Array with space for all primitives.
+    ///     Receives the indices of the visible primitives in traversal order.
+    /// \return Number of visible primitives (number of written indices).
+    inline uint32 intersectsIndices( const BVH& _bvh, const Box* _bounds, const FastFrustum& _frustum, uint32* _visibleIndices ) // TESTED
+    {
+        if(_bvh.nodes.empty()) return 0;
+        struct Entry { uint32 node; uint32 planeMask; };
+        Entry stack[details::BVH_MAX_DEPTH + 1];
+        int stackSize = 0;
+        stack[stackSize++] = Entry{0, FRUSTUM_ALL_PLANES};
+        // The plane which culled the last node likely culls its neighbors
+        uint32 lastRejectingPlane = 0;
+        uint32 numVisible = 0;
+        while(stackSize > 0)
+        {
+            Entry entry = stack[--stackSize];
+            const BVHNode& node = _bvh.nodes[entry.node];
+            if(entry.planeMask && classify( node.bounds, _frustum, entry.planeMask, lastRejectingPlane ) == Visibility::OUTSIDE)
+                continue;
+            if(node.isLeaf())
+            {
+                for(uint32 i = node.first; i < node.first + node.count; ++i)
+                {
+                    uint32 planeMask = entry.planeMask;
+                    uint32 index = _bvh.indices[i];
+                    if(!planeMask || classify( _bounds[index], _frustum, planeMask, lastRejectingPlane ) != Visibility::OUTSIDE)
+                        _visibleIndices[numVisible++] = index;
+                }
+            } else {
+                stack[stackSize++] = Entry{node.first + 1, entry.planeMask};
+                stack[stackSize++] = Entry{node.first, entry.planeMask};
+            }
+        }
+        return numVisible;
+    }
+
+}
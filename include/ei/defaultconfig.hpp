@@ -32,3 +32,14 @@
 ///    Level 1: Use assertions where errors are likely. Default option.
 ///    Level 2: Maximum. Permanent tests everywhere.
 #define EI_ASSERTION_LEVEL		2
+
+
+/// \brief Disable the usage of SSE/AVX intrinsics in the packet and batch
+///    kernels.
+/// \details The packet kernels use the instruction set of the compiler flags
+///    (e.g. -mavx or /arch:AVX). The batch kernels are compiled for each
+///    instruction set and choose one at runtime (see forceSimdLevel()).
+///    With this option all kernels use the scalar fallback.
+///
+///    The default is 'disabled'.
+//#define EI_NO_SIMD
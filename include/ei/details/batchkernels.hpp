@@ -0,0 +1,488 @@
+// Intentionally without include guard: the batch kernels are compiled once
+// per instruction set (see simddispatch.hpp). The public functions in
+// 3dbatch.hpp call the implementation for the active level.
+
+// Conservative classification of 8 spheres against the frustum planes.
+// Returns the lanes which are certainly visible in _inside and the lanes
+// which are certainly culled in _outside (each with bit i for lane i).
+inline void classifySpheres8( const Sphere* _spheres, uint _num, const FastFrustum& _frustum, uint32& _inside, uint32& _outside )
+{
+    alignas(32) float cx[8], cy[8], cz[8], rad[8];
+    uint i = 0;
+    for(; i < _num; ++i)
+    {
+        cx[i] = _spheres[i].center.x;
+        cy[i] = _spheres[i].center.y;
+        cz[i] = _spheres[i].center.z;
+        rad[i] = _spheres[i].radius;
+    }
+    for(; i < 8; ++i)
+        cx[i] = cy[i] = cz[i] = rad[i] = 0.0f;
+    Float8 x = Float8::load(cx);
+    Float8 y = Float8::load(cy);
+    Float8 z = Float8::load(cz);
+    Float8 r = Float8::load(rad);
+    Float8 negR = -r;
+
+    // Near and far plane. The comparisons are those of distance(Vec3, DOP)
+    // to get exactly the same culling as the single test.
+    Float8 d = Float8(_frustum.nf.n.x) * x + Float8(_frustum.nf.n.y) * y + Float8(_frustum.nf.n.z) * z;
+    Mask8 outside = ((d + Float8(_frustum.nf.d0)) < negR) | ((d + Float8(_frustum.nf.d1)) > r);
+    Mask8 inside = (d >= Float8(-_frustum.nf.d0)) & (d <= Float8(-_frustum.nf.d1));
+
+    // Side planes
+    const Plane* planes[4] = { &_frustum.l, &_frustum.r, &_frustum.b, &_frustum.t };
+    for(int p = 0; p < 4; ++p)
+    {
+        d = Float8(planes[p]->n.x) * x + Float8(planes[p]->n.y) * y + Float8(planes[p]->n.z) * z + Float8(planes[p]->d);
+        outside = outside | (d < negR);
+        inside = inside & (d >= Float8(0.0f));
+    }
+
+    uint32 valid = (1u << _num) - 1;
+    _inside = bits(inside) & valid;
+    _outside = bits(outside) | ~valid;
+}
+
+// Visibility of up to 8 spheres (bit i for sphere i).
+inline uint32 intersectsSpheres8( const Sphere* _spheres, uint _num, const FastFrustum& _frustum )
+{
+    uint32 inside, outside;
+    classifySpheres8( _spheres, _num, _frustum, inside, outside );
+    // The center is outside of at least one plane, but the sphere is
+    // not completely outside any plane. This happens only close to the
+    // frustum border. Use the exact test which handles the corners.
+    uint32 undecided = ~(inside | outside) & 0xff;
+    for(uint i = 0; undecided; ++i, undecided >>= 1)
+        if((undecided & 1) && intersects( _spheres[i], _frustum ))
+            inside |= 1u << i;
+    return inside;
+}
+
+// Visibility of many spheres as bitmask.
+inline uint32 visibleSpheres( const Sphere* _spheres, uint32 _num, const FastFrustum& _frustum, uint32* _visibleMask )
+{
+    uint32 count = 0;
+    for(uint32 i = 0; i < _num; i += 32)
+    {
+        uint32 word = 0;
+        for(uint32 j = i; j < _num && j < i + 32; j += 8)
+            word |= intersectsSpheres8( _spheres + j, ei::min(8u, _num - j), _frustum ) << (j - i);
+        _visibleMask[i / 32] = word;
+        count += countBits(word);
+    }
+    return count;
+}
+
+// Visibility of many spheres as compacted index list.
+inline uint32 visibleSphereIndices( const Sphere* _spheres, uint32 _num, const FastFrustum& _frustum, uint32* _visibleIndices )
+{
+    uint32 count = 0;
+    for(uint32 i = 0; i < _num; i += 8)
+    {
+        uint32 n = ei::min(8u, _num - i);
+        uint32 mask = intersectsSpheres8( _spheres + i, n, _frustum );
+        // Branchless compaction: always write and advance only on a hit.
+        // The write position is never larger than i+j < _num.
+        for(uint32 j = 0; j < n; ++j)
+        {
+            _visibleIndices[count] = i + j;
+            count += (mask >> j) & 1;
+        }
+    }
+    return count;
+}
+
+// Point containment kernels for 8 points at once. The constructors do
+// all the per-shape precomputation. Where possible the comparisons
+// mirror the single tests (including their NaN behavior).
+struct PointInBox8
+{
+    Float8 minX, minY, minZ, maxX, maxY, maxZ;
+    PointInBox8( const Box& _box ) :
+        minX(_box.min.x), minY(_box.min.y), minZ(_box.min.z),
+        maxX(_box.max.x), maxY(_box.max.y), maxZ(_box.max.z)
+    {}
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        return ~((_x < minX) | (_y < minY) | (_z < minZ) | (_x > maxX) | (_y > maxY)) & (_z <= maxZ);
+    }
+};
+
+struct PointInSphere8
+{
+    Float8 cx, cy, cz, radiusSq;
+    PointInSphere8( const Sphere& _sphere ) :
+        cx(_sphere.center.x), cy(_sphere.center.y), cz(_sphere.center.z), radiusSq(sq(_sphere.radius))
+    {}
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        Float8 dx = _x - cx, dy = _y - cy, dz = _z - cz;
+        return dx * dx + dy * dy + dz * dz <= radiusSq;
+    }
+};
+
+// Shared part of all shapes which transform the point into a local
+// unit space: o = M * (p - center) * scale (component wise).
+struct LocalSpace8
+{
+    Float8 cx, cy, cz;
+    Float8 m[9];
+    LocalSpace8( const Vec3& _center, const Mat3x3& _rotation, const Vec3& _scale ) :
+        cx(_center.x), cy(_center.y), cz(_center.z)
+    {
+        for(int i = 0; i < 3; ++i)
+            for(int j = 0; j < 3; ++j)
+                m[i*3+j] = Float8(_rotation(i,j) * _scale[i]);
+    }
+    void operator () ( Float8& _x, Float8& _y, Float8& _z ) const
+    {
+        Float8 dx = _x - cx, dy = _y - cy, dz = _z - cz;
+        _x = m[0] * dx + m[1] * dy + m[2] * dz;
+        _y = m[3] * dx + m[4] * dy + m[5] * dz;
+        _z = m[6] * dx + m[7] * dy + m[8] * dz;
+    }
+};
+
+struct PointInEllipsoid8
+{
+    LocalSpace8 space;
+    PointInEllipsoid8( const Ellipsoid& _ellipsoid ) :
+        space(_ellipsoid.center, identity3x3(), ellipsoidScale(_ellipsoid.radii))
+    {}
+    PointInEllipsoid8( const OEllipsoid& _oellipsoid ) :
+        space(_oellipsoid.center, rotation(_oellipsoid.orientation), ellipsoidScale(_oellipsoid.radii))
+    {}
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        space(_x, _y, _z);
+        return _x * _x + _y * _y + _z * _z <= Float8(1.0f);
+    }
+};
+
+struct PointInOBox8
+{
+    LocalSpace8 space;
+    Float8 hx, hy, hz;
+    PointInOBox8( const OBox& _obox ) :
+        space(_obox.center, rotation(conjugate(_obox.orientation)), Vec3(1.0f)),
+        hx(_obox.halfSides.x), hy(_obox.halfSides.y), hz(_obox.halfSides.z)
+    {}
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        space(_x, _y, _z);
+        return ~((_x < -hx) | (_y < -hy) | (_z < -hz) | (_x > hx) | (_y > hy)) & (_z <= hz);
+    }
+};
+
+struct PointInTetrahedron8
+{
+    // Per face: normal, a point on the face and the side of the
+    // opposite vertex (same computation as the single test).
+    Float8 nx[4], ny[4], nz[4], px[4], py[4], pz[4], side[4];
+    PointInTetrahedron8( const Tetrahedron& _tetrahedron )
+    {
+        Vec3 e01 = _tetrahedron.v1 - _tetrahedron.v0;
+        Vec3 e02 = _tetrahedron.v2 - _tetrahedron.v0;
+        Vec3 e03 = _tetrahedron.v3 - _tetrahedron.v0;
+        Vec3 e13 = _tetrahedron.v3 - _tetrahedron.v1;
+        Vec3 e23 = _tetrahedron.v3 - _tetrahedron.v2;
+        Vec3 n[4] = { cross(e01, e02), cross(e13, e01), cross(e23, e02), cross(e23, e13) };
+        float dt[4] = { dot(n[0], e03), dot(n[1], e02), dot(n[2], e01), dot(n[3], e03) };
+        for(int i = 0; i < 4; ++i)
+        {
+            // The last face uses v3 - point instead of point - v0
+            float f = i == 3 ? -1.0f : 1.0f;
+            Vec3 p = i == 3 ? _tetrahedron.v3 : _tetrahedron.v0;
+            nx[i] = Float8(n[i].x * f); ny[i] = Float8(n[i].y * f); nz[i] = Float8(n[i].z * f);
+            px[i] = Float8(p.x); py[i] = Float8(p.y); pz[i] = Float8(p.z);
+            side[i] = Float8(dt[i]);
+        }
+    }
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        Float8 zero(0.0f);
+        Mask8 outside = (nx[0] * (_x - px[0]) + ny[0] * (_y - py[0]) + nz[0] * (_z - pz[0])) * side[0] < zero;
+        for(int i = 1; i < 4; ++i)
+        {
+            Float8 dp = nx[i] * (_x - px[i]) + ny[i] * (_y - py[i]) + nz[i] * (_z - pz[i]);
+            outside = outside | (dp * side[i] < zero);
+        }
+        return ~outside;
+    }
+};
+
+struct PointInFastCone8
+{
+    Float8 ox, oy, oz, dx, dy, dz, height, cosThetaSq;
+    PointInFastCone8( const FastCone& _cone ) :
+        ox(_cone.centralRay.origin.x), oy(_cone.centralRay.origin.y), oz(_cone.centralRay.origin.z),
+        dx(_cone.centralRay.direction.x), dy(_cone.centralRay.direction.y), dz(_cone.centralRay.direction.z),
+        height(_cone.height), cosThetaSq(_cone.cosThetaSq)
+    {}
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        Float8 oToPX = _x - ox, oToPY = _y - oy, oToPZ = _z - oz;
+        Float8 dp = oToPX * dx + oToPY * dy + oToPZ * dz;
+        Mask8 outside = (dp < Float8(0.0f)) | (dp > height);
+        return ~outside & (dp * dp >= cosThetaSq * (oToPX * oToPX + oToPY * oToPY + oToPZ * oToPZ));
+    }
+};
+
+struct PointInFastFrustum8
+{
+    // Planes: 0 near/far DOP, 1-4 l r b t
+    Float8 nx[5], ny[5], nz[5], d[5];
+    PointInFastFrustum8( const FastFrustum& _frustum )
+    {
+        const Vec3* n[5] = { &_frustum.nf.n, &_frustum.l.n, &_frustum.r.n, &_frustum.b.n, &_frustum.t.n };
+        float dist[5] = { -_frustum.nf.d1, _frustum.l.d, _frustum.r.d, _frustum.b.d, _frustum.t.d };
+        for(int i = 0; i < 5; ++i)
+        {
+            nx[i] = Float8(n[i]->x); ny[i] = Float8(n[i]->y); nz[i] = Float8(n[i]->z);
+            d[i] = Float8(dist[i]);
+        }
+    }
+    Mask8 operator () ( Float8 _x, Float8 _y, Float8 _z ) const
+    {
+        Float8 zero(0.0f);
+        // distance(Vec3, DOP) > 0 happens for dot(n, p) > -d1 only
+        Float8 dn = nx[0] * _x + ny[0] * _y + nz[0] * _z;
+        Mask8 outside = dn > d[0];
+        for(int i = 1; i < 5; ++i)
+            outside = outside | ((nx[i] * _x + ny[i] * _y + nz[i] * _z + d[i]) < zero);
+        return ~outside;
+    }
+};
+
+// Run a point kernel over AoS points and write the bitmask (optional).
+template<class Kernel>
+inline uint32 testPoints( const Kernel& _kernel, const Vec3* _points, uint32 _num, uint32* _mask )
+{
+    alignas(32) float x[8], y[8], z[8];
+    uint32 count = 0;
+    for(uint32 i = 0; i < _num; i += 32)
+    {
+        uint32 word = 0;
+        for(uint32 j = i; j < _num && j < i + 32; j += 8)
+        {
+            uint32 n = ei::min(8u, _num - j);
+            uint32 k = 0;
+            for(; k < n; ++k)
+            {
+                x[k] = _points[j+k].x;
+                y[k] = _points[j+k].y;
+                z[k] = _points[j+k].z;
+            }
+            for(; k < 8; ++k)
+                x[k] = y[k] = z[k] = 0.0f;
+            uint32 hits = bits(_kernel( Float8::load(x), Float8::load(y), Float8::load(z) ));
+            word |= (hits & ((1u << n) - 1)) << (j - i);
+        }
+        if(_mask) _mask[i / 32] = word;
+        count += countBits(word);
+    }
+    return count;
+}
+
+// Run a point kernel over SoA points and write the bitmask (optional).
+template<class Kernel>
+inline uint32 testPoints( const Kernel& _kernel, const float* _x, const float* _y, const float* _z, uint32 _num, uint32* _mask )
+{
+    alignas(32) float x[8], y[8], z[8];
+    uint32 count = 0;
+    for(uint32 i = 0; i < _num; i += 32)
+    {
+        uint32 word = 0;
+        for(uint32 j = i; j < _num && j < i + 32; j += 8)
+        {
+            uint32 hits;
+            if(j + 8 <= _num)
+                hits = bits(_kernel( Float8::loadu(_x + j), Float8::loadu(_y + j), Float8::loadu(_z + j) ));
+            else {
+                uint32 n = _num - j;
+                for(uint32 k = 0; k < 8; ++k)
+                {
+                    x[k] = k < n ? _x[j+k] : 0.0f;
+                    y[k] = k < n ? _y[j+k] : 0.0f;
+                    z[k] = k < n ? _z[j+k] : 0.0f;
+                }
+                hits = bits(_kernel( Float8::load(x), Float8::load(y), Float8::load(z) )) & ((1u << n) - 1);
+            }
+            word |= hits << (j - i);
+        }
+        if(_mask) _mask[i / 32] = word;
+        count += countBits(word);
+    }
+    return count;
+}
+
+// Kernel type for each shape.
+template<class Shape> struct PointKernel;
+template<> struct PointKernel<Box> { typedef PointInBox8 type; };
+template<> struct PointKernel<Sphere> { typedef PointInSphere8 type; };
+template<> struct PointKernel<OBox> { typedef PointInOBox8 type; };
+template<> struct PointKernel<Ellipsoid> { typedef PointInEllipsoid8 type; };
+template<> struct PointKernel<OEllipsoid> { typedef PointInEllipsoid8 type; };
+template<> struct PointKernel<Tetrahedron> { typedef PointInTetrahedron8 type; };
+template<> struct PointKernel<FastCone> { typedef PointInFastCone8 type; };
+template<> struct PointKernel<FastFrustum> { typedef PointInFastFrustum8 type; };
+
+template<class Shape>
+inline uint32 pointsInside( const Vec3* _points, uint32 _num, const Shape& _shape, uint32* _insideMask )
+{
+    return testPoints( typename PointKernel<Shape>::type(_shape), _points, _num, _insideMask );
+}
+
+template<class Shape>
+inline uint32 pointsInside( const float* _x, const float* _y, const float* _z, uint32 _num, const Shape& _shape, uint32* _insideMask )
+{
+    return testPoints( typename PointKernel<Shape>::type(_shape), _x, _y, _z, _num, _insideMask );
+}
+
+// Plane side of many boxes, 8 at once.
+inline void classifyBoxes( const Plane& _plane, const Box* _boxes, uint32 _num, PlaneSide* _sides )
+{
+    alignas(32) float minX[8], minY[8], minZ[8], maxX[8], maxY[8], maxZ[8];
+    Float8 nx(_plane.n.x), ny(_plane.n.y), nz(_plane.n.z), d(_plane.d);
+    Float8 absNX(ei::abs(_plane.n.x)), absNY(ei::abs(_plane.n.y)), absNZ(ei::abs(_plane.n.z));
+    Float8 half(0.5f), zero(0.0f);
+    for(uint32 i = 0; i < _num; i += 8)
+    {
+        uint32 n = ei::min(8u, _num - i);
+        uint32 k = 0;
+        for(; k < n; ++k)
+        {
+            minX[k] = _boxes[i+k].min.x; minY[k] = _boxes[i+k].min.y; minZ[k] = _boxes[i+k].min.z;
+            maxX[k] = _boxes[i+k].max.x; maxY[k] = _boxes[i+k].max.y; maxZ[k] = _boxes[i+k].max.z;
+        }
+        for(; k < 8; ++k)
+            minX[k] = minY[k] = minZ[k] = maxX[k] = maxY[k] = maxZ[k] = 0.0f;
+        Float8 bMinX = Float8::load(minX), bMinY = Float8::load(minY), bMinZ = Float8::load(minZ);
+        Float8 bMaxX = Float8::load(maxX), bMaxY = Float8::load(maxY), bMaxZ = Float8::load(maxZ);
+        // Same operation order as in classify(Plane, Box)
+        Float8 offset = d + (nx * ((bMinX + bMaxX) * half) + ny * ((bMinY + bMaxY) * half) + nz * ((bMinZ + bMaxZ) * half));
+        Float8 projMax = (absNX * (bMaxX - bMinX) + absNY * (bMaxY - bMinY) + absNZ * (bMaxZ - bMinZ)) * half;
+        Mask8 straddling = abs(offset) <= projMax;
+        uint32 front = bits(~straddling & (offset > zero));
+        uint32 back = ~(bits(straddling) | front);
+        for(k = 0; k < n; ++k)
+            _sides[i+k] = PlaneSide(int8((front >> k) & 1) - int8((back >> k) & 1));
+    }
+}
+
+struct SphereTile
+{
+    // 8 padding elements allow unaligned loads at any tile position.
+    alignas(32) float x[OVERLAP_TILE_SIZE + 8], y[OVERLAP_TILE_SIZE + 8], z[OVERLAP_TILE_SIZE + 8], r[OVERLAP_TILE_SIZE + 8];
+
+    void load( const Sphere* _spheres, uint32 _num )
+    {
+        for(uint32 i = 0; i < _num; ++i)
+        {
+            x[i] = _spheres[i].center.x;
+            y[i] = _spheres[i].center.y;
+            z[i] = _spheres[i].center.z;
+            r[i] = _spheres[i].radius;
+        }
+        for(uint32 i = _num; i < _num + 8; ++i)
+            x[i] = y[i] = z[i] = r[i] = 0.0f;
+    }
+
+    struct Query
+    {
+        Float8 x, y, z, r;
+        Query( const Sphere& _sphere ) :
+            x(_sphere.center.x), y(_sphere.center.y), z(_sphere.center.z), r(_sphere.radius)
+        {}
+    };
+
+    // Test the query against the tile elements [_j, _j+8).
+    Mask8 test( const Query& _q, uint32 _j ) const
+    {
+        Float8 dx = Float8::loadu(x + _j) - _q.x;
+        Float8 dy = Float8::loadu(y + _j) - _q.y;
+        Float8 dz = Float8::loadu(z + _j) - _q.z;
+        Float8 rsum = _q.r + Float8::loadu(r + _j);
+        return dx * dx + dy * dy + dz * dz <= rsum * rsum;
+    }
+};
+
+struct BoxTile
+{
+    alignas(32) float minX[OVERLAP_TILE_SIZE + 8], minY[OVERLAP_TILE_SIZE + 8], minZ[OVERLAP_TILE_SIZE + 8];
+    alignas(32) float maxX[OVERLAP_TILE_SIZE + 8], maxY[OVERLAP_TILE_SIZE + 8], maxZ[OVERLAP_TILE_SIZE + 8];
+
+    void load( const Box* _boxes, uint32 _num )
+    {
+        for(uint32 i = 0; i < _num; ++i)
+        {
+            minX[i] = _boxes[i].min.x; minY[i] = _boxes[i].min.y; minZ[i] = _boxes[i].min.z;
+            maxX[i] = _boxes[i].max.x; maxY[i] = _boxes[i].max.y; maxZ[i] = _boxes[i].max.z;
+        }
+        for(uint32 i = _num; i < _num + 8; ++i)
+            minX[i] = minY[i] = minZ[i] = maxX[i] = maxY[i] = maxZ[i] = 0.0f;
+    }
+
+    struct Query
+    {
+        Float8 minX, minY, minZ, maxX, maxY, maxZ;
+        Query( const Box& _box ) :
+            minX(_box.min.x), minY(_box.min.y), minZ(_box.min.z),
+            maxX(_box.max.x), maxY(_box.max.y), maxZ(_box.max.z)
+        {}
+    };
+
+    // Same expression as intersects(Box, Box) for each axis.
+    static Mask8 overlaps( Float8 _min0, Float8 _max0, Float8 _min1, Float8 _max1 )
+    {
+        return (max(_max0, _max1) - min(_min0, _min1)) <= ((_max0 - _min0) + (_max1 - _min1));
+    }
+
+    Mask8 test( const Query& _q, uint32 _j ) const
+    {
+        return overlaps(_q.minX, _q.maxX, Float8::loadu(minX + _j), Float8::loadu(maxX + _j))
+             & overlaps(_q.minY, _q.maxY, Float8::loadu(minY + _j), Float8::loadu(maxY + _j))
+             & overlaps(_q.minZ, _q.maxZ, Float8::loadu(minZ + _j), Float8::loadu(maxZ + _j));
+    }
+};
+
+// Generic NxM overlap test. If _set1 is nullptr all pairs i < j of
+// _set0 are tested.
+template<class Tile, class T>
+inline uint32 tiledPairs( const T* _set0, uint32 _num0, const T* _set1, uint32 _num1, UVec2* _pairs, uint32 _maxPairs )
+{
+    bool self = _set1 == nullptr;
+    if(self) { _set1 = _set0; _num1 = _num0; }
+    Tile tile;
+    uint32 count = 0;
+    for(uint32 t = 0; t < _num1; t += OVERLAP_TILE_SIZE)
+    {
+        uint32 tileSize = ei::min(OVERLAP_TILE_SIZE, _num1 - t);
+        tile.load( _set1 + t, tileSize );
+        // In the self test only i < j is required
+        uint32 iEnd = self ? ei::min(_num0, t + tileSize) : _num0;
+        for(uint32 i = 0; i < iEnd; ++i)
+        {
+            typename Tile::Query q( _set0[i] );
+            uint32 j = (self && i >= t) ? i + 1 - t : 0;
+            for(; j < tileSize; j += 8)
+            {
+                uint32 valid = tileSize - j >= 8 ? 0xff : (1u << (tileSize - j)) - 1;
+                uint32 mask = bits(tile.test(q, j)) & valid;
+                emitPairs( i, t + j, mask, _pairs, _maxPairs, count );
+            }
+        }
+    }
+    return count;
+}
+
+inline uint32 overlapPairs( const Sphere* _set0, uint32 _num0, const Sphere* _set1, uint32 _num1, UVec2* _pairs, uint32 _maxPairs )
+{
+    return tiledPairs<SphereTile>( _set0, _num0, _set1, _num1, _pairs, _maxPairs );
+}
+
+inline uint32 overlapPairs( const Box* _set0, uint32 _num0, const Box* _set1, uint32 _num1, UVec2* _pairs, uint32 _maxPairs )
+{
+    return tiledPairs<BoxTile>( _set0, _num0, _set1, _num1, _pairs, _maxPairs );
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+namespace ei { namespace details {
+
+    // Number of threads for a requested count (0 = all hardware threads).
+    inline uint32 numWorkers( uint32 _requested )
+    {
+        if(_requested) return _requested;
+        uint32 n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // Contiguous part [_begin, _end) of [0, _num) for one of _numThreads.
+    inline void threadRange( uint32 _num, uint32 _thread, uint32 _numThreads, uint32& _begin, uint32& _end )
+    {
+        _begin = uint32(uint64(_num) * _thread / _numThreads);
+        _end = uint32(uint64(_num) * (_thread + 1) / _numThreads);
+    }
+
+    // Reusable barrier for a fixed number of threads.
+    class Barrier
+    {
+    public:
+        explicit Barrier( uint32 _numThreads ) :
+            m_numThreads(_numThreads),
+            m_waiting(0),
+            m_generation(0)
+        {}
+
+        void wait()
+        {
+            if(m_numThreads == 1) return;
+            std::unique_lock<std::mutex> lock(m_mutex);
+            uint32 generation = m_generation;
+            if(++m_waiting == m_numThreads)
+            {
+                m_waiting = 0;
+                ++m_generation;
+                m_condition.notify_all();
+            } else
+                m_condition.wait(lock, [&]{ return generation != m_generation; });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        uint32 m_numThreads;
+        uint32 m_waiting;
+        uint32 m_generation;
+    };
+
+    // Run _func(threadIndex, numThreads) on _numThreads threads. The calling
+    // thread is thread 0. Starting the threads once and synchronizing the
+    // phases with a Barrier is much cheaper than one spawn per phase.
+    template<typename Func>
+    inline void runParallel( uint32 _numThreads, const Func& _func )
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(_numThreads - 1);
+        for(uint32 t = 1; t < _numThreads; ++t)
+            threads.emplace_back([&_func, t, _numThreads]{ _func(t, _numThreads); });
+        _func(0, _numThreads);
+        for(auto& t : threads)
+            t.join();
+    }
+
+}} // namespace ei::details
@@ -0,0 +1,168 @@
+#pragma once
+
+// Detect the available instruction sets from the compiler flags. Each level
+// implies the lower ones. Define EI_NO_SIMD in the config to force the scalar
+// fallback (e.g. to compare results).
+#if !defined(EI_NO_SIMD)
+#   if defined(__AVX__)
+#       define EI_SIMD_AVX
+#   endif
+#   if defined(__SSE4_1__) || defined(EI_SIMD_AVX)
+#       define EI_SIMD_SSE41
+#   endif
+#   if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(EI_SIMD_SSE41)
+#       define EI_SIMD_SSE2
+#   endif
+// On x86 the batch kernels are compiled for all instruction sets and the best
+// one is chosen at runtime (cpuid). This does not depend on the compiler flags.
+#   if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#       define EI_SIMD_RUNTIME_DISPATCH
+#   endif
+#endif
+
+#ifdef EI_SIMD_RUNTIME_DISPATCH
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#   endif
+#endif
+
+// Enable an instruction set for all functions between EI_SIMD_TARGET_X and
+// EI_SIMD_TARGET_END, independent of the compiler flags. MSVC allows all
+// intrinsics everywhere and needs nothing.
+#if defined(__clang__)
+#   define EI_SIMD_TARGET_SSE2  _Pragma("clang attribute push (__attribute__((target(\"sse2\"))), apply_to = function)")
+#   define EI_SIMD_TARGET_SSE41 _Pragma("clang attribute push (__attribute__((target(\"sse4.1\"))), apply_to = function)")
+#   define EI_SIMD_TARGET_AVX2  _Pragma("clang attribute push (__attribute__((target(\"avx2\"))), apply_to = function)")
+#   define EI_SIMD_TARGET_END   _Pragma("clang attribute pop")
+#elif defined(__GNUC__)
+#   define EI_SIMD_TARGET_SSE2  _Pragma("GCC push_options") _Pragma("GCC target(\"sse2\")")
+#   define EI_SIMD_TARGET_SSE41 _Pragma("GCC push_options") _Pragma("GCC target(\"sse4.1\")")
+#   define EI_SIMD_TARGET_AVX2  _Pragma("GCC push_options") _Pragma("GCC target(\"avx2\")")
+#   define EI_SIMD_TARGET_END   _Pragma("GCC pop_options")
+#else
+#   define EI_SIMD_TARGET_SSE2
+#   define EI_SIMD_TARGET_SSE41
+#   define EI_SIMD_TARGET_AVX2
+#   define EI_SIMD_TARGET_END
+#endif
+
+namespace ei {
+
+    /// \brief Instruction set levels for the batched kernels (3dbatch.hpp).
+    /// \details Each level implies the lower ones. There are no 16 lane
+    ///     kernels, AVX512 uses the same kernels as AVX2.
+    enum struct SimdLevel
+    {
+        SCALAR,
+        SSE2,
+        SSE41,
+        AVX2,
+        AVX512
+    };
+
+    namespace details {
+        // Query the CPU. The levels with wide registers also require the OS
+        // to save them (XCR0).
+        inline SimdLevel cpuSimdLevel()
+        {
+#if defined(EI_SIMD_RUNTIME_DISPATCH) && defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            int maxLeaf = info[0];
+            __cpuid(info, 1);
+            if(!(info[3] & (1 << 26))) return SimdLevel::SCALAR;
+            if(!(info[2] & (1 << 19))) return SimdLevel::SSE2;
+            // OSXSAVE and AVX
+            if((info[2] & (3 << 27)) != (3 << 27) || maxLeaf < 7) return SimdLevel::SSE41;
+            unsigned long long xcr0 = _xgetbv(0);
+            __cpuidex(info, 7, 0);
+            if((xcr0 & 0x6) != 0x6 || !(info[1] & (1 << 5))) return SimdLevel::SSE41;
+            if((xcr0 & 0xe6) != 0xe6 || !(info[1] & (1 << 16))) return SimdLevel::AVX2;
+            return SimdLevel::AVX512;
+#elif defined(EI_SIMD_RUNTIME_DISPATCH)
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2")) return SimdLevel::AVX512;
+            if(__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+            if(__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE41;
+            if(__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+            return SimdLevel::SCALAR;
+#else
+            return SimdLevel::SCALAR;
+#endif
+        }
+
+        inline SimdLevel& activeSimdLevel()
+        {
+            static SimdLevel s_level = cpuSimdLevel();
+            return s_level;
+        }
+    }
+
+    /// \brief Highest level which is supported by the CPU and this build.
+    /// \details Without runtime dispatch (EI_NO_SIMD or not x86) this is
+    ///     always SCALAR.
+    inline SimdLevel detectedSimdLevel()
+    {
+        static const SimdLevel s_level = details::cpuSimdLevel();
+        return s_level;
+    }
+
+    /// \brief Level which is currently used by the batched kernels. The
+    ///     default is detectedSimdLevel().
+    inline SimdLevel simdLevel()
+    {
+        return details::activeSimdLevel();
+    }
+
+    /// \brief Force the batched kernels to use a certain level, e.g. to test
+    ///     or to compare the implementations.
+    /// \details Levels above detectedSimdLevel() are clamped. This is not
+    ///     thread safe. Do not call it while a batched kernel is running.
+    /// \return The level which is used from now on.
+    inline SimdLevel forceSimdLevel( SimdLevel _level )
+    {
+        if(_level > detectedSimdLevel()) _level = detectedSimdLevel();
+        details::activeSimdLevel() = _level;
+        return _level;
+    }
+
+} // namespace ei
+
+// Wrappers for each instruction set in ei::details::scalar, sse2, sse41 and
+// avx2. The packet kernels use the wrappers matching the compiler flags,
+// which are available directly in ei::details.
+#define EI_SIMD_KERNELS "simdwrappers.hpp"
+#include "simddispatch.hpp"
+
+#if defined(EI_SIMD_AVX)
+#   define EI_SIMD_ISA 3
+#elif defined(EI_SIMD_SSE41)
+#   define EI_SIMD_ISA 2
+#elif defined(EI_SIMD_SSE2)
+#   define EI_SIMD_ISA 1
+#else
+#   define EI_SIMD_ISA 0
+#endif
+namespace ei { namespace details {
+    namespace native {
+#       include "simdwrappers.hpp"
+    }
+    using namespace native;
+}} // namespace ei::details
+#undef EI_SIMD_ISA
+
+// Call the implementation of a function for the active level. The function
+// must exist in all instruction set namespaces (see simddispatch.hpp).
+#ifdef EI_SIMD_RUNTIME_DISPATCH
+#   define EI_SIMD_DISPATCH(call)                                  \
+        switch(simdLevel()) {                                      \
+        case SimdLevel::AVX512:                                    \
+        case SimdLevel::AVX2: return details::avx2::call;          \
+        case SimdLevel::SSE41: return details::sse41::call;        \
+        case SimdLevel::SSE2: return details::sse2::call;          \
+        default: return details::scalar::call;                     \
+        }
+#else
+#   define EI_SIMD_DISPATCH(call) return details::scalar::call
+#endif
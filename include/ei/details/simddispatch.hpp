@@ -0,0 +1,39 @@
+// Intentionally without include guard: compiles the file named by
+// EI_SIMD_KERNELS once for each instruction set which can be chosen at
+// runtime. Each copy is placed in its own namespace ei::details::scalar,
+// sse2, sse41 or avx2 and sees the matching EI_SIMD_ISA (0-3). The included
+// file must not include other headers itself.
+
+#define EI_SIMD_ISA 0
+namespace ei { namespace details { namespace scalar {
+#   include EI_SIMD_KERNELS
+}}}
+#undef EI_SIMD_ISA
+
+#ifdef EI_SIMD_RUNTIME_DISPATCH
+#define EI_SIMD_ISA 1
+EI_SIMD_TARGET_SSE2
+namespace ei { namespace details { namespace sse2 {
+#   include EI_SIMD_KERNELS
+}}}
+EI_SIMD_TARGET_END
+#undef EI_SIMD_ISA
+
+#define EI_SIMD_ISA 2
+EI_SIMD_TARGET_SSE41
+namespace ei { namespace details { namespace sse41 {
+#   include EI_SIMD_KERNELS
+}}}
+EI_SIMD_TARGET_END
+#undef EI_SIMD_ISA
+
+#define EI_SIMD_ISA 3
+EI_SIMD_TARGET_AVX2
+namespace ei { namespace details { namespace avx2 {
+#   include EI_SIMD_KERNELS
+}}}
+EI_SIMD_TARGET_END
+#undef EI_SIMD_ISA
+#endif
+
+#undef EI_SIMD_KERNELS
@@ -0,0 +1,202 @@
+// Intentionally without include guard: the wrappers are compiled once per
+// instruction set (see simd.hpp). The includer defines EI_SIMD_ISA:
+//  0 scalar, 1 SSE2, 2 SSE4.1, 3 AVX2 (only AVX is used for 8 lanes).
+
+
+// Thin wrappers for 4 and 8 float lanes. They are used to write the packet
+// and batch kernels only once for all instruction sets.
+// All operations follow the semantic of the scalar ei:: functions. In
+// particular min(x,y) and max(x,y) return x if any of the two is NaN,
+// comparisons with NaN are false except of !=.
+
+#if EI_SIMD_ISA >= 1
+struct Mask4
+{
+    __m128 v;
+    Mask4() noexcept {}
+    Mask4(__m128 _v) noexcept : v(_v) {}
+};
+
+struct Float4
+{
+    __m128 v;
+    Float4() noexcept {}
+    Float4(__m128 _v) noexcept : v(_v) {}
+    /// \brief Broadcast a scalar to all lanes.
+    explicit Float4(float _x) noexcept : v(_mm_set1_ps(_x)) {}
+    /// \brief Load from 16 byte aligned memory.
+    static Float4 load(const float* _p) noexcept { return _mm_load_ps(_p); }
+    /// \brief Load from unaligned memory.
+    static Float4 loadu(const float* _p) noexcept { return _mm_loadu_ps(_p); }
+    void store(float* _p) const noexcept { _mm_store_ps(_p, v); }
+    void storeu(float* _p) const noexcept { _mm_storeu_ps(_p, v); }
+};
+
+inline Float4 operator + (Float4 _a, Float4 _b) noexcept { return _mm_add_ps(_a.v, _b.v); }
+inline Float4 operator - (Float4 _a, Float4 _b) noexcept { return _mm_sub_ps(_a.v, _b.v); }
+inline Float4 operator * (Float4 _a, Float4 _b) noexcept { return _mm_mul_ps(_a.v, _b.v); }
+inline Float4 operator / (Float4 _a, Float4 _b) noexcept { return _mm_div_ps(_a.v, _b.v); }
+inline Float4 operator - (Float4 _a) noexcept { return _mm_xor_ps(_a.v, _mm_set1_ps(-0.0f)); }
+// Operands swapped to get the NaN behavior of ei::min/ei::max.
+inline Float4 min(Float4 _a, Float4 _b) noexcept { return _mm_min_ps(_b.v, _a.v); }
+inline Float4 max(Float4 _a, Float4 _b) noexcept { return _mm_max_ps(_b.v, _a.v); }
+inline Float4 abs(Float4 _a) noexcept { return _mm_andnot_ps(_mm_set1_ps(-0.0f), _a.v); }
+inline Float4 sqrt(Float4 _a) noexcept { return _mm_sqrt_ps(_a.v); }
+inline Mask4 operator <  (Float4 _a, Float4 _b) noexcept { return _mm_cmplt_ps(_a.v, _b.v); }
+inline Mask4 operator <= (Float4 _a, Float4 _b) noexcept { return _mm_cmple_ps(_a.v, _b.v); }
+inline Mask4 operator >  (Float4 _a, Float4 _b) noexcept { return _mm_cmpgt_ps(_a.v, _b.v); }
+inline Mask4 operator >= (Float4 _a, Float4 _b) noexcept { return _mm_cmpge_ps(_a.v, _b.v); }
+inline Mask4 operator == (Float4 _a, Float4 _b) noexcept { return _mm_cmpeq_ps(_a.v, _b.v); }
+inline Mask4 operator != (Float4 _a, Float4 _b) noexcept { return _mm_cmpneq_ps(_a.v, _b.v); }
+inline Mask4 operator & (Mask4 _a, Mask4 _b) noexcept { return _mm_and_ps(_a.v, _b.v); }
+inline Mask4 operator | (Mask4 _a, Mask4 _b) noexcept { return _mm_or_ps(_a.v, _b.v); }
+inline Mask4 operator ~ (Mask4 _a) noexcept { return _mm_xor_ps(_a.v, _mm_castsi128_ps(_mm_set1_epi32(-1))); }
+/// \brief Per lane _mask ? _a : _b
+inline Float4 select(Mask4 _mask, Float4 _a, Float4 _b) noexcept
+{
+#if EI_SIMD_ISA >= 2
+    return _mm_blendv_ps(_b.v, _a.v, _mask.v);
+#else
+    return _mm_or_ps(_mm_and_ps(_mask.v, _a.v), _mm_andnot_ps(_mask.v, _b.v));
+#endif
+}
+/// \brief Get one bit per lane (lane i -> bit i).
+inline uint32 bits(Mask4 _mask) noexcept { return uint32(_mm_movemask_ps(_mask.v)); }
+#else
+struct Mask4
+{
+    bool v[4];
+};
+
+struct Float4
+{
+    float v[4];
+    Float4() noexcept {}
+    explicit Float4(float _x) noexcept { v[0] = v[1] = v[2] = v[3] = _x; }
+    static Float4 load(const float* _p) noexcept { Float4 r; for(int i = 0; i < 4; ++i) r.v[i] = _p[i]; return r; }
+    static Float4 loadu(const float* _p) noexcept { return load(_p); }
+    void store(float* _p) const noexcept { for(int i = 0; i < 4; ++i) _p[i] = v[i]; }
+    void storeu(float* _p) const noexcept { store(_p); }
+};
+
+#   define EI_SIMD_SCALAR_OP(RetType, expr)                               \
+    { RetType r; for(int i = 0; i < 4; ++i) r.v[i] = (expr); return r; }
+inline Float4 operator + (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] + _b.v[i])
+inline Float4 operator - (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] - _b.v[i])
+inline Float4 operator * (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] * _b.v[i])
+inline Float4 operator / (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] / _b.v[i])
+inline Float4 operator - (Float4 _a) noexcept EI_SIMD_SCALAR_OP(Float4, -_a.v[i])
+inline Float4 min(Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] > _b.v[i] ? _b.v[i] : _a.v[i])
+inline Float4 max(Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _a.v[i] < _b.v[i] ? _b.v[i] : _a.v[i])
+inline Float4 abs(Float4 _a) noexcept EI_SIMD_SCALAR_OP(Float4, std::abs(_a.v[i]))
+inline Float4 sqrt(Float4 _a) noexcept EI_SIMD_SCALAR_OP(Float4, std::sqrt(_a.v[i]))
+inline Mask4 operator <  (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] <  _b.v[i])
+inline Mask4 operator <= (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] <= _b.v[i])
+inline Mask4 operator >  (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] >  _b.v[i])
+inline Mask4 operator >= (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] >= _b.v[i])
+inline Mask4 operator == (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] == _b.v[i])
+inline Mask4 operator != (Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] != _b.v[i])
+inline Mask4 operator & (Mask4 _a, Mask4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] && _b.v[i])
+inline Mask4 operator | (Mask4 _a, Mask4 _b) noexcept EI_SIMD_SCALAR_OP(Mask4, _a.v[i] || _b.v[i])
+inline Mask4 operator ~ (Mask4 _a) noexcept EI_SIMD_SCALAR_OP(Mask4, !_a.v[i])
+inline Float4 select(Mask4 _mask, Float4 _a, Float4 _b) noexcept EI_SIMD_SCALAR_OP(Float4, _mask.v[i] ? _a.v[i] : _b.v[i])
+#   undef EI_SIMD_SCALAR_OP
+inline uint32 bits(Mask4 _mask) noexcept
+{
+    return uint32(_mask.v[0]) | (uint32(_mask.v[1]) << 1) | (uint32(_mask.v[2]) << 2) | (uint32(_mask.v[3]) << 3);
+}
+#endif
+
+#if EI_SIMD_ISA >= 3
+struct Mask8
+{
+    __m256 v;
+    Mask8() noexcept {}
+    Mask8(__m256 _v) noexcept : v(_v) {}
+};
+
+struct Float8
+{
+    __m256 v;
+    Float8() noexcept {}
+    Float8(__m256 _v) noexcept : v(_v) {}
+    /// \brief Broadcast a scalar to all lanes.
+    explicit Float8(float _x) noexcept : v(_mm256_set1_ps(_x)) {}
+    /// \brief Load from 32 byte aligned memory.
+    static Float8 load(const float* _p) noexcept { return _mm256_load_ps(_p); }
+    /// \brief Load from unaligned memory.
+    static Float8 loadu(const float* _p) noexcept { return _mm256_loadu_ps(_p); }
+    void store(float* _p) const noexcept { _mm256_store_ps(_p, v); }
+    void storeu(float* _p) const noexcept { _mm256_storeu_ps(_p, v); }
+};
+
+inline Float8 operator + (Float8 _a, Float8 _b) noexcept { return _mm256_add_ps(_a.v, _b.v); }
+inline Float8 operator - (Float8 _a, Float8 _b) noexcept { return _mm256_sub_ps(_a.v, _b.v); }
+inline Float8 operator * (Float8 _a, Float8 _b) noexcept { return _mm256_mul_ps(_a.v, _b.v); }
+inline Float8 operator / (Float8 _a, Float8 _b) noexcept { return _mm256_div_ps(_a.v, _b.v); }
+inline Float8 operator - (Float8 _a) noexcept { return _mm256_xor_ps(_a.v, _mm256_set1_ps(-0.0f)); }
+inline Float8 min(Float8 _a, Float8 _b) noexcept { return _mm256_min_ps(_b.v, _a.v); }
+inline Float8 max(Float8 _a, Float8 _b) noexcept { return _mm256_max_ps(_b.v, _a.v); }
+inline Float8 abs(Float8 _a) noexcept { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), _a.v); }
+inline Float8 sqrt(Float8 _a) noexcept { return _mm256_sqrt_ps(_a.v); }
+inline Mask8 operator <  (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_LT_OQ); }
+inline Mask8 operator <= (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_LE_OQ); }
+inline Mask8 operator >  (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_GT_OQ); }
+inline Mask8 operator >= (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_GE_OQ); }
+inline Mask8 operator == (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_EQ_OQ); }
+inline Mask8 operator != (Float8 _a, Float8 _b) noexcept { return _mm256_cmp_ps(_a.v, _b.v, _CMP_NEQ_UQ); }
+inline Mask8 operator & (Mask8 _a, Mask8 _b) noexcept { return _mm256_and_ps(_a.v, _b.v); }
+inline Mask8 operator | (Mask8 _a, Mask8 _b) noexcept { return _mm256_or_ps(_a.v, _b.v); }
+inline Mask8 operator ~ (Mask8 _a) noexcept { return _mm256_xor_ps(_a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))); }
+inline Float8 select(Mask8 _mask, Float8 _a, Float8 _b) noexcept { return _mm256_blendv_ps(_b.v, _a.v, _mask.v); }
+inline uint32 bits(Mask8 _mask) noexcept { return uint32(_mm256_movemask_ps(_mask.v)); }
+#else
+// Without AVX two 4-lane halves are used (SSE or scalar).
+struct Mask8
+{
+    Mask4 lo, hi;
+};
+
+struct Float8
+{
+    Float4 lo, hi;
+    Float8() noexcept {}
+    Float8(Float4 _lo, Float4 _hi) noexcept : lo(_lo), hi(_hi) {}
+    explicit Float8(float _x) noexcept : lo(_x), hi(_x) {}
+    static Float8 load(const float* _p) noexcept { return Float8(Float4::load(_p), Float4::load(_p + 4)); }
+    static Float8 loadu(const float* _p) noexcept { return Float8(Float4::loadu(_p), Float4::loadu(_p + 4)); }
+    void store(float* _p) const noexcept { lo.store(_p); hi.store(_p + 4); }
+    void storeu(float* _p) const noexcept { lo.storeu(_p); hi.storeu(_p + 4); }
+};
+
+#   define EI_SIMD_SPLIT_OP(RetType, expr) { RetType r; { auto& s = r.lo; auto& a = _a.lo; auto& b = _b.lo; (void)b; s = (expr); } { auto& s = r.hi; auto& a = _a.hi; auto& b = _b.hi; (void)b; s = (expr); } return r; }
+inline Float8 operator + (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, a + b)
+inline Float8 operator - (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, a - b)
+inline Float8 operator * (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, a * b)
+inline Float8 operator / (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, a / b)
+inline Float8 min(Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, min(a, b))
+inline Float8 max(Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Float8, max(a, b))
+inline Mask8 operator <  (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a <  b)
+inline Mask8 operator <= (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a <= b)
+inline Mask8 operator >  (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a >  b)
+inline Mask8 operator >= (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a >= b)
+inline Mask8 operator == (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a == b)
+inline Mask8 operator != (Float8 _a, Float8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a != b)
+inline Mask8 operator & (Mask8 _a, Mask8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a & b)
+inline Mask8 operator | (Mask8 _a, Mask8 _b) noexcept EI_SIMD_SPLIT_OP(Mask8, a | b)
+#   undef EI_SIMD_SPLIT_OP
+inline Float8 operator - (Float8 _a) noexcept { return Float8(-_a.lo, -_a.hi); }
+inline Float8 abs(Float8 _a) noexcept { return Float8(abs(_a.lo), abs(_a.hi)); }
+inline Float8 sqrt(Float8 _a) noexcept { return Float8(sqrt(_a.lo), sqrt(_a.hi)); }
+inline Mask8 operator ~ (Mask8 _a) noexcept { Mask8 r; r.lo = ~_a.lo; r.hi = ~_a.hi; return r; }
+inline Float8 select(Mask8 _mask, Float8 _a, Float8 _b) noexcept
+{
+    return Float8(select(_mask.lo, _a.lo, _b.lo), select(_mask.hi, _a.hi, _b.hi));
+}
+inline uint32 bits(Mask8 _mask) noexcept { return bits(_mask.lo) | (bits(_mask.hi) << 4); }
+#endif
+
+/// \brief Select the wrapper type by lane count.
+template<uint N> struct FloatN;
+template<> struct FloatN<4> { typedef Float4 type; typedef Mask4 mask; };
+template<> struct FloatN<8> { typedef Float8 type; typedef Mask8 mask; };
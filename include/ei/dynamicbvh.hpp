@@ -0,0 +1,327 @@
+#pragma once
+
+#include "bvh.hpp"
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                           DYNAMIC BVH                                     //
+    // ************************************************************************* //
+    // An incrementally updated binary BVH for moving objects. Each object is a
+    // leaf (proxy) with a "fat" box which is larger than the object. Small
+    // movements inside the fat box do not touch the tree at all. Otherwise the
+    // leaf is removed and inserted again at the best place (surface area
+    // heuristic) and the ancestors are balanced with tree rotations. The nodes
+    // are taken from a pool with a free list, so the operations only allocate
+    // if the pool is exhausted (see reserve()).
+
+    class DynamicBVH
+    {
+    public:
+        /// \brief Marker of a missing node.
+        static const uint32 NO_NODE = 0xffffffff;
+        /// \brief The rotations keep the tree balanced, so its height is
+        ///     about 1.44 log2(n) at most. The queries use a stack of this
+        ///     size.
+        static const uint32 MAX_HEIGHT = 64;
+
+        /// \param [in] _margin Enlargement of the fat boxes in all directions.
+        explicit DynamicBVH( float _margin = 0.1f ) :
+            m_root(NO_NODE),
+            m_freeList(NO_NODE),
+            m_numProxies(0),
+            m_margin(_margin)
+        {}
+
+        /// \brief Preallocate the nodes for _numProxies objects.
+        void reserve( uint32 _numProxies )
+        {
+            m_nodes.reserve(ei::max(1u, 2 * _numProxies) - 1);
+        }
+
+        /// \brief Add an object.
+        /// \param [in] _userData Arbitrary value which is given to the query
+        ///     callbacks together with the proxy.
+        /// \return The proxy of the object. It stays valid until remove().
+        uint32 insert( const Box& _bounds, uint32 _userData )
+        {
+            uint32 proxy = allocateNode();
+            Node& node = m_nodes[proxy];
+            node.bounds = fatBox(_bounds, Vec3(0.0f));
+            node.userData = _userData;
+            node.height = 0;
+            insertLeaf(proxy);
+            ++m_numProxies;
+            return proxy;
+        }
+
+        /// \brief Remove an object. The proxy may be reused by later inserts.
+        void remove( uint32 _proxy )
+        {
+            eiAssert( _proxy < m_nodes.size() && m_nodes[_proxy].height == 0, "Invalid proxy!" );
+            removeLeaf(_proxy);
+            freeNode(_proxy);
+            --m_numProxies;
+        }
+
+        /// \brief Update the bounds of a moved object.
+        /// \details Nothing happens if the new bounds are still inside the fat
+        ///     box. Otherwise the object is reinserted with a new fat box.
+        /// \param [in] _displacement Expected movement until the next update
+        ///     (e.g. velocity * time step). The fat box is extended into this
+        ///     direction to reduce the number of reinsertions.
+        /// \return true if the tree was changed.
+        bool move( uint32 _proxy, const Box& _bounds, const Vec3& _displacement = Vec3(0.0f) )
+        {
+            eiAssert( _proxy < m_nodes.size() && m_nodes[_proxy].height == 0, "Invalid proxy!" );
+            const Box& fat = m_nodes[_proxy].bounds;
+            if(_bounds.min.x >= fat.min.x && _bounds.min.y >= fat.min.y && _bounds.min.z >= fat.min.z
+                && _bounds.max.x <= fat.max.x && _bounds.max.y <= fat.max.y && _bounds.max.z <= fat.max.z)
+                return false;
+            removeLeaf(_proxy);
+            m_nodes[_proxy].bounds = fatBox(_bounds, _displacement);
+            insertLeaf(_proxy);
+            return true;
+        }
+
+        /// \brief Call _callback(proxy, userData) for each object whose fat
+        ///     box intersects _shape.
+        /// \details Works for all shapes with an intersects(Shape, Box) test.
+        ///     The callback must return false to stop the query or true to
+        ///     continue. It must not change the tree.
+        template<typename Shape, typename Callback>
+        void query( const Shape& _shape, Callback _callback ) const
+        {
+            if(m_root == NO_NODE) return;
+            uint32 stack[MAX_HEIGHT + 1];
+            int stackSize = 0;
+            stack[stackSize++] = m_root;
+            while(stackSize > 0)
+            {
+                const Node& node = m_nodes[stack[--stackSize]];
+                if(!intersects( _shape, node.bounds ))
+                    continue;
+                if(node.isLeaf())
+                {
+                    if(!_callback( uint32(&node - m_nodes.data()), node.userData ))
+                        return;
+                } else {
+                    stack[stackSize++] = node.left;
+                    stack[stackSize++] = node.right;
+                }
+            }
+        }
+
+        /// \brief The fat box of an object.
+        const Box& fatBounds( uint32 _proxy ) const  { return m_nodes[_proxy].bounds; }
+        /// \brief The user data given to insert().
+        uint32 userData( uint32 _proxy ) const       { return m_nodes[_proxy].userData; }
+        /// \brief Number of objects in the tree.
+        uint32 size() const                          { return m_numProxies; }
+        /// \brief Height of the tree, 0 for a single object.
+        uint32 height() const                        { return m_root == NO_NODE ? 0 : uint32(m_nodes[m_root].height); }
+
+    private:
+        struct Node
+        {
+            Box bounds;
+            uint32 parent;      ///< Parent node or the next free node for nodes in the free list.
+            uint32 left;
+            uint32 right;
+            int32 height;       ///< 0 for leaves, -1 for free nodes.
+            uint32 userData;
+
+            bool isLeaf() const noexcept { return height == 0; }
+        };
+
+        std::vector<Node> m_nodes;
+        uint32 m_root;
+        uint32 m_freeList;
+        uint32 m_numProxies;
+        float m_margin;
+
+        uint32 allocateNode()
+        {
+            if(m_freeList == NO_NODE)
+            {
+                m_nodes.emplace_back();
+                m_nodes.back().height = -1;
+                m_nodes.back().parent = NO_NODE;
+                m_freeList = uint32(m_nodes.size() - 1);
+            }
+            uint32 index = m_freeList;
+            Node& node = m_nodes[index];
+            m_freeList = node.parent;
+            node.parent = NO_NODE;
+            node.left = NO_NODE;
+            node.right = NO_NODE;
+            node.height = 0;
+            return index;
+        }
+
+        void freeNode( uint32 _index )
+        {
+            m_nodes[_index].parent = m_freeList;
+            m_nodes[_index].height = -1;
+            m_freeList = _index;
+        }
+
+        Box fatBox( const Box& _bounds, const Vec3& _displacement ) const
+        {
+            Box box;
+            box.min = _bounds.min - m_margin + min(_displacement, Vec3(0.0f));
+            box.max = _bounds.max + m_margin + max(_displacement, Vec3(0.0f));
+            return box;
+        }
+
+        // Surface of the union of two boxes
+        static float unionSurface( const Box& _a, const Box& _b )
+        {
+            float x = ei::max(_a.max.x, _b.max.x) - ei::min(_a.min.x, _b.min.x);
+            float y = ei::max(_a.max.y, _b.max.y) - ei::min(_a.min.y, _b.min.y);
+            float z = ei::max(_a.max.z, _b.max.z) - ei::min(_a.min.z, _b.min.z);
+            return 2.0f * (x * y + y * z + z * x);
+        }
+
+        // Recompute the bounds and the height from the children.
+        void refit( uint32 _index )
+        {
+            Node& node = m_nodes[_index];
+            const Node& left = m_nodes[node.left];
+            const Node& right = m_nodes[node.right];
+            node.bounds = left.bounds;
+            details::extend(node.bounds, right.bounds);
+            node.height = 1 + ei::max(left.height, right.height);
+        }
+
+        // Rebalance and refit all nodes from _index up to the root.
+        void updateAncestors( uint32 _index )
+        {
+            while(_index != NO_NODE)
+            {
+                _index = balance(_index);
+                refit(_index);
+                _index = m_nodes[_index].parent;
+            }
+        }
+
+        void insertLeaf( uint32 _leaf )
+        {
+            if(m_root == NO_NODE)
+            {
+                m_root = _leaf;
+                m_nodes[_leaf].parent = NO_NODE;
+                return;
+            }
+
+            // Descend to the sibling with the smallest surface area cost. The
+            // cost of an inner node is the new parent plus the growth of all
+            // ancestors.
+            const Box leafBounds = m_nodes[_leaf].bounds;
+            uint32 index = m_root;
+            while(!m_nodes[index].isLeaf())
+            {
+                const Node& node = m_nodes[index];
+                float area = surface(node.bounds);
+                float combinedArea = unionSurface(node.bounds, leafBounds);
+                float cost = 2.0f * combinedArea;
+                float inheritance = 2.0f * (combinedArea - area);
+                float costLeft = unionSurface(m_nodes[node.left].bounds, leafBounds) + inheritance;
+                if(!m_nodes[node.left].isLeaf()) costLeft -= surface(m_nodes[node.left].bounds);
+                float costRight = unionSurface(m_nodes[node.right].bounds, leafBounds) + inheritance;
+                if(!m_nodes[node.right].isLeaf()) costRight -= surface(m_nodes[node.right].bounds);
+                if(cost < costLeft && cost < costRight)
+                    break;
+                index = costLeft < costRight ? node.left : node.right;
+            }
+
+            // Replace the sibling by a new parent of the sibling and the leaf
+            uint32 sibling = index;
+            uint32 newParent = allocateNode();
+            uint32 oldParent = m_nodes[sibling].parent;
+            Node& parent = m_nodes[newParent];
+            parent.parent = oldParent;
+            parent.left = sibling;
+            parent.right = _leaf;
+            parent.userData = 0;
+            m_nodes[sibling].parent = newParent;
+            m_nodes[_leaf].parent = newParent;
+            if(oldParent == NO_NODE)
+                m_root = newParent;
+            else if(m_nodes[oldParent].left == sibling)
+                m_nodes[oldParent].left = newParent;
+            else
+                m_nodes[oldParent].right = newParent;
+            updateAncestors(newParent);
+        }
+
+        void removeLeaf( uint32 _leaf )
+        {
+            if(_leaf == m_root)
+            {
+                m_root = NO_NODE;
+                return;
+            }
+            // Replace the parent by the sibling
+            uint32 parent = m_nodes[_leaf].parent;
+            uint32 grandParent = m_nodes[parent].parent;
+            uint32 sibling = m_nodes[parent].left == _leaf ? m_nodes[parent].right : m_nodes[parent].left;
+            m_nodes[sibling].parent = grandParent;
+            freeNode(parent);
+            if(grandParent == NO_NODE)
+            {
+                m_root = sibling;
+                return;
+            }
+            if(m_nodes[grandParent].left == parent)
+                m_nodes[grandParent].left = sibling;
+            else
+                m_nodes[grandParent].right = sibling;
+            updateAncestors(grandParent);
+        }
+
+        // If the heights of the children of _a differ by more than one, the
+        // higher child C becomes the parent of _a. The higher grandchild
+        // below C stays at C, the other one moves to _a.
+        // Returns the index of the node which is now at the place of _a.
+        uint32 balance( uint32 _a )
+        {
+            Node& a = m_nodes[_a];
+            if(a.isLeaf() || a.height < 2)
+                return _a;
+            int32 diff = m_nodes[a.right].height - m_nodes[a.left].height;
+            if(diff > 1) return rotate(_a, a.right);
+            if(diff < -1) return rotate(_a, a.left);
+            return _a;
+        }
+
+        uint32 rotate( uint32 _a, uint32 _c )
+        {
+            Node& a = m_nodes[_a];
+            Node& c = m_nodes[_c];
+            uint32 f = c.left;
+            uint32 g = c.right;
+            // C takes the place of A
+            c.parent = a.parent;
+            a.parent = _c;
+            if(c.parent == NO_NODE)
+                m_root = _c;
+            else if(m_nodes[c.parent].left == _a)
+                m_nodes[c.parent].left = _c;
+            else
+                m_nodes[c.parent].right = _c;
+            // Keep the higher grandchild at C and give the other one to A
+            if(m_nodes[f].height < m_nodes[g].height)
+                std::swap(f, g);
+            c.left = _a;
+            c.right = f;
+            if(a.left == _c) a.left = g;
+            else a.right = g;
+            m_nodes[g].parent = _a;
+            refit(_a);
+            refit(_c);
+            return _c;
+        }
+    };
+
+}
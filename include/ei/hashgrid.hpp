@@ -0,0 +1,214 @@
+#pragma once
+
+#include "3dintersection.hpp"
+#include "stdextensions.hpp"
+#include "details/parallel.hpp"
+#include <vector>
+#include <atomic>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                             HASH GRID                                     //
+    // ************************************************************************* //
+    // A uniform grid of unbounded size for particles (points or spheres). The
+    // integer cell coordinates are hashed into a fixed number of buckets. The
+    // particles are sorted by their bucket with a parallel counting sort and
+    // copied into one compact array, so each bucket is a contiguous range.
+    // A query visits the buckets of all cells which are touched by the query
+    // sphere, so its cost depends on the number of nearby particles only.
+
+    class HashGrid
+    {
+    public:
+        /// \param [in] _cellSize Edge length of the cubic cells. A good
+        ///     choice is about the diameter of typical queries.
+        explicit HashGrid( float _cellSize ) :
+            m_invCellSize(1.0f / _cellSize),
+            m_maxRadius(0.0f),
+            m_mask(0)
+        {
+            eiAssert( _cellSize > 0.0f, "The cell size must be positive." );
+        }
+
+        /// \brief Replace the content by points.
+        /// \param [in] _numThreads Number of threads or 0 for all hardware
+        ///     threads.
+        void build( const Vec3* _points, uint32 _num, uint32 _numThreads = 0 )
+        {
+            build( _num, _numThreads, [_points](uint32 _i) { return Sphere(_points[_i], 0.0f); } );
+        }
+
+        /// \brief Replace the content by spheres. Each sphere is stored in
+        ///     the cell of its center, so queries get more expensive if the
+        ///     largest radius is much larger than the cell size.
+        void build( const Sphere* _spheres, uint32 _num, uint32 _numThreads = 0 )
+        {
+            build( _num, _numThreads, [_spheres](uint32 _i) { return _spheres[_i]; } );
+        }
+
+        /// \brief Call _callback(index) for each element which intersects
+        ///     _sphere (points inside or touching spheres).
+        /// \details The index refers to the array given to build(). The
+        ///     callback must return false to stop the query or true to
+        ///     continue.
+        template<typename Callback>
+        void query( const Sphere& _sphere, Callback _callback ) const
+        {
+            if(m_elements.empty()) return;
+            float range = _sphere.radius + m_maxRadius;
+            IVec3 lo = cell(_sphere.center - range);
+            IVec3 hi = cell(_sphere.center + range);
+            // Huge queries visit each bucket more than once, then a full
+            // scan is cheaper.
+            if(float(hi.x - lo.x + 1) * float(hi.y - lo.y + 1) * float(hi.z - lo.z + 1) > float(m_mask + 1))
+            {
+                for(uint32 i = 0; i < m_elements.size(); ++i)
+                    if(intersects( _sphere, m_elements[i] ) && !_callback( m_indices[i] ))
+                        return;
+                return;
+            }
+            IVec3 c;
+            for(c.z = lo.z; c.z <= hi.z; ++c.z)
+                for(c.y = lo.y; c.y <= hi.y; ++c.y)
+                    for(c.x = lo.x; c.x <= hi.x; ++c.x)
+                    {
+                        uint32 b = bucket(c);
+                        for(uint32 i = m_bucketStart[b]; i < m_bucketStart[b + 1]; ++i)
+                        {
+                            // Other cells with the same hash are visited on
+                            // their own (if they are in range at all).
+                            if(intersects( _sphere, m_elements[i] ) && cell(m_elements[i].center) == c
+                                && !_callback( m_indices[i] ))
+                                return;
+                        }
+                    }
+        }
+
+        /// \brief Find all elements within a distance of a point.
+        /// \param [out] _neighbors Cleared and filled with the indices of all
+        ///     elements which intersect the sphere (_center, _radius).
+        void neighbors( const Vec3& _center, float _radius, std::vector<uint32>& _neighbors ) const
+        {
+            _neighbors.clear();
+            query( Sphere(_center, _radius), [&_neighbors](uint32 _i) { _neighbors.push_back(_i); return true; } );
+        }
+
+        /// \brief Number of elements in the grid.
+        uint32 size() const                    { return uint32(m_elements.size()); }
+
+    private:
+        float m_invCellSize;
+        float m_maxRadius;
+        uint32 m_mask;                          ///< Number of buckets - 1 (power of two)
+        std::vector<Sphere> m_elements;         ///< Elements sorted by bucket
+        std::vector<uint32> m_indices;          ///< Original index of each element
+        std::vector<uint32> m_bucketStart;      ///< Bucket b is [m_bucketStart[b], m_bucketStart[b+1])
+
+        IVec3 cell( const Vec3& _position ) const
+        {
+            return IVec3(floor(_position.x * m_invCellSize),
+                         floor(_position.y * m_invCellSize),
+                         floor(_position.z * m_invCellSize));
+        }
+
+        uint32 bucket( const IVec3& _cell ) const
+        {
+            return uint32(std::hash<IVec3>()(_cell)) & m_mask;
+        }
+
+        template<typename GetElement>
+        void build( uint32 _num, uint32 _numThreads, const GetElement& _getElement )
+        {
+            // About one element per bucket
+            uint32 numBuckets = 1;
+            while(numBuckets < _num) numBuckets *= 2;
+            m_mask = numBuckets - 1;
+            m_elements.resize(_num);
+            m_indices.resize(_num);
+            m_bucketStart.assign(numBuckets + 1, 0);
+
+            // Each thread counts its part of the elements per chunk of
+            // buckets (the high bits of the bucket). The histograms of all
+            // threads are interleaved by a prefix sum, such that the scatter
+            // keeps the input order inside each chunk. Then the chunks are
+            // sorted by bucket independently. This needs O(threads * chunks)
+            // counters instead of a histogram of all buckets per thread.
+            uint32 numThreads = ei::max(1u, ei::min(details::numWorkers(_numThreads), _num / 16384));
+            uint32 numChunks = ei::min(numBuckets, 1024u);
+            uint32 chunkSize = numBuckets / numChunks;
+            std::vector<uint32> buckets(_num);
+            std::vector<uint32> chunkOrder(_num);
+            std::vector<uint32> histograms(size_t(numThreads) * numChunks, 0);
+            std::vector<uint32> chunkStart(numChunks + 1);
+            std::vector<float> maxRadius(numThreads, 0.0f);
+            std::atomic<uint32> nextChunk(0);
+            details::Barrier barrier(numThreads);
+            details::runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                uint32 begin, end;
+                details::threadRange(_num, _thread, _numThreads, begin, end);
+                uint32* histogram = histograms.data() + size_t(_thread) * numChunks;
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    Sphere element = _getElement(i);
+                    buckets[i] = bucket(cell(element.center));
+                    histogram[buckets[i] / chunkSize]++;
+                    maxRadius[_thread] = ei::max(maxRadius[_thread], element.radius);
+                }
+                barrier.wait();
+
+                // Turn the counts into offsets. There are only few chunks, so
+                // one thread does this alone.
+                if(_thread == 0)
+                {
+                    uint32 offset = 0;
+                    for(uint32 c = 0; c < numChunks; ++c)
+                    {
+                        chunkStart[c] = offset;
+                        for(uint32 t = 0; t < _numThreads; ++t)
+                        {
+                            uint32 count = histograms[size_t(t) * numChunks + c];
+                            histograms[size_t(t) * numChunks + c] = offset;
+                            offset += count;
+                        }
+                    }
+                    chunkStart[numChunks] = offset;
+                }
+                barrier.wait();
+                for(uint32 i = begin; i < end; ++i)
+                    chunkOrder[histogram[buckets[i] / chunkSize]++] = i;
+                barrier.wait();
+
+                // Stable counting sort of each chunk by its buckets
+                std::vector<uint32> offsets(chunkSize);
+                for(uint32 c = nextChunk++; c < numChunks; c = nextChunk++)
+                {
+                    uint32 firstBucket = c * chunkSize;
+                    std::fill(offsets.begin(), offsets.end(), 0);
+                    for(uint32 k = chunkStart[c]; k < chunkStart[c + 1]; ++k)
+                        offsets[buckets[chunkOrder[k]] - firstBucket]++;
+                    uint32 offset = chunkStart[c];
+                    for(uint32 b = 0; b < chunkSize; ++b)
+                    {
+                        m_bucketStart[firstBucket + b] = offset;
+                        uint32 count = offsets[b];
+                        offsets[b] = offset;
+                        offset += count;
+                    }
+                    for(uint32 k = chunkStart[c]; k < chunkStart[c + 1]; ++k)
+                    {
+                        uint32 i = chunkOrder[k];
+                        uint32 pos = offsets[buckets[i] - firstBucket]++;
+                        m_elements[pos] = _getElement(i);
+                        m_indices[pos] = i;
+                    }
+                }
+            });
+            m_bucketStart[numBuckets] = _num;
+            m_maxRadius = 0.0f;
+            for(float r : maxRadius)
+                m_maxRadius = ei::max(m_maxRadius, r);
+        }
+    };
+
+}
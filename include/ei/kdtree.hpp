@@ -0,0 +1,285 @@
+#pragma once
+
+#include "3dtypes.hpp"
+#include "details/parallel.hpp"
+#include <vector>
+#include <algorithm>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                               KD-TREE                                     //
+    // ************************************************************************* //
+    // A static kd-tree over points for nearest neighbor searches. The tree is
+    // complete and balanced, so it needs no node pointers: node i has the
+    // children 2i+1 and 2i+2 and the point range of each node follows from
+    // its position. Each inner node splits its range at the median of the
+    // axis with the largest extent. The leaves are buckets of a few points.
+    // The queries use fixed size stacks and the caller's output arrays, so
+    // they never allocate.
+
+    class KDTree
+    {
+    public:
+        /// \brief Marker for missing results.
+        static const uint32 NONE = 0xffffffff;
+
+        /// \brief Create an empty tree.
+        KDTree() : m_numLevels(0) {}
+
+        /// \brief Build the tree. The points are copied.
+        /// \param [in] _bucketSize Maximum number of points per leaf.
+        /// \param [in] _numThreads Number of threads or 0 for all hardware
+        ///     threads.
+        KDTree( const Vec3* _points, uint32 _num, uint32 _bucketSize = 8, uint32 _numThreads = 0 ) :
+            m_numLevels(0)
+        {
+            eiAssert( _bucketSize > 0, "A leaf must be allowed to contain points." );
+            while(m_numLevels < 31 && (_num >> m_numLevels) >= _bucketSize)
+                ++m_numLevels;
+            m_split.resize((size_t(1) << m_numLevels) - 1);
+            m_axis.resize(m_split.size());
+            std::vector<BuildPoint> points(_num);
+            for(uint32 i = 0; i < _num; ++i)
+                points[i] = BuildPoint{_points[i], i};
+
+            // All nodes of a level are independent
+            uint32 numThreads = ei::max(1u, ei::min(details::numWorkers(_numThreads), _num / 65536));
+            details::Barrier barrier(numThreads);
+            details::runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                for(uint32 level = 0; level < m_numLevels; ++level)
+                {
+                    uint32 begin, end;
+                    details::threadRange(1u << level, _thread, _numThreads, begin, end);
+                    for(uint32 k = begin; k < end; ++k)
+                        split(points, level, k);
+                    barrier.wait();
+                }
+            });
+            m_points.resize(_num);
+            m_indices.resize(_num);
+            for(uint32 i = 0; i < _num; ++i)
+            {
+                m_points[i] = points[i].position;
+                m_indices[i] = points[i].index;
+            }
+        }
+
+        /// \brief Number of points in the tree.
+        uint32 size() const    { return uint32(m_points.size()); }
+
+        /// \brief Find the k nearest points.
+        /// \param [out] _indices Array of at least _k entries. Receives the
+        ///     indices of the found points (into the array given to the
+        ///     constructor) sorted by increasing distance.
+        /// \param [out] _distancesSq Array of at least _k entries for the
+        ///     squared distances of the found points.
+        /// \param [in] _maxDistance Points which are farther away are ignored.
+        /// \return Number of found points: min(_k, number of points in range).
+        uint32 kNearest( const Vec3& _query, uint32 _k, uint32* _indices, float* _distancesSq, float _maxDistance = INF ) const
+        {
+            if(_k == 0) return 0;
+            // Max-heap of the best candidates in the output arrays
+            uint32 num = 0;
+            float worst = _maxDistance * _maxDistance;
+            traverse( _query, worst, [&](uint32 _point, float _distSq) {
+                if(num < _k)
+                    heapPush(_indices, _distancesSq, num++, m_indices[_point], _distSq);
+                else
+                    heapReplaceTop(_indices, _distancesSq, num, m_indices[_point], _distSq);
+                if(num == _k) worst = _distancesSq[0];
+                return worst;
+            } );
+            // Heap sort to get increasing distances
+            for(uint32 n = num; n > 1; --n)
+            {
+                std::swap(_indices[0], _indices[n - 1]);
+                std::swap(_distancesSq[0], _distancesSq[n - 1]);
+                siftDown(_indices, _distancesSq, n - 1, 0);
+            }
+            return num;
+        }
+
+        /// \brief Find the nearest point.
+        /// \param [out] _distanceSq Squared distance to the nearest point.
+        /// \return Index of the nearest point or NONE if there is no point
+        ///     within _maxDistance.
+        uint32 nearest( const Vec3& _query, float& _distanceSq, float _maxDistance = INF ) const
+        {
+            // Same as kNearest() with k = 1, but without the heap
+            uint32 index = NONE;
+            _distanceSq = INF;
+            traverse( _query, _maxDistance * _maxDistance, [&](uint32 _point, float _distSq) {
+                index = m_indices[_point];
+                _distanceSq = _distSq;
+                return _distSq;
+            } );
+            return index;
+        }
+
+        /// \brief Call _callback(index, distanceSq) for all points within
+        ///     _radius in arbitrary order.
+        /// \details The callback must return false to stop the query or true
+        ///     to continue.
+        template<typename Callback>
+        void radius( const Vec3& _query, float _radius, Callback _callback ) const
+        {
+            float radiusSq = _radius * _radius;
+            traverse( _query, radiusSq, [&](uint32 _point, float _distSq) {
+                return _callback( m_indices[_point], _distSq ) ? radiusSq : -1.0f;
+            } );
+        }
+
+        /// \brief Batched k nearest neighbor search on multiple threads.
+        /// \param [out] _indices Array of _num * _k entries. The results of
+        ///     query i start at i * _k. Missing results are NONE.
+        /// \param [out] _distancesSq Array of _num * _k entries. Missing
+        ///     results are INF.
+        void kNearest( const Vec3* _queries, uint32 _num, uint32 _k, uint32* _indices, float* _distancesSq, float _maxDistance = INF, uint32 _numThreads = 0 ) const
+        {
+            uint32 numThreads = ei::max(1u, ei::min(details::numWorkers(_numThreads), _num / 256));
+            details::runParallel(numThreads, [&](uint32 _thread, uint32 _numThreads) {
+                uint32 begin, end;
+                details::threadRange(_num, _thread, _numThreads, begin, end);
+                for(uint32 i = begin; i < end; ++i)
+                {
+                    uint32* indices = _indices + size_t(i) * _k;
+                    float* distancesSq = _distancesSq + size_t(i) * _k;
+                    for(uint32 j = kNearest( _queries[i], _k, indices, distancesSq, _maxDistance ); j < _k; ++j)
+                    {
+                        indices[j] = NONE;
+                        distancesSq[j] = INF;
+                    }
+                }
+            });
+        }
+
+        /// \brief Batched nearest neighbor search on multiple threads.
+        void nearest( const Vec3* _queries, uint32 _num, uint32* _indices, float* _distancesSq, float _maxDistance = INF, uint32 _numThreads = 0 ) const
+        {
+            kNearest( _queries, _num, 1, _indices, _distancesSq, _maxDistance, _numThreads );
+        }
+
+    private:
+        std::vector<Vec3> m_points;         ///< The points reordered by the tree
+        std::vector<uint32> m_indices;      ///< Original index of each point
+        std::vector<float> m_split;         ///< Split position of each inner node
+        std::vector<uint8> m_axis;          ///< Split axis of each inner node
+        uint32 m_numLevels;                 ///< Number of inner levels; the leaves are at this depth.
+
+        // First point of node k on a level. The median of a node is the
+        // first point of its right child.
+        static uint32 rangeBegin( uint32 _level, uint32 _k, uint32 _num )
+        {
+            return uint32((uint64(_num) * _k) >> _level);
+        }
+
+        struct BuildPoint
+        {
+            Vec3 position;
+            uint32 index;
+        };
+
+        // Split the range of node k on a level at the median.
+        void split( std::vector<BuildPoint>& _points, uint32 _level, uint32 _k )
+        {
+            uint32 begin = rangeBegin(_level, _k, uint32(_points.size()));
+            uint32 end = rangeBegin(_level, _k + 1, uint32(_points.size()));
+            uint32 median = rangeBegin(_level + 1, 2 * _k + 1, uint32(_points.size()));
+            Vec3 lo(INF), hi(-INF);
+            for(uint32 i = begin; i < end; ++i)
+            {
+                lo = min(lo, _points[i].position);
+                hi = max(hi, _points[i].position);
+            }
+            Vec3 extent = hi - lo;
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            std::nth_element(_points.begin() + begin, _points.begin() + median, _points.begin() + end,
+                [axis](const BuildPoint& _a, const BuildPoint& _b) { return _a.position[axis] < _b.position[axis]; });
+            uint32 node = (1u << _level) - 1 + _k;
+            m_split[node] = _points[median].position[axis];
+            m_axis[node] = uint8(axis);
+        }
+
+        // Depth first search which visits the closer child first. _visit(point,
+        // distanceSq) is called for each point with a distance below _maxDistSq
+        // and returns the new bound (negative to stop).
+        template<typename Visit>
+        void traverse( const Vec3& _query, float _maxDistSq, Visit _visit ) const
+        {
+            if(m_points.empty()) return;
+            struct Entry { uint32 node; float distSq; };
+            Entry stack[32];
+            int stackSize = 0;
+            stack[stackSize++] = Entry{0, 0.0f};
+            uint32 firstLeaf = uint32(m_split.size());
+            while(stackSize > 0)
+            {
+                Entry entry = stack[--stackSize];
+                if(entry.distSq > _maxDistSq) continue;
+                uint32 node = entry.node;
+                // Descend to the leaf on the query's side
+                while(node < firstLeaf)
+                {
+                    float diff = _query[m_axis[node]] - m_split[node];
+                    uint32 left = 2 * node + 1;
+                    if(diff < 0.0f)
+                    {
+                        stack[stackSize++] = Entry{left + 1, diff * diff};
+                        node = left;
+                    } else {
+                        stack[stackSize++] = Entry{left, diff * diff};
+                        node = left + 1;
+                    }
+                }
+                uint32 k = node - firstLeaf;
+                uint32 end = rangeBegin(m_numLevels, k + 1, size());
+                for(uint32 i = rangeBegin(m_numLevels, k, size()); i < end; ++i)
+                {
+                    float distSq = lensq(m_points[i] - _query);
+                    if(distSq <= _maxDistSq)
+                    {
+                        _maxDistSq = _visit(i, distSq);
+                        if(_maxDistSq < 0.0f) return;
+                    }
+                }
+            }
+        }
+
+        static void siftDown( uint32* _indices, float* _distancesSq, uint32 _num, uint32 _i )
+        {
+            while(true)
+            {
+                uint32 largest = _i;
+                uint32 left = 2 * _i + 1;
+                if(left < _num && _distancesSq[left] > _distancesSq[largest]) largest = left;
+                if(left + 1 < _num && _distancesSq[left + 1] > _distancesSq[largest]) largest = left + 1;
+                if(largest == _i) return;
+                std::swap(_indices[_i], _indices[largest]);
+                std::swap(_distancesSq[_i], _distancesSq[largest]);
+                _i = largest;
+            }
+        }
+
+        static void heapPush( uint32* _indices, float* _distancesSq, uint32 _num, uint32 _index, float _distSq )
+        {
+            uint32 i = _num;
+            while(i > 0 && _distancesSq[(i - 1) / 2] < _distSq)
+            {
+                _indices[i] = _indices[(i - 1) / 2];
+                _distancesSq[i] = _distancesSq[(i - 1) / 2];
+                i = (i - 1) / 2;
+            }
+            _indices[i] = _index;
+            _distancesSq[i] = _distSq;
+        }
+
+        static void heapReplaceTop( uint32* _indices, float* _distancesSq, uint32 _num, uint32 _index, float _distSq )
+        {
+            _indices[0] = _index;
+            _distancesSq[0] = _distSq;
+            siftDown(_indices, _distancesSq, _num, 0);
+        }
+    };
+
+}
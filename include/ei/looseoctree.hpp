@@ -0,0 +1,297 @@
+#pragma once
+
+#include "3dintersection.hpp"
+#include <vector>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                            LOOSE OCTREE                                   //
+    // ************************************************************************* //
+    // An octree over a fixed world box where each node has "loose" bounds: its
+    // octant enlarged around the center by a looseness factor k. An object is
+    // stored in the deepest node whose octant contains the center of the
+    // object and whose loose bounds still contain the whole object. For k = 2
+    // this depth follows directly from the object size, so objects of very
+    // different sizes are sorted in without any search. A moving object stays
+    // in its node as long as it remains inside the loose bounds.
+
+    class LooseOctree
+    {
+    public:
+        /// \brief Limit for the depth of the tree.
+        static const uint32 MAX_DEPTH = 20;
+        /// \brief Marker of a missing node or object.
+        static const uint32 NONE = 0xffffffff;
+
+        /// \param [in] _world Region which is subdivided. Objects outside of
+        ///     this box are stored in the root.
+        /// \param [in] _maxDepth Depth of the smallest nodes (<= MAX_DEPTH).
+        /// \param [in] _looseness Factor k > 1 of the loose bounds relative to
+        ///     the octant size.
+        explicit LooseOctree( const Box& _world, uint32 _maxDepth = 8, float _looseness = 2.0f ) :
+            m_worldMin(_world.min),
+            m_maxDepth(ei::min(_maxDepth, MAX_DEPTH)),
+            m_looseness(_looseness),
+            m_freeNodes(NONE),
+            m_freeObjects(NONE),
+            m_numObjects(0)
+        {
+            eiAssert( _looseness > 1.0f, "The loose bounds must be larger than the octants." );
+            // Cubic cells, such that the looseness is the same on all axes
+            float size = max(_world.max - _world.min);
+            for(uint32 d = 0; d <= m_maxDepth; ++d)
+                m_cellSize[d] = size / float(1u << d);
+            Node root;
+            root.cell = IVec3(0);
+            root.depth = 0;
+            root.parent = NONE;
+            for(int c = 0; c < 8; ++c) root.children[c] = NONE;
+            root.firstObject = NONE;
+            m_nodes.push_back(root);
+        }
+
+        /// \brief Add an object by its bounding box.
+        /// \return Handle of the object which stays valid until remove().
+        uint32 insert( const Box& _bounds, uint32 _userData )
+        {
+            uint32 object;
+            if(m_freeObjects != NONE)
+            {
+                object = m_freeObjects;
+                m_freeObjects = m_objects[object].next;
+            } else {
+                object = uint32(m_objects.size());
+                m_objects.emplace_back();
+            }
+            m_objects[object].bounds = _bounds;
+            m_objects[object].userData = _userData;
+            link(object, findNode(_bounds));
+            ++m_numObjects;
+            return object;
+        }
+
+        /// \brief Remove an object. Empty nodes return to the node pool.
+        void remove( uint32 _object )
+        {
+            eiAssert( _object < m_objects.size() && m_objects[_object].node != NONE, "Invalid object!" );
+            unlink(_object);
+            prune(m_objects[_object].node);
+            m_objects[_object].node = NONE;
+            m_objects[_object].next = m_freeObjects;
+            m_freeObjects = _object;
+            --m_numObjects;
+        }
+
+        /// \brief Update the bounds of an object.
+        /// \details If the object still fits into the loose bounds of its
+        ///     node and is not small enough for a deeper level, only the
+        ///     bounds are replaced. Otherwise the object is relocated.
+        /// \return true if the object moved to another node.
+        bool move( uint32 _object, const Box& _bounds )
+        {
+            eiAssert( _object < m_objects.size() && m_objects[_object].node != NONE, "Invalid object!" );
+            Object& object = m_objects[_object];
+            object.bounds = _bounds;
+            const Node& node = m_nodes[object.node];
+            if(node.depth == depthForSize(_bounds) && contains(looseBounds(node), _bounds))
+                return false;
+            uint32 target = findNode(_bounds);
+            if(target == object.node)
+                return false;
+            // Link first, the target may be an ancestor which would be
+            // pruned otherwise.
+            uint32 source = object.node;
+            unlink(_object);
+            link(_object, target);
+            prune(source);
+            return true;
+        }
+
+        /// \brief Call _callback(object, userData) for each object whose
+        ///     bounds intersect _shape.
+        /// \details Works for all shapes with an intersects(Shape, Box) test.
+        ///     The callback must return false to stop the query or true to
+        ///     continue. It must not change the tree.
+        template<typename Shape, typename Callback>
+        void query( const Shape& _shape, Callback _callback ) const
+        {
+            uint32 stack[8 * MAX_DEPTH + 1];
+            int stackSize = 0;
+            stack[stackSize++] = 0;
+            while(stackSize > 0)
+            {
+                uint32 index = stack[--stackSize];
+                const Node& node = m_nodes[index];
+                // The root also holds the objects outside the world
+                if(index != 0 && !intersects( _shape, looseBounds(node) ))
+                    continue;
+                for(uint32 o = node.firstObject; o != NONE; o = m_objects[o].next)
+                    if(intersects( _shape, m_objects[o].bounds ) && !_callback( o, m_objects[o].userData ))
+                        return;
+                for(int c = 0; c < 8; ++c)
+                    if(node.children[c] != NONE)
+                        stack[stackSize++] = node.children[c];
+            }
+        }
+
+        /// \brief The bounds given to insert() or move().
+        const Box& bounds( uint32 _object ) const   { return m_objects[_object].bounds; }
+        /// \brief The user data given to insert().
+        uint32 userData( uint32 _object ) const     { return m_objects[_object].userData; }
+        /// \brief Number of objects in the tree.
+        uint32 size() const                          { return m_numObjects; }
+        /// \brief Depth of the node which contains the object.
+        uint32 depth( uint32 _object ) const         { return m_nodes[m_objects[_object].node].depth; }
+
+    private:
+        struct Node
+        {
+            IVec3 cell;             ///< Integer coordinate of the octant at its depth
+            uint32 depth;
+            uint32 parent;          ///< Parent node or the next free node for nodes in the pool.
+            uint32 children[8];
+            uint32 firstObject;     ///< Head of the object list of this node
+        };
+
+        struct Object
+        {
+            Box bounds;
+            uint32 userData;
+            uint32 node;            ///< NONE for free objects
+            uint32 prev;
+            uint32 next;            ///< Next object in the node or the next free object.
+        };
+
+        Vec3 m_worldMin;
+        uint32 m_maxDepth;
+        float m_looseness;
+        float m_cellSize[MAX_DEPTH + 1];
+        std::vector<Node> m_nodes;
+        std::vector<Object> m_objects;
+        uint32 m_freeNodes;
+        uint32 m_freeObjects;
+        uint32 m_numObjects;
+
+        static bool contains( const Box& _outer, const Box& _inner )
+        {
+            return _inner.min.x >= _outer.min.x && _inner.min.y >= _outer.min.y && _inner.min.z >= _outer.min.z
+                && _inner.max.x <= _outer.max.x && _inner.max.y <= _outer.max.y && _inner.max.z <= _outer.max.z;
+        }
+
+        Box looseBounds( const Node& _node ) const
+        {
+            float size = m_cellSize[_node.depth];
+            float margin = size * (m_looseness - 1.0f) * 0.5f;
+            Box box;
+            box.min = m_worldMin + Vec3(_node.cell) * size - margin;
+            box.max = box.min + size + 2.0f * margin;
+            return box;
+        }
+
+        // Deepest level where an object of this size fits into the loose
+        // bounds, if its center is anywhere in the octant.
+        uint32 depthForSize( const Box& _bounds ) const
+        {
+            float extent = max(_bounds.max - _bounds.min);
+            uint32 depth = 0;
+            while(depth < m_maxDepth && extent <= m_cellSize[depth + 1] * (m_looseness - 1.0f))
+                ++depth;
+            return depth;
+        }
+
+        // Get or create the node for an object
+        uint32 findNode( const Box& _bounds )
+        {
+            uint32 depth = depthForSize(_bounds);
+            Vec3 center = (_bounds.min + _bounds.max) * 0.5f;
+            IVec3 cell;
+            float maxCell = float((1u << depth) - 1);
+            for(int a = 0; a < 3; ++a)
+                cell[a] = floor(ei::clamp((center[a] - m_worldMin[a]) / m_cellSize[depth], 0.0f, maxCell));
+            uint32 index = 0;
+            for(uint32 d = 1; d <= depth; ++d)
+            {
+                // The octant at depth d which contains the target cell
+                IVec3 sub = cell / int32(1u << (depth - d));
+                int c = (sub.x & 1) | ((sub.y & 1) << 1) | ((sub.z & 1) << 2);
+                uint32 child = m_nodes[index].children[c];
+                if(child == NONE)
+                {
+                    // Objects outside the world may not fit into the clamped
+                    // octant. These stay in the deepest fitting ancestor.
+                    Node candidate;
+                    candidate.cell = sub;
+                    candidate.depth = d;
+                    if(!contains(looseBounds(candidate), _bounds))
+                        return index;
+                    child = allocateNode(index, sub, d);
+                    m_nodes[index].children[c] = child;
+                } else if(!contains(looseBounds(m_nodes[child]), _bounds))
+                    return index;
+                index = child;
+            }
+            return index;
+        }
+
+        uint32 allocateNode( uint32 _parent, const IVec3& _cell, uint32 _depth )
+        {
+            uint32 index;
+            if(m_freeNodes != NONE)
+            {
+                index = m_freeNodes;
+                m_freeNodes = m_nodes[index].parent;
+            } else {
+                index = uint32(m_nodes.size());
+                m_nodes.emplace_back();
+            }
+            Node& node = m_nodes[index];
+            node.cell = _cell;
+            node.depth = _depth;
+            node.parent = _parent;
+            for(int c = 0; c < 8; ++c) node.children[c] = NONE;
+            node.firstObject = NONE;
+            return index;
+        }
+
+        void link( uint32 _object, uint32 _node )
+        {
+            Object& object = m_objects[_object];
+            object.node = _node;
+            object.prev = NONE;
+            object.next = m_nodes[_node].firstObject;
+            if(object.next != NONE)
+                m_objects[object.next].prev = _object;
+            m_nodes[_node].firstObject = _object;
+        }
+
+        // Remove the object from the list of its node.
+        void unlink( uint32 _object )
+        {
+            Object& object = m_objects[_object];
+            if(object.prev != NONE) m_objects[object.prev].next = object.next;
+            else m_nodes[object.node].firstObject = object.next;
+            if(object.next != NONE) m_objects[object.next].prev = object.prev;
+        }
+
+        // Return _index and its ancestors to the pool as long as they are
+        // empty.
+        void prune( uint32 _index )
+        {
+            while(_index != 0 && m_nodes[_index].firstObject == NONE)
+            {
+                const Node& node = m_nodes[_index];
+                for(int c = 0; c < 8; ++c)
+                    if(node.children[c] != NONE) return;
+                uint32 parent = node.parent;
+                for(int c = 0; c < 8; ++c)
+                    if(m_nodes[parent].children[c] == _index)
+                        m_nodes[parent].children[c] = NONE;
+                m_nodes[_index].parent = m_freeNodes;
+                m_freeNodes = _index;
+                _index = parent;
+            }
+        }
+    };
+
+}
@@ -0,0 +1,342 @@
+#pragma once
+
+#include "bvh.hpp"
+#include <cstring>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                            QUANTIZED BVH                                  //
+    // ************************************************************************* //
+    // A compact, serialized form of a wide BVH which is used in place, e.g.
+    // directly from a memory mapped file. Each node stores the bounds of its
+    // children with 16 bit (4 children) or 8 bit (8 children) integers
+    // relative to its own box, which is decoded from its parent. Each node
+    // takes exactly 64 bytes (one cache line) and leaves are no nodes of
+    // their own, which saves about two thirds of the memory of a BVH.
+    //
+    // The quantization step of a node is the power of two above
+    // extent / (2^bits - 1). Therefore, the products of the decoding are exact
+    // and the decoded boxes are the same with and without fused multiply-add.
+    // The encoder rounds all children outwards in exactly the same
+    // arithmetic, so the decoded bounds are always conservative.
+    //
+    // Layout of the data: QuantizedBVHHeader, the nodes in breadth first
+    // order and the primitive indices. The data uses the native byte order,
+    // which is checked by the magic number of the header.
+
+    /// \brief Header of serialized quantized BVHs (64 bytes).
+    struct QuantizedBVHHeader
+    {
+        static const uint32 MAGIC = 0x42514945;     ///< "EIQB"
+        static const uint32 VERSION = 1;
+
+        uint32 magic;
+        uint32 version;
+        uint32 bits;            ///< Bits per coordinate: 16 or 8
+        uint32 numNodes;
+        uint32 numIndices;
+        uint32 reserved[5];     ///< Zero
+        Box bounds;             ///< Bounds of the root node
+    };
+
+    /// \brief Node of a quantized BVH with 16 bit (4 children) or 8 bit (8
+    ///     children) coordinates (64 bytes).
+    /// \details The inner children of a node are stored consecutively
+    ///     starting at firstChild and the primitives of all its leaf
+    ///     children are consecutive in the index array starting at
+    ///     firstIndex. Both are in the order of the lanes.
+    template<typename Q>
+    struct QuantizedBVHNode
+    {
+        static const uint N = 8 / sizeof(Q);
+        static const uint32 EMPTY = 0;      ///< meta of an unused lane
+        static const uint32 INNER = 0xff;   ///< meta of an inner child
+
+        Q lo[3][N];         ///< Child minimum per axis: node min + lo * step
+        Q hi[3][N];         ///< Child maximum per axis: node max - hi * step
+        uint32 firstChild;  ///< Index of the first inner child
+        uint32 firstIndex;  ///< First index of the first leaf child
+        uint8 meta[8];      ///< EMPTY, INNER or the number of primitives of a leaf (< 255) for each lane.
+    };
+
+    namespace details {
+        // Power of two step with which _extent is covered by at most
+        // _maxQ steps.
+        inline float quantizationStep( float _extent, float _invMaxQ )
+        {
+            // Avoid denormals for flat boxes. The products stay exact.
+            uint32 bits = hard_cast<uint32>(ei::max(_extent * _invMaxQ, hard_cast<float>(0x00800000u)));
+            return hard_cast<float>((bits + 0x007fffffu) & 0xff800000u);
+        }
+
+        // Decode the child bounds of a node with the box _box.
+        template<typename Q>
+        inline void decodeChildren( const QuantizedBVHNode<Q>& _node, const Box& _box, BoxSoA<QuantizedBVHNode<Q>::N>& _children )
+        {
+            const uint N = QuantizedBVHNode<Q>::N;
+            const float invMaxQ = 1.0f / float(Q(~Q(0)));
+            float* childMin[3] = {_children.min.x, _children.min.y, _children.min.z};
+            float* childMax[3] = {_children.max.x, _children.max.y, _children.max.z};
+            for(int a = 0; a < 3; ++a)
+            {
+                float step = quantizationStep(_box.max[a] - _box.min[a], invMaxQ);
+                for(uint i = 0; i < N; ++i)
+                {
+                    childMin[a][i] = _box.min[a] + float(_node.lo[a][i]) * step;
+                    childMax[a][i] = _box.max[a] - float(_node.hi[a][i]) * step;
+                }
+            }
+            for(uint i = 0; i < N; ++i)
+                if(_node.meta[i] == QuantizedBVHNode<Q>::EMPTY)
+                    _children.clear(i);
+        }
+
+        // Quantize _child relative to _box. The result is rounded outwards
+        // such that the decoded box contains _child.
+        template<typename Q>
+        inline Box encodeChild( const Box& _child, const Box& _box, QuantizedBVHNode<Q>& _node, uint _lane )
+        {
+            const float maxQ = float(Q(~Q(0)));
+            Box decoded;
+            for(int a = 0; a < 3; ++a)
+            {
+                float step = quantizationStep(_box.max[a] - _box.min[a], 1.0f / maxQ);
+                float lo = float(ei::floor(ei::clamp((_child.min[a] - _box.min[a]) / step, 0.0f, maxQ)));
+                float hi = float(ei::floor(ei::clamp((_box.max[a] - _child.max[a]) / step, 0.0f, maxQ)));
+                // Decoding rounds to nearest. Step back until it is outside.
+                while(lo > 0.0f && _box.min[a] + lo * step > _child.min[a]) lo -= 1.0f;
+                while(hi > 0.0f && _box.max[a] - hi * step < _child.max[a]) hi -= 1.0f;
+                _node.lo[a][_lane] = Q(lo);
+                _node.hi[a][_lane] = Q(hi);
+                decoded.min[a] = _box.min[a] + lo * step;
+                decoded.max[a] = _box.max[a] - hi * step;
+            }
+            return decoded;
+        }
+    }
+
+    /// \brief Serialize a BVH into the quantized format.
+    /// \details The BVH is collapsed to 4 (16 bit) or 8 (8 bit) children per
+    ///     node. Its leaves must have less than 255 primitives. The result can
+    ///     be written to a file and used by QuantizedBVH after loading or
+    ///     memory mapping. Usage: serializeBVH<uint16>(bvh, data);
+    /// \param [out] _data Replaced by the serialized BVH.
+    template<typename Q>
+    inline void serializeBVH( const BVH& _bvh, std::vector<uint8>& _data )
+    {
+        static_assert(sizeof(Q) == 1 || sizeof(Q) == 2, "Only 8 and 16 bit quantization is supported.");
+        static_assert(sizeof(QuantizedBVHNode<Q>) == 64 && sizeof(QuantizedBVHHeader) == 64, "Unexpected padding.");
+        const uint N = QuantizedBVHNode<Q>::N;
+        WideBVH<N> wide = collapseBVH<N>( _bvh );
+
+        // Box() does not initialize, the bounds of empty trees are zero
+        QuantizedBVHHeader header{};
+        header.bounds = Box( Vec3(0.0f), Vec3(0.0f) );
+        header.magic = QuantizedBVHHeader::MAGIC;
+        header.version = QuantizedBVHHeader::VERSION;
+        header.bits = sizeof(Q) * 8;
+        std::vector<QuantizedBVHNode<Q>> nodes;
+        std::vector<uint32> indices;
+        if(!wide.nodes.empty())
+        {
+            header.bounds = _bvh.nodes[0].bounds;
+            // Breadth first, such that the inner children of a node get
+            // consecutive indices. Each task is one output node.
+            struct Task { uint32 wide; Box bounds; };
+            std::vector<Task> tasks;
+            tasks.push_back(Task{0, header.bounds});
+            for(size_t t = 0; t < tasks.size(); ++t)
+            {
+                const Task task = tasks[t];
+                const WideBVHNode<N>& node = wide.nodes[task.wide];
+                QuantizedBVHNode<Q> result;
+                std::memset(&result, 0, sizeof(result));
+                result.firstChild = uint32(tasks.size());
+                result.firstIndex = uint32(indices.size());
+                for(uint i = 0; i < N; ++i)
+                {
+                    Box child = node.bounds.get(i);
+                    if(child.min.x > child.max.x)
+                    {
+                        result.meta[i] = QuantizedBVHNode<Q>::EMPTY;
+                        continue;
+                    }
+                    Box decoded = details::encodeChild( child, task.bounds, result, i );
+                    if(node.count[i])
+                    {
+                        eiAssert( node.count[i] < QuantizedBVHNode<Q>::INNER, "Too many primitives in a leaf!" );
+                        result.meta[i] = uint8(node.count[i]);
+                        indices.insert(indices.end(), wide.indices.begin() + node.child[i], wide.indices.begin() + node.child[i] + node.count[i]);
+                    } else {
+                        result.meta[i] = QuantizedBVHNode<Q>::INNER;
+                        tasks.push_back(Task{node.child[i], decoded});
+                    }
+                }
+                nodes.push_back(result);
+            }
+        }
+        header.numNodes = uint32(nodes.size());
+        header.numIndices = uint32(indices.size());
+
+        _data.resize(sizeof(header) + nodes.size() * sizeof(QuantizedBVHNode<Q>) + indices.size() * sizeof(uint32));
+        uint8* out = _data.data();
+        std::memcpy(out, &header, sizeof(header));
+        out += sizeof(header);
+        if(!nodes.empty()) std::memcpy(out, nodes.data(), nodes.size() * sizeof(QuantizedBVHNode<Q>));
+        out += nodes.size() * sizeof(QuantizedBVHNode<Q>);
+        if(!indices.empty()) std::memcpy(out, indices.data(), indices.size() * sizeof(uint32));
+    }
+
+    /// \brief Read-only view of a serialized quantized BVH.
+    /// \details The data is used in place and must stay valid as long as the
+    ///     view is used. It must be aligned to 4 bytes at least. With 64 byte
+    ///     alignment (e.g. mmap) each node is in a single cache line.
+    template<typename Q>
+    class QuantizedBVH
+    {
+    public:
+        /// \brief Create an invalid view.
+        QuantizedBVH() :
+            m_header(nullptr),
+            m_nodes(nullptr),
+            m_indices(nullptr)
+        {}
+
+        /// \brief Interpret serialized data without copying it.
+        /// \details If the data is too small or the header does not match
+        ///     (version, bits per coordinate or byte order) the view is
+        ///     invalid.
+        QuantizedBVH( const void* _data, size_t _size ) :
+            QuantizedBVH()
+        {
+            eiAssert( (reinterpret_cast<uintptr_t>(_data) & 3) == 0, "The data must be aligned to 4 bytes." );
+            if(_size < sizeof(QuantizedBVHHeader)) return;
+            const QuantizedBVHHeader* header = static_cast<const QuantizedBVHHeader*>(_data);
+            if(header->magic != QuantizedBVHHeader::MAGIC || header->version != QuantizedBVHHeader::VERSION
+                || header->bits != sizeof(Q) * 8)
+                return;
+            if(_size < sizeof(QuantizedBVHHeader) + uint64(header->numNodes) * sizeof(QuantizedBVHNode<Q>) + uint64(header->numIndices) * sizeof(uint32))
+                return;
+            m_header = header;
+            m_nodes = reinterpret_cast<const QuantizedBVHNode<Q>*>(header + 1);
+            m_indices = reinterpret_cast<const uint32*>(m_nodes + header->numNodes);
+        }
+
+        /// \brief Could the data be used?
+        bool isValid() const                          { return m_header != nullptr; }
+        /// \brief Number of nodes, 0 for an empty BVH.
+        uint32 numNodes() const                       { return m_header->numNodes; }
+        /// \brief Bounds of the root node.
+        const Box& bounds() const                     { return m_header->bounds; }
+        const QuantizedBVHNode<Q>* nodes() const      { return m_nodes; }
+        /// \brief Primitive indices in the order of the leaves.
+        const uint32* indices() const                 { return m_indices; }
+
+    private:
+        const QuantizedBVHHeader* m_header;
+        const QuantizedBVHNode<Q>* m_nodes;
+        const uint32* m_indices;
+    };
+
+    typedef QuantizedBVH<uint16> QuantizedBVH16;
+    typedef QuantizedBVH<uint8> QuantizedBVH8;
+
+    namespace details {
+        // Closest hit traversal of a quantized BVH (see closestHit(WideBVH...)).
+        // The stack keeps the decoded box of each inner child, which is the
+        // reference for the bounds of its own children.
+        template<typename Q, typename LeafTest>
+        inline bool closestHit( const QuantizedBVH<Q>& _bvh, const FastRay& _ray, float& _distance, uint32& _index, LeafTest _leafTest )
+        {
+            const uint N = QuantizedBVHNode<Q>::N;
+            _distance = INF;
+            if(!_bvh.isValid() || _bvh.numNodes() == 0) return false;
+            bool hit = false;
+            struct Entry { uint32 child; uint32 count; float dist; Box bounds; };
+            Entry stack[BVH_MAX_DEPTH * (N - 1) + 1];
+            int stackSize = 0;
+            stack[stackSize++] = Entry{0, 0, 0.0f, _bvh.bounds()};
+            BoxSoA<N> children;
+            alignas(N * sizeof(float)) float dist[N];
+            while(stackSize > 0)
+            {
+                const Entry entry = stack[--stackSize];
+                if(entry.dist > _distance) continue;
+                if(entry.count)
+                {
+                    for(uint32 i = entry.child; i < entry.child + entry.count; ++i)
+                        if(_leafTest( _bvh.indices()[i], _distance ))
+                        {
+                            _index = _bvh.indices()[i];
+                            hit = true;
+                        }
+                    continue;
+                }
+                const QuantizedBVHNode<Q>& node = _bvh.nodes()[entry.child];
+                decodeChildren( node, entry.bounds, children );
+                uint32 mask = intersects( _ray, children, dist, _distance );
+                // Offsets of the lanes into the children and the indices
+                uint32 child[N], index[N];
+                uint32 nextChild = node.firstChild, nextIndex = node.firstIndex;
+                for(uint i = 0; i < N; ++i)
+                {
+                    child[i] = nextChild;
+                    index[i] = nextIndex;
+                    if(node.meta[i] == QuantizedBVHNode<Q>::INNER) ++nextChild;
+                    else nextIndex += node.meta[i];
+                }
+                // Insertion sort of the hit children by descending distance
+                int first = stackSize;
+                while(mask)
+                {
+                    uint32 lane = countTrailingZeros(mask);
+                    mask &= mask - 1;
+                    Entry next;
+                    if(node.meta[lane] == QuantizedBVHNode<Q>::INNER)
+                    {
+                        next.child = child[lane];
+                        next.count = 0;
+                        next.bounds = children.get(lane);
+                    } else {
+                        next.child = index[lane];
+                        next.count = node.meta[lane];
+                    }
+                    next.dist = dist[lane];
+                    int i = stackSize++;
+                    for(; i > first && stack[i - 1].dist < next.dist; --i)
+                        stack[i] = stack[i - 1];
+                    stack[i] = next;
+                }
+            }
+            return hit;
+        }
+    }
+
+    /// \brief Closest hit of a ray with a triangle mesh in a quantized BVH.
+    /// \param _bvh A view of a BVH which was serialized from a BVH for
+    ///     _triangles.
+    /// \param [out] _distance Ray parameter of the closest hit.
+    /// \param [out] _triangle Index of the hit triangle.
+    /// \return true if any triangle is hit.
+    inline bool intersects( const Ray& _ray, const QuantizedBVH16& _bvh, const Triangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<Triangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const QuantizedBVH8& _bvh, const Triangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<Triangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const QuantizedBVH16& _bvh, const FastTriangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<FastTriangle>{_ray, _triangles} );
+    }
+
+    inline bool intersects( const Ray& _ray, const QuantizedBVH8& _bvh, const FastTriangle* _triangles, float& _distance, uint32& _triangle ) // TESTED
+    {
+        return details::closestHit( _bvh, FastRay(_ray), _distance, _triangle, details::TriangleHit<FastTriangle>{_ray, _triangles} );
+    }
+
+}
@@ -0,0 +1,265 @@
+#pragma once
+
+#include "3dintersection.hpp"
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+
+namespace ei {
+
+    // ************************************************************************* //
+    //                          SWEEP AND PRUNE                                  //
+    // ************************************************************************* //
+    // Incremental sweep and prune broadphase over boxes. The start and end
+    // points of all boxes are kept sorted on each axis. Moving a box only
+    // shifts its own endpoints with an insertion sort. Each swap of a start
+    // and an end point may start or end an overlap, which is confirmed with
+    // intersects(Box, Box). Therefore, the cost of an update is proportional
+    // to the number of swaps, which is small for coherent movements.
+
+    class SweepAndPrune
+    {
+    public:
+        /// \brief Create an empty broadphase.
+        SweepAndPrune() :
+            m_freeList(NO_PROXY)
+        {}
+
+        /// \brief Create from many boxes at once. The proxy of box i is i.
+        /// \details This sorts the endpoints once and finds the initial pairs
+        ///     with a single sweep, which is much faster than inserting the
+        ///     boxes one by one.
+        SweepAndPrune( const Box* _boxes, uint32 _num ) :
+            m_freeList(NO_PROXY)
+        {
+            m_proxies.resize(_num);
+            for(int a = 0; a < 3; ++a)
+            {
+                std::vector<Endpoint>& endpoints = m_endpoints[a];
+                endpoints.resize(2 * _num);
+                m_positions[a].resize(2 * _num);
+                for(uint32 i = 0; i < _num; ++i)
+                {
+                    endpoints[2 * i] = Endpoint{_boxes[i].min[a], i << 1};
+                    endpoints[2 * i + 1] = Endpoint{_boxes[i].max[a], (i << 1) | 1};
+                }
+                std::sort(endpoints.begin(), endpoints.end(), less);
+                for(uint32 i = 0; i < 2 * _num; ++i)
+                    m_positions[a][endpoints[i].data] = i;
+            }
+            for(uint32 i = 0; i < _num; ++i)
+            {
+                m_proxies[i].bounds = _boxes[i];
+                m_proxies[i].nextFree = IN_USE;
+            }
+
+            // Sweep along x and test all boxes which are open at the start
+            // of a new one.
+            std::vector<uint32> active;
+            std::vector<uint32> activePos(_num);
+            for(const Endpoint& e : m_endpoints[0])
+            {
+                uint32 proxy = e.data >> 1;
+                if(e.data & 1)
+                {
+                    // Swap remove from the active list
+                    uint32 pos = activePos[proxy];
+                    active[pos] = active.back();
+                    activePos[active[pos]] = pos;
+                    active.pop_back();
+                } else {
+                    for(uint32 other : active)
+                        if(intersects( m_proxies[proxy].bounds, m_proxies[other].bounds ))
+                            m_pairs.insert(pairKey(proxy, other));
+                    activePos[proxy] = uint32(active.size());
+                    active.push_back(proxy);
+                }
+            }
+        }
+
+        /// \brief Add a box. This costs O(n) swaps in the worst case.
+        /// \return The proxy of the box. It stays valid until remove().
+        uint32 insert( const Box& _box )
+        {
+            uint32 proxy;
+            if(m_freeList != NO_PROXY)
+            {
+                proxy = m_freeList;
+                m_freeList = m_proxies[proxy].nextFree;
+            } else {
+                proxy = uint32(m_proxies.size());
+                m_proxies.emplace_back();
+                for(int a = 0; a < 3; ++a)
+                    m_positions[a].resize(2 * m_proxies.size());
+            }
+            Proxy& p = m_proxies[proxy];
+            p.bounds = _box;
+            p.nextFree = IN_USE;
+            // Append the endpoints behind all others and move them down
+            for(int a = 0; a < 3; ++a)
+            {
+                std::vector<Endpoint>& endpoints = m_endpoints[a];
+                uint32* position = &m_positions[a][proxy << 1];
+                position[0] = uint32(endpoints.size());
+                endpoints.push_back(Endpoint{_box.min[a], proxy << 1});
+                position[1] = uint32(endpoints.size());
+                endpoints.push_back(Endpoint{_box.max[a], (proxy << 1) | 1});
+                sortDown(a, position[0], nullptr, &p.bounds);
+                sortDown(a, position[1], nullptr, &p.bounds);
+            }
+            return proxy;
+        }
+
+        /// \brief Remove a box and all its pairs. The proxy may be reused
+        ///     by later inserts.
+        void remove( uint32 _proxy )
+        {
+            eiAssert( _proxy < m_proxies.size() && m_proxies[_proxy].nextFree == IN_USE, "Invalid proxy!" );
+            // Move the endpoints behind all others. This ends all overlaps.
+            // A value sentinel like INF would not work, because other
+            // endpoints can be infinite too.
+            const Box& bounds = m_proxies[_proxy].bounds;
+            for(int a = 0; a < 3; ++a)
+            {
+                uint32* position = &m_positions[a][_proxy << 1];
+                sortUp(a, position[1], &bounds, nullptr, true);
+                sortUp(a, position[0], &bounds, nullptr, true);
+                eiAssertWeak( position[1] == m_endpoints[a].size() - 1, "Endpoints must be at the end." );
+                m_endpoints[a].resize(m_endpoints[a].size() - 2);
+            }
+            m_proxies[_proxy].nextFree = m_freeList;
+            m_freeList = _proxy;
+        }
+
+        /// \brief Update the box of a proxy.
+        /// \details The cost is proportional to the number of endpoints the
+        ///     box passes on the three axes.
+        void move( uint32 _proxy, const Box& _box )
+        {
+            eiAssert( _proxy < m_proxies.size() && m_proxies[_proxy].nextFree == IN_USE, "Invalid proxy!" );
+            const Box before = m_proxies[_proxy].bounds;
+            m_proxies[_proxy].bounds = _box;
+            for(int a = 0; a < 3; ++a)
+            {
+                const uint32* endpoint = &m_positions[a][_proxy << 1];
+                std::vector<Endpoint>& endpoints = m_endpoints[a];
+                float oldMin = endpoints[endpoint[0]].value;
+                float oldMax = endpoints[endpoint[1]].value;
+                endpoints[endpoint[0]].value = _box.min[a];
+                endpoints[endpoint[1]].value = _box.max[a];
+                // Grow first, such that the start never passes the end
+                if(_box.min[a] < oldMin) sortDown(a, endpoint[0], &before, &_box);
+                if(_box.max[a] > oldMax) sortUp(a, endpoint[1], &before, &_box);
+                if(_box.min[a] > oldMin) sortUp(a, endpoint[0], &before, &_box);
+                if(_box.max[a] < oldMax) sortDown(a, endpoint[1], &before, &_box);
+            }
+        }
+
+        /// \brief The current box of a proxy.
+        const Box& bounds( uint32 _proxy ) const    { return m_proxies[_proxy].bounds; }
+        /// \brief Number of overlapping pairs.
+        size_t numPairs() const                      { return m_pairs.size(); }
+
+        /// \brief Do the boxes of two proxies overlap?
+        bool overlapping( uint32 _a, uint32 _b ) const
+        {
+            return m_pairs.count(pairKey(_a, _b)) != 0;
+        }
+
+        /// \brief Call _callback(a, b) for each overlapping pair with a < b.
+        template<typename Callback>
+        void forEachPair( Callback _callback ) const
+        {
+            for(uint64 key : m_pairs)
+                _callback( uint32(key >> 32), uint32(key) );
+        }
+
+    private:
+        static const uint32 NO_PROXY = 0xffffffff;
+        static const uint32 IN_USE = 0xfffffffe;
+
+        struct Endpoint
+        {
+            float value;
+            uint32 data;        ///< proxy << 1 | isEnd
+        };
+
+        struct Proxy
+        {
+            Box bounds;
+            uint32 nextFree;        ///< Next proxy in the free list or IN_USE.
+        };
+
+        std::vector<Proxy> m_proxies;
+        std::vector<Endpoint> m_endpoints[3];
+        std::vector<uint32> m_positions[3];     ///< Index of each endpoint in m_endpoints (by Endpoint::data).
+        std::unordered_set<uint64> m_pairs;
+        uint32 m_freeList;
+
+        // Start points come first for equal values. Thus, touching boxes
+        // overlap like in intersects(Box, Box).
+        static bool less( const Endpoint& _a, const Endpoint& _b )
+        {
+            return _a.value < _b.value || (_a.value == _b.value && !(_a.data & 1) && (_b.data & 1));
+        }
+
+        static uint64 pairKey( uint32 _a, uint32 _b )
+        {
+            return _a < _b ? (uint64(_a) << 32) | _b : (uint64(_b) << 32) | _a;
+        }
+
+        // Called when a start and an end point of _a and _b swapped. _a
+        // changed from _before to _after (nullptr if not in the broadphase).
+        // Comparing both states touches the pair set only for real changes,
+        // while most swaps do not change the overlap on the other axes.
+        void updatePair( uint32 _a, uint32 _b, const Box* _before, const Box* _after )
+        {
+            const Box& other = m_proxies[_b].bounds;
+            bool before = _before && intersects( *_before, other );
+            bool after = _after && intersects( *_after, other );
+            if(before == after) return;
+            if(after) m_pairs.insert(pairKey(_a, _b));
+            else m_pairs.erase(pairKey(_a, _b));
+        }
+
+        void sortDown( int _axis, uint32 _index, const Box* _before, const Box* _after )
+        {
+            std::vector<Endpoint>& endpoints = m_endpoints[_axis];
+            Endpoint e = endpoints[_index];
+            uint32 proxy = e.data >> 1;
+            while(_index > 0 && less(e, endpoints[_index - 1]))
+            {
+                const Endpoint& prev = endpoints[_index - 1];
+                // Only a start passing an end or vice versa changes the
+                // overlap on this axis.
+                if((e.data ^ prev.data) & 1) updatePair(proxy, prev.data >> 1, _before, _after);
+                m_positions[_axis][prev.data] = _index;
+                endpoints[_index] = prev;
+                --_index;
+            }
+            endpoints[_index] = e;
+            m_positions[_axis][e.data] = _index;
+        }
+
+        // With _toEnd the endpoint is moved behind all endpoints of other
+        // proxies, regardless of their values.
+        void sortUp( int _axis, uint32 _index, const Box* _before, const Box* _after, bool _toEnd = false )
+        {
+            std::vector<Endpoint>& endpoints = m_endpoints[_axis];
+            Endpoint e = endpoints[_index];
+            uint32 proxy = e.data >> 1;
+            uint32 last = uint32(endpoints.size() - 1);
+            while(_index < last && (_toEnd ? (endpoints[_index + 1].data >> 1) != proxy : less(endpoints[_index + 1], e)))
+            {
+                const Endpoint& next = endpoints[_index + 1];
+                if((e.data ^ next.data) & 1) updatePair(proxy, next.data >> 1, _before, _after);
+                m_positions[_axis][next.data] = _index;
+                endpoints[_index] = next;
+                ++_index;
+            }
+            endpoints[_index] = e;
+            m_positions[_axis][e.data] = _index;
+        }
+    };
+
+}
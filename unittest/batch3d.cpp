@@ -0,0 +1,245 @@
+#include "ei/3dbatch.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+
+using namespace ei;
+using namespace std;
+
+// Compare the batched point containment (AoS and SoA) against the single test.
+template<typename Shape>
+static bool consistentPointTest(const Shape& _shape, const vector<Vec3>& _points, uint32& _numInside)
+{
+    uint32 num = (uint32)_points.size();
+    vector<float> x(num), y(num), z(num);
+    for(uint32 i = 0; i < num; ++i)
+    {
+        x[i] = _points[i].x;
+        y[i] = _points[i].y;
+        z[i] = _points[i].z;
+    }
+    vector<uint32> mask((num + 31) / 32), maskSoA((num + 31) / 32);
+    uint32 count = intersects( _points.data(), num, _shape, mask.data() );
+    if(count != intersects( x.data(), y.data(), z.data(), num, _shape, maskSoA.data() )) return false;
+    if(count != intersects( _points.data(), num, _shape, nullptr )) return false;
+    if(mask != maskSoA) return false;
+    uint32 expectedCount = 0;
+    for(uint32 i = 0; i < num; ++i)
+    {
+        bool inside = intersects( _points[i], _shape );
+        if(inside) ++expectedCount;
+        if(inside != ((mask[i / 32] >> (i % 32)) & 1)) return false;
+    }
+    _numInside += count;
+    return count == expectedCount;
+}
+
+// Compare the NxM overlap kernels (all pairs and two sets) against the single
+// test. Uses more elements than a tile to test the tile borders.
+template<typename Shape>
+static bool consistentOverlapTest(const vector<Shape>& _set0, const vector<Shape>& _set1, uint32& _numPairs)
+{
+    uint32 num0 = (uint32)_set0.size(), num1 = (uint32)_set1.size();
+    // Large enough for all pairs of both queries, the count of truncated
+    // outputs would be larger than the buffer
+    vector<UVec2> pairs(ei::max(num0 * (num0 - 1) / 2, num0 * num1));
+    // All pairs inside set 0
+    uint32 count = intersects( _set0.data(), num0, pairs.data(), (uint32)pairs.size() );
+    vector<bool> found(num0 * num0, false);
+    for(uint32 p = 0; p < count; ++p)
+    {
+        if(pairs[p].x >= pairs[p].y || found[pairs[p].x * num0 + pairs[p].y]) return false;
+        found[pairs[p].x * num0 + pairs[p].y] = true;
+    }
+    for(uint32 i = 0; i < num0; ++i)
+        for(uint32 j = i + 1; j < num0; ++j)
+            if(found[i * num0 + j] != intersects( _set0[i], _set0[j] )) return false;
+    _numPairs += count;
+    if(count > 0 && intersects( _set0.data(), num0, pairs.data(), 1 ) != count) return false;
+
+    // Two sets
+    count = intersects( _set0.data(), num0, _set1.data(), num1, pairs.data(), (uint32)pairs.size() );
+    found.assign(num0 * num1, false);
+    for(uint32 p = 0; p < count; ++p)
+    {
+        if(found[pairs[p].x * num1 + pairs[p].y]) return false;
+        found[pairs[p].x * num1 + pairs[p].y] = true;
+    }
+    for(uint32 i = 0; i < num0; ++i)
+        for(uint32 j = 0; j < num1; ++j)
+            if(found[i * num1 + j] != intersects( _set0[i], _set1[j] )) return false;
+    _numPairs += count;
+
+    // A too small output must still return the full count
+    return count == 0 || intersects( _set0.data(), num0, _set1.data(), num1, pairs.data(), 1 ) == count;
+}
+
+bool test_3dbatch()
+{
+    bool result = true;
+
+    // Test sphere <-> frustum culling
+    {
+        FastFrustum ffr0( Frustum( Vec3(0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 1.0f, 0.0f), 1.0f, 2.0f, 0.0f, 1.0f, 0.0f, 1.0f ) );
+        // The spheres from the single test (intersects: 0, 1, 5, 6, 7)
+        Sphere spheres[9] = {
+            Sphere( Vec3(0.0f, 0.0f, 0.0f), 0.1f ),
+            Sphere( Vec3(1.5f, 0.5f, 0.8f), 0.1f ),
+            Sphere( Vec3(-1.0f, 2.5f, 0.0f), 0.5f ),
+            Sphere( Vec3(3.0f, 1.5f, 1.25f), 0.5f ),
+            Sphere( Vec3(-1.5f, -0.5f, -1.0f), 1.5f ),
+            Sphere( Vec3(-1.5f, -0.5f, -1.0f), 2.0f ),
+            Sphere( Vec3(0.0f, 0.25f, 0.5f), 0.5f ),
+            Sphere( Vec3(0.0f, 1.0f, 0.5f), 0.75f ),
+            Sphere( Vec3(0.0f, 1.0f, 0.5f), 0.7f )
+        };
+        uint32 mask;
+        uint32 indices[9];
+        TEST( intersects( spheres, 9, ffr0, &mask ) == 5 && mask == 0xe3, "Wrong visibility mask for the spheres!" );
+        TEST( intersectsIndices( spheres, 9, ffr0, indices ) == 5
+            && indices[0] == 0 && indices[1] == 1 && indices[2] == 5 && indices[3] == 6 && indices[4] == 7,
+            "Wrong visible sphere indices!" );
+
+        // Compare against the single test for many random spheres (with a
+        // remainder which does not fill a full block).
+        FastFrustum ffr1( Frustum( Vec3(-0.5f, 0.0f, -1.0f), normalize(Vec3(1.0f, 0.0f, 1.0f)), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -0.5f, 0.5f, 0.5f, 2.0f ) );
+        const uint32 num = 1011;
+        vector<Sphere> randomSpheres(num);
+        for(auto& s : randomSpheres) random(s);
+        vector<uint32> masks((num + 31) / 32);
+        vector<uint32> randomIndices(num);
+        uint32 count = intersects( randomSpheres.data(), num, ffr1, masks.data() );
+        uint32 countIndices = intersectsIndices( randomSpheres.data(), num, ffr1, randomIndices.data() );
+        uint32 expectedCount = 0;
+        bool consistent = count == countIndices && (masks.back() >> (num % 32)) == 0;
+        for(uint32 i = 0; i < num; ++i)
+        {
+            bool visible = intersects( randomSpheres[i], ffr1 );
+            if(visible != ((masks[i / 32] >> (i % 32)) & 1))
+                consistent = false;
+            if(visible && (expectedCount >= countIndices || randomIndices[expectedCount++] != i))
+                consistent = false;
+        }
+        TEST( consistent && count == expectedCount && count > 0, "Batched sphere culling differs from the single test!" );
+    }
+
+    // Test bulk point containment
+    {
+        vector<Vec3> points(1013);
+        for(auto& p : points) random(p);
+        points[0] = Vec3(0.0f);
+        FastFrustum ffr0( Frustum( Vec3(-0.5f, 0.0f, -1.0f), normalize(Vec3(1.0f, 0.0f, 1.0f)), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -0.5f, 0.5f, 0.5f, 2.0f ) );
+        uint32 mask[32];
+        TEST( intersects( points.data(), 1, Box( Vec3(-0.5f), Vec3(0.0f) ), mask ) == 1 && mask[0] == 1, "The origin is on the boundary of the box!" );
+        TEST( intersects( points.data(), 1, Sphere( Vec3(1.0f, 0.0f, 0.0f), 1.0f ), mask ) == 1, "The origin is on the boundary of the sphere!" );
+
+        bool consistent = true;
+        uint32 numInside[8] = {0};
+        for(int t = 0; t < 20; ++t)
+        {
+            Box box; random(box);
+            Sphere sphere; random(sphere);
+            OBox obox; random(obox);
+            Ellipsoid ellipsoid; random(ellipsoid);
+            OEllipsoid oellipsoid; random(oellipsoid);
+            Tetrahedron tetrahedron; random(tetrahedron);
+            Cone cone; random(cone);
+            consistent &= consistentPointTest( box, points, numInside[0] );
+            consistent &= consistentPointTest( sphere, points, numInside[1] );
+            consistent &= consistentPointTest( obox, points, numInside[2] );
+            consistent &= consistentPointTest( ellipsoid, points, numInside[3] );
+            consistent &= consistentPointTest( oellipsoid, points, numInside[4] );
+            consistent &= consistentPointTest( tetrahedron, points, numInside[5] );
+            consistent &= consistentPointTest( FastCone(cone), points, numInside[6] );
+        }
+        consistent &= consistentPointTest( ffr0, points, numInside[7] );
+        TEST( consistent, "Batched point containment differs from the single test!" );
+        for(int i = 0; i < 8; ++i)
+            TEST( numInside[i] > 0, "Random test " << i << " has no point inside the volume!" );
+    }
+
+    // Test plane <-> box classification
+    {
+        const uint32 num = 203;
+        vector<Box> boxes(num);
+        for(auto& b : boxes) random(b);
+        boxes[0] = Box( Vec3(-0.5f), Vec3(0.0f) );
+        vector<PlaneSide> sides(num);
+        bool consistent = true;
+        int numSides[3] = {0};
+        for(int t = 0; t < 10; ++t)
+        {
+            Plane plane( normalize(Vec3(rnd() - 0.5f, rnd() - 0.5f, rnd() - 0.5f)), rnd() - 0.5f );
+            if(t == 0) plane = Plane( Vec3(1.0f, 0.0f, 0.0f), 0.0f ); // Touches box 0
+            classify( plane, boxes.data(), num, sides.data() );
+            for(uint32 i = 0; i < num; ++i)
+            {
+                if(sides[i] != classify( plane, boxes[i] )) consistent = false;
+                numSides[int(sides[i]) + 1]++;
+            }
+            if(t == 0 && sides[0] != PlaneSide::STRADDLING) consistent = false;
+        }
+        TEST( consistent, "Batched plane <-> box classification differs from the single test!" );
+        TEST( numSides[0] > 0 && numSides[1] > 0 && numSides[2] > 0, "All three sides should occur in the random test!" );
+    }
+
+    // Test NxM sphere <-> sphere and box <-> box overlaps
+    {
+        vector<Sphere> spheres0(301), spheres1(27);
+        for(auto& s : spheres0) random(s);
+        for(auto& s : spheres1) random(s);
+        vector<Box> boxes0(301), boxes1(27);
+        for(auto& b : boxes0) random(b);
+        for(auto& b : boxes1) random(b);
+        boxes1[0] = Box( boxes0[5].max, boxes0[5].max + 1.0f ); // Touching
+
+        uint32 numSpherePairs = 0, numBoxPairs = 0;
+        TEST( consistentOverlapTest( spheres0, spheres1, numSpherePairs ) && numSpherePairs > 0, "NxM sphere overlaps differ from the single test!" );
+        TEST( consistentOverlapTest( boxes0, boxes1, numBoxPairs ) && numBoxPairs > 0, "NxM box overlaps differ from the single test!" );
+    }
+
+    // Test runtime instruction set dispatch: all levels must give the same
+    // results as the scalar fallback.
+    {
+        SimdLevel detected = detectedSimdLevel();
+        TEST( simdLevel() == detected, "The detected level should be active by default!" );
+        TEST( forceSimdLevel( SimdLevel::AVX512 ) == detected, "Forcing a level must clamp to the detected one!" );
+
+        const uint32 num = 517;
+        vector<Sphere> spheres(num);
+        vector<Box> boxes(num);
+        vector<Vec3> points(num);
+        for(auto& s : spheres) random(s);
+        for(auto& b : boxes) random(b);
+        for(auto& p : points) random(p);
+        FastFrustum frustum( Frustum( Vec3(-0.5f, 0.0f, -1.0f), normalize(Vec3(1.0f, 0.0f, 1.0f)), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -0.5f, 0.5f, 0.5f, 2.0f ) );
+        OEllipsoid oellipsoid; random(oellipsoid);
+        Plane plane( normalize(Vec3(1.0f, 2.0f, -1.0f)), 0.1f );
+
+        vector<uint32> refVisible((num + 31) / 32), refInside((num + 31) / 32);
+        vector<PlaneSide> refSides(num);
+        vector<UVec2> refPairs(num * 4);
+        bool consistent = true;
+        for(int level = int(SimdLevel::SCALAR); level <= int(detected); ++level)
+        {
+            if(forceSimdLevel( SimdLevel(level) ) != SimdLevel(level) || simdLevel() != SimdLevel(level))
+                consistent = false;
+            vector<uint32> visible((num + 31) / 32), inside((num + 31) / 32);
+            vector<PlaneSide> sides(num);
+            vector<UVec2> pairs(num * 4);
+            intersects( spheres.data(), num, frustum, visible.data() );
+            intersects( points.data(), num, oellipsoid, inside.data() );
+            classify( plane, boxes.data(), num, sides.data() );
+            uint32 numPairs = intersects( boxes.data(), num, pairs.data(), (uint32)pairs.size() );
+            pairs.resize(ei::min(numPairs, (uint32)pairs.size()));
+            if(level == int(SimdLevel::SCALAR))
+            {
+                refVisible = visible; refInside = inside; refSides = sides; refPairs = pairs;
+            } else if(visible != refVisible || inside != refInside || sides != refSides || pairs != refPairs)
+                consistent = false;
+        }
+        TEST( consistent, "The batched kernels differ between the instruction sets!" );
+        forceSimdLevel( detected );
+    }
+
+    return result;
+}
@@ -0,0 +1,502 @@
+#include "ei/bvh.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+
+using namespace ei;
+using namespace std;
+
+// Small random triangles in the [-1,1] cube
+static void randomMesh(vector<Triangle>& _triangles)
+{
+    for(auto& t : _triangles)
+    {
+        Vec3 c; random(c);
+        Vec3 d0, d1, d2; random(d0); random(d1); random(d2);
+        t = Triangle( c + d0 * 0.05f, c + d1 * 0.05f, c + d2 * 0.05f );
+    }
+}
+
+// Check the structure: all bounds must be conservative, all primitives must
+// be referenced exactly once and leaves must not be too large.
+static bool validBVH(const BVH& _bvh, const Box* _bounds, uint32 _num, uint32 _maxLeafSize)
+{
+    vector<int> referenced(_num, 0);
+    for(const BVHNode& node : _bvh.nodes)
+    {
+        if(node.isLeaf())
+        {
+            if(node.count > _maxLeafSize) return false;
+            for(uint32 i = node.first; i < node.first + node.count; ++i)
+            {
+                if(!(_bounds[_bvh.indices[i]].min >= node.bounds.min && _bounds[_bvh.indices[i]].max <= node.bounds.max)) return false;
+                referenced[_bvh.indices[i]]++;
+            }
+        } else {
+            if(node.first + 1 >= _bvh.nodes.size()) return false;
+            for(uint32 c = node.first; c <= node.first + 1; ++c)
+                if(!(_bvh.nodes[c].bounds.min >= node.bounds.min && _bvh.nodes[c].bounds.max <= node.bounds.max)) return false;
+        }
+    }
+    for(int r : referenced) if(r != 1) return false;
+    return true;
+}
+
+// Bitwise comparison of two trees, e.g. from builds with different numbers
+// of threads.
+static bool equalBVH(const BVH& _a, const BVH& _b)
+{
+    if(_a.indices != _b.indices || _a.nodes.size() != _b.nodes.size()) return false;
+    for(size_t i = 0; i < _a.nodes.size(); ++i)
+        if(_a.nodes[i].first != _b.nodes[i].first || _a.nodes[i].count != _b.nodes[i].count
+            || _a.nodes[i].bounds.min != _b.nodes[i].bounds.min || _a.nodes[i].bounds.max != _b.nodes[i].bounds.max)
+            return false;
+    return true;
+}
+
+// All primitives must be referenced exactly once and all inner children
+// must be valid nodes.
+template<uint N>
+static bool validWideBVH(const WideBVH<N>& _bvh, uint32 _num)
+{
+    vector<int> referenced(_num, 0);
+    for(const auto& node : _bvh.nodes)
+        for(uint i = 0; i < N; ++i)
+        {
+            if(node.count[i])
+                for(uint32 j = node.child[i]; j < node.child[i] + node.count[i]; ++j)
+                    referenced[_bvh.indices[j]]++;
+            else if(node.bounds.min.x[i] <= node.bounds.max.x[i] && (node.child[i] == 0 || node.child[i] >= _bvh.nodes.size()))
+                return false;
+        }
+    for(int r : referenced) if(r != 1) return false;
+    return true;
+}
+
+bool test_bvh()
+{
+    bool result = true;
+
+    // Test the binned SAH builder and closest hit queries
+    {
+        const uint32 num = 3001;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        vector<FastTriangle> fastTriangles;
+        vector<Box> bounds;
+        for(auto& t : triangles)
+        {
+            fastTriangles.push_back(FastTriangle(t));
+            bounds.push_back(Box(t));
+        }
+        BVH bvh = buildBVH( triangles.data(), num );
+        TEST( validBVH( bvh, bounds.data(), num, 4 ), "The SAH BVH is invalid!" );
+        BVH4 bvh4 = collapseBVH<4>( bvh );
+        BVH8 bvh8 = collapseBVH<8>( bvh );
+        TEST( bvh4.nodes.size() < bvh.nodes.size() / 2 && bvh8.nodes.size() < bvh4.nodes.size(), "Collapsing should reduce the number of nodes!" );
+        TEST( validWideBVH( bvh4, num ) && validWideBVH( bvh8, num ), "The collapsed BVH is invalid!" );
+
+        bool consistent = true;
+        int numHits = 0;
+        for(int r = 0; r < 500; ++r)
+        {
+            Ray ray; random(ray);
+            // Brute force reference
+            float refDist = INF, dist;
+            uint32 refIndex = 0, index = 0;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( ray, triangles[i], dist ) && dist < refDist)
+                {
+                    refDist = dist;
+                    refIndex = i;
+                }
+            bool hit = intersects( ray, bvh, triangles.data(), dist, index );
+            if(hit != (refDist < INF) || (hit && (dist != refDist || index != refIndex)))
+                consistent = false;
+            float fastRefDist = INF;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( ray, fastTriangles[i], dist ) && dist < fastRefDist)
+                    fastRefDist = dist;
+            hit = intersects( ray, bvh, fastTriangles.data(), dist, index );
+            if(hit != (fastRefDist < INF) || (hit && dist != fastRefDist))
+                consistent = false;
+            if(hit) ++numHits;
+            // The wide BVHs must find the same closest hits
+            hit = intersects( ray, bvh4, triangles.data(), dist, index );
+            if(hit != (refDist < INF) || (hit && (dist != refDist || index != refIndex)))
+                consistent = false;
+            hit = intersects( ray, bvh8, fastTriangles.data(), dist, index );
+            if(hit != (fastRefDist < INF) || (hit && dist != fastRefDist))
+                consistent = false;
+        }
+        TEST( consistent, "BVH closest hit differs from the brute force search!" );
+        TEST( numHits > 0, "The random rays should hit the mesh!" );
+    }
+
+    // Test the parallel LBVH builder
+    {
+        const uint32 num = 20011;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        vector<Box> bounds;
+        for(auto& t : triangles)
+            bounds.push_back(Box(t));
+        BVH bvh30 = buildLBVH( triangles.data(), num, 30, 4 );
+        BVH bvh63 = buildLBVH( triangles.data(), num, 63, 4 );
+        TEST( validBVH( bvh30, bounds.data(), num, 1 ), "The 30 bit LBVH is invalid!" );
+        TEST( validBVH( bvh63, bounds.data(), num, 1 ), "The 63 bit LBVH is invalid!" );
+
+        // The result must not depend on the number of threads
+        TEST( equalBVH( buildLBVH( triangles.data(), num, 30, 1 ), bvh30 ), "The LBVH differs between 1 and 4 threads!" );
+
+        bool consistent = true;
+        for(int r = 0; r < 200; ++r)
+        {
+            Ray ray; random(ray);
+            float refDist = INF, dist;
+            uint32 refIndex = 0, index = 0;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( ray, triangles[i], dist ) && dist < refDist)
+                {
+                    refDist = dist;
+                    refIndex = i;
+                }
+            bool hit = intersects( ray, bvh30, triangles.data(), dist, index );
+            if(hit != (refDist < INF) || (hit && (dist != refDist || index != refIndex)))
+                consistent = false;
+            hit = intersects( ray, bvh63, triangles.data(), dist, index );
+            if(hit != (refDist < INF) || (hit && (dist != refDist || index != refIndex)))
+                consistent = false;
+        }
+        TEST( consistent, "LBVH closest hit differs from the brute force search!" );
+
+        // Equal codes are ordered by their index
+        vector<Box> equalBoxes(9000, Box( Vec3(0.0f), Vec3(1.0f) ));
+        BVH equalBVH = buildLBVH( equalBoxes.data(), 9000, 30, 3 );
+        TEST( validBVH( equalBVH, equalBoxes.data(), 9000, 1 ), "The LBVH of equal boxes is invalid!" );
+        BVH single = buildLBVH( equalBoxes.data(), 1 );
+        TEST( single.nodes.size() == 1 && single.nodes[0].isLeaf() && buildLBVH( (const Box*)nullptr, 0 ).nodes.empty(),
+            "LBVH of one or zero primitives is wrong!" );
+    }
+
+    // Test the parallel SAH builder with nodes above the size of subtree
+    // tasks
+    {
+        const uint32 num = 150001;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        vector<Box> bounds;
+        for(auto& t : triangles)
+            bounds.push_back(Box(t));
+        BVH parallel = buildBVH( triangles.data(), num, 4, 4 );
+        TEST( validBVH( parallel, bounds.data(), num, 4 ), "The parallel SAH BVH is invalid!" );
+
+        // The result must not depend on the number of threads
+        TEST( equalBVH( buildBVH( triangles.data(), num, 4, 1 ), parallel ), "The SAH BVH differs between 1 and 4 threads!" );
+
+        // Equal boxes are split in the middle of their range
+        vector<Box> equalBoxes(70000, Box( Vec3(0.0f), Vec3(1.0f) ));
+        BVH equalBVH = buildBVH( equalBoxes.data(), 70000, 2, 3 );
+        TEST( validBVH( equalBVH, equalBoxes.data(), 70000, 2 ), "The parallel SAH BVH of equal boxes is invalid!" );
+        TEST( equalBVH.indices == buildBVH( equalBoxes.data(), 70000, 2, 1 ).indices, "The SAH BVH of equal boxes differs between 1 and 3 threads!" );
+    }
+
+    // Test refitting after deformations. The mesh is large enough to refit
+    // and rebuild the subtrees on multiple threads.
+    {
+        const uint32 num = 80000;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        BVH bvh = buildBVH( triangles.data(), num );
+        BVHQualityMonitor monitor;
+        TEST( refitBVH( bvh, monitor, triangles.data() ) == 0, "The first refit only stores the reference costs!" );
+
+        // Small deformation: the tree structure stays valid
+        for(auto& t : triangles)
+        {
+            Vec3 d; random(d);
+            t.v0 += d * 0.02f;
+            t.v1 += d * 0.02f;
+            t.v2 -= d * 0.02f;
+        }
+        vector<Box> bounds;
+        for(auto& t : triangles)
+            bounds.push_back(Box(t));
+        BVH refitted = bvh;
+        refitBVH( refitted, triangles.data(), 4 );
+        TEST( validBVH( refitted, bounds.data(), num, 4 ), "The refitted BVH is invalid!" );
+        BVH serialRefitted = bvh;
+        refitBVH( serialRefitted, triangles.data(), 1 );
+        TEST( equalBVH( refitted, serialRefitted ), "The refit differs between 1 and 4 threads!" );
+        TEST( refitBVH( bvh, monitor, triangles.data(), 4 ) == 0, "A small deformation should not trigger rebuilds!" );
+        TEST( bvh.indices == refitted.indices, "The refit must not change the tree!" );
+
+        // Move the triangles of one half of the mesh to random places. This
+        // degrades the subtrees which contain them.
+        for(uint32 i = 0; i < num; ++i)
+            if(center(triangles[i]).x < 0.0f)
+            {
+                Vec3 d; random(d);
+                triangles[i].v0 += d;
+                triangles[i].v1 += d;
+                triangles[i].v2 += d;
+            }
+        bounds.clear();
+        for(auto& t : triangles)
+            bounds.push_back(Box(t));
+        BVH serial = bvh;
+        BVHQualityMonitor serialMonitor = monitor;
+        uint32 numRebuilt = refitBVH( bvh, monitor, triangles.data(), 4 );
+        TEST( numRebuilt > 0 && numRebuilt < monitor.referenceCost.size(), "Only the degraded subtrees should be rebuilt!" );
+        TEST( validBVH( bvh, bounds.data(), num, 4 ), "The partially rebuilt BVH is invalid!" );
+        TEST( refitBVH( serial, serialMonitor, triangles.data(), 1 ) == numRebuilt && equalBVH( bvh, serial )
+            && serialMonitor.referenceCost == monitor.referenceCost, "The partial rebuild differs between 1 and 4 threads!" );
+        TEST( refitBVH( bvh, monitor, triangles.data(), 4 ) == 0, "The rebuilt subtrees should be the new reference!" );
+
+        bool consistent = true;
+        for(int r = 0; r < 200; ++r)
+        {
+            Ray ray; random(ray);
+            float refDist = INF, dist;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( ray, triangles[i], dist ) && dist < refDist)
+                    refDist = dist;
+            uint32 index;
+            bool hit = intersects( ray, bvh, triangles.data(), dist, index );
+            if(hit != (refDist < INF) || (hit && dist != refDist))
+                consistent = false;
+        }
+        TEST( consistent, "Closest hit in the refitted BVH differs from the brute force search!" );
+
+        // Refitting a LBVH (one primitive per leaf)
+        BVH lbvh = buildLBVH( bounds.data(), num );
+        for(auto& b : bounds)
+            b.max += Vec3(0.1f);
+        refitBVH( lbvh, bounds.data() );
+        TEST( validBVH( lbvh, bounds.data(), num, 1 ), "The refitted LBVH is invalid!" );
+    }
+
+    // Test closest point queries
+    {
+        const uint32 num = 5000;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        BVH bvh = buildBVH( triangles.data(), num );
+        const uint32 numQueries = 1000;
+        vector<Vec3> queries(numQueries);
+        for(auto& q : queries) { random(q); q *= 1.5f; }
+        bool consistent = true, onTriangle = true;
+        for(uint32 q = 0; q < numQueries; ++q)
+        {
+            float expected = INF;
+            for(uint32 i = 0; i < num; ++i)
+                expected = ei::min(expected, ei::abs(distance( queries[q], triangles[i] )));
+            MeshPoint hit;
+            if(!closestPoint( queries[q], bvh, triangles.data(), hit ) || !approx( hit.distance, expected, 1e-4f ))
+                consistent = false;
+            else {
+                const Triangle& t = triangles[hit.triangle];
+                if(!approx( ei::abs(distance( queries[q], t )), hit.distance, 1e-4f )
+                    || min(hit.barycentric) < 0.0f || !approx( sum(hit.barycentric), 1.0f )
+                    || !approx( t.v0 * hit.barycentric.x + t.v1 * hit.barycentric.y + t.v2 * hit.barycentric.z, hit.position )
+                    || !approx( distance( queries[q], hit.position ), hit.distance ))
+                    onTriangle = false;
+            }
+        }
+        TEST( consistent, "BVH closest point differs from the brute force search!" );
+        TEST( onTriangle, "The closest point must be on the closest triangle!" );
+
+        // Batched queries with a distance limit
+        vector<MeshPoint> results(numQueries), serialResults(numQueries);
+        uint32 numFound = closestPoints( queries.data(), numQueries, bvh, triangles.data(), results.data(), 0.05f, 4 );
+        TEST( closestPoints( queries.data(), numQueries, bvh, triangles.data(), serialResults.data(), 0.05f, 1 ) == numFound,
+            "The hit must not depend on the number of threads!" );
+        uint32 expectedFound = 0;
+        consistent = true;
+        for(uint32 q = 0; q < numQueries; ++q)
+        {
+            MeshPoint single;
+            bool found = closestPoint( queries[q], bvh, triangles.data(), single, 0.05f );
+            if(found) ++expectedFound;
+            if(single.triangle != results[q].triangle || single.distance != results[q].distance
+                || single.triangle != serialResults[q].triangle)
+                consistent = false;
+            if(found != (distance( queries[q], bvh, triangles.data() ) <= 0.05f))
+                consistent = false;
+        }
+        TEST( consistent, "Batched closest points differ from single queries!" );
+        TEST( numFound == expectedFound && numFound > 0 && numFound < numQueries, "Wrong number of found closest points!" );
+
+        // Degenerated triangles are segments or points
+        Triangle line( Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(2.0f, 0.0f, 0.0f) );
+        Triangle point( Vec3(1.0f), Vec3(1.0f), Vec3(1.0f) );
+        MeshPoint hit;
+        Box lineBounds( line );
+        BVH lineBVH = buildBVH( &lineBounds, 1 );
+        TEST( closestPoint( Vec3(1.5f, 1.0f, 0.0f), lineBVH, &line, hit ) && approx( hit.distance, 1.0f )
+            && approx( hit.position, Vec3(1.5f, 0.0f, 0.0f) ), "Closest point on a degenerated triangle failed!" );
+        Box pointBounds( point );
+        BVH pointBVH = buildBVH( &pointBounds, 1 );
+        TEST( closestPoint( Vec3(0.0f), pointBVH, &point, hit ) && approx( hit.distance, sqrt(3.0f) ),
+            "Closest point on a point triangle failed!" );
+    }
+
+    // Test any hit queries
+    {
+        const uint32 num = 10000;
+        vector<Triangle> triangles(num);
+        randomMesh(triangles);
+        vector<FastTriangle> fastTriangles(triangles.begin(), triangles.end());
+        BVH bvh = buildBVH( triangles.data(), num );
+        BVH4 bvh4 = collapseBVH<4>( bvh );
+        BVH8 bvh8 = collapseBVH<8>( bvh );
+        const uint32 numRays = 3000;
+        vector<Ray> rays(numRays);
+        vector<float> tMax(numRays);
+        for(uint32 i = 0; i < numRays; ++i)
+        {
+            random(rays[i]);
+            tMax[i] = i % 4 == 0 ? INF : (rays[i].origin.x + 1.0f);
+        }
+        bool consistent = true;
+        uint32 numHits = 0;
+        for(uint32 i = 0; i < numRays; ++i)
+        {
+            float dist;
+            uint32 index;
+            bool expected = intersects( rays[i], bvh, triangles.data(), dist, index ) && dist <= tMax[i];
+            if(expected) ++numHits;
+            if(intersects( rays[i], bvh, triangles.data(), tMax[i] ) != expected
+                || intersects( rays[i], bvh, fastTriangles.data(), tMax[i] ) != expected
+                || intersects( rays[i], bvh4, triangles.data(), tMax[i] ) != expected
+                || intersects( rays[i], bvh8, triangles.data(), tMax[i] ) != expected
+                || intersects( rays[i], bvh8, fastTriangles.data(), tMax[i] ) != expected)
+                consistent = false;
+        }
+        TEST( consistent, "Any hit query differs from the closest hit!" );
+        TEST( numHits > 0 && numHits < numRays, "Some but not all rays should be occluded!" );
+
+        vector<uint32> mask((numRays + 31) / 32), serialMask((numRays + 31) / 32);
+        TEST( intersects( rays.data(), tMax.data(), numRays, bvh8, triangles.data(), mask.data(), 4 ) == numHits, "Wrong number of occluded rays!" );
+        TEST( intersects( rays.data(), tMax.data(), numRays, bvh, triangles.data(), serialMask.data(), 1 ) == numHits && mask == serialMask,
+            "The batched any hit query must not depend on the BVH or the number of threads!" );
+        consistent = true;
+        for(uint32 i = 0; i < numRays; ++i)
+            if(((mask[i / 32] >> (i % 32)) & 1) != uint32(intersects( rays[i], bvh, triangles.data(), tMax[i] )))
+                consistent = false;
+        TEST( consistent, "Batched any hit differs from the single query!" );
+        uint32 numUnlimited = 0;
+        for(const Ray& ray : rays)
+            if(intersects( ray, bvh, triangles.data() )) ++numUnlimited;
+        TEST( intersects( rays.data(), nullptr, numRays, bvh4, fastTriangles.data(), nullptr ) == numUnlimited,
+            "Batched any hit without maximum distance failed!" );
+    }
+
+    // Test mesh overlap queries
+    {
+        const uint32 num = 2000;
+        vector<Triangle> trianglesA(num), trianglesB(num);
+        randomMesh(trianglesA);
+        randomMesh(trianglesB);
+        BVH bvhA = buildBVH( trianglesA.data(), num );
+        BVH bvhB = buildBVH( trianglesB.data(), num );
+        Quaternion q( normalize(Vec3(1.0f, 2.0f, 3.0f)), 0.7f );
+        Vec3 translation(0.3f, -0.2f, 0.1f);
+        Mat3x3 rot = rotation(q);
+        // Brute force references
+        vector<Triangle> movedB(num);
+        for(uint32 j = 0; j < num; ++j)
+            movedB[j] = Triangle( rot * trianglesB[j].v0 + translation, rot * trianglesB[j].v1 + translation, rot * trianglesB[j].v2 + translation );
+        vector<TrianglePair> expected, expectedMoved;
+        for(uint32 i = 0; i < num; ++i)
+            for(uint32 j = 0; j < num; ++j)
+            {
+                if(intersects( trianglesA[i], trianglesB[j] )) expected.push_back(TrianglePair{i, j});
+                if(intersects( trianglesA[i], movedB[j] )) expectedMoved.push_back(TrianglePair{i, j});
+            }
+        auto pairLess = [](const TrianglePair& _x, const TrianglePair& _y) { return _x.a < _y.a || (_x.a == _y.a && _x.b < _y.b); };
+        auto pairEqual = [](const TrianglePair& _x, const TrianglePair& _y) { return _x.a == _y.a && _x.b == _y.b; };
+        auto samePairs = [&](vector<TrianglePair> _pairs, const vector<TrianglePair>& _expected) {
+            sort(_pairs.begin(), _pairs.end(), pairLess);
+            return _pairs.size() == _expected.size() && equal(_pairs.begin(), _pairs.end(), _expected.begin(), pairEqual);
+        };
+
+        vector<TrianglePair> pairs, parallelPairs;
+        overlappingTriangles( bvhA, trianglesA.data(), bvhB, trianglesB.data(), pairs, 1 );
+        TEST( !expected.empty() && samePairs( pairs, expected ), "Overlapping triangle pairs are wrong!" );
+        overlappingTriangles( bvhA, trianglesA.data(), bvhB, trianglesB.data(), parallelPairs, 4 );
+        TEST( parallelPairs.size() == pairs.size() && equal(pairs.begin(), pairs.end(), parallelPairs.begin(), pairEqual),
+            "The order of overlapping pairs must not depend on the number of threads!" );
+        overlappingTriangles( bvhA, trianglesA.data(), bvhB, trianglesB.data(), q, translation, pairs, 4 );
+        TEST( !expectedMoved.empty() && samePairs( pairs, expectedMoved ), "Overlapping triangle pairs under a rigid transformation are wrong!" );
+        TEST( intersects( bvhA, trianglesA.data(), bvhB, trianglesB.data(), 4 ) && intersects( bvhA, trianglesA.data(), bvhB, trianglesB.data(), q, translation, 1 ),
+            "The meshes should intersect!" );
+        // Moved apart
+        TEST( !intersects( bvhA, trianglesA.data(), bvhB, trianglesB.data(), q, Vec3(5.0f, 0.0f, 0.0f) )
+            && overlappingTriangles( bvhA, trianglesA.data(), bvhB, trianglesB.data(), q, Vec3(5.0f, 0.0f, 0.0f), pairs ) == 0 && pairs.empty(),
+            "Distant meshes must not intersect!" );
+    }
+
+    // Test hierarchical frustum culling
+    {
+        const uint32 num = 20000;
+        vector<Box> boxes(num);
+        for(auto& b : boxes) random(b);
+        BVH bvh = buildBVH( boxes.data(), num );
+        const FastFrustum frustums[] = {
+            FastFrustum( Vec3(-0.5f, 0.0f, -1.0f), normalize(Vec3(1.0f, 0.0f, 1.0f)), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -0.5f, 0.5f, 0.5f, 2.0f ),
+            FastFrustum( Vec3(0.2f, 0.3f, -0.1f), normalize(Vec3(-1.0f, 0.5f, 0.2f)), Vec3(0.0f, 1.0f, 0.0f), -0.3f, 0.2f, -0.1f, 0.4f, 0.1f, 1.0f ),
+            FastFrustum( Vec3(0.0f, 0.0f, -5.0f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 1.0f, 0.0f), -20.0f, 20.0f, -20.0f, 20.0f, 0.1f, 20.0f ),
+            FastFrustum( Vec3(0.0f, 0.0f, 5.0f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -1.0f, 1.0f, 0.1f, 20.0f )
+        };
+        vector<uint32> visible(num);
+        bool consistent = true;
+        for(const FastFrustum& frustum : frustums)
+        {
+            vector<uint32> expected;
+            for(uint32 i = 0; i < num; ++i)
+                if(classify( boxes[i], frustum ) != Visibility::OUTSIDE)
+                    expected.push_back(i);
+            uint32 numVisible = intersectsIndices( bvh, boxes.data(), frustum, visible.data() );
+            sort(visible.begin(), visible.begin() + numVisible);
+            if(numVisible != expected.size() || !equal(expected.begin(), expected.end(), visible.begin()))
+                consistent = false;
+        }
+        TEST( consistent, "Hierarchical culling differs from the culling of single boxes!" );
+        TEST( intersectsIndices( bvh, boxes.data(), frustums[2], visible.data() ) == num, "All boxes should be inside the wide frustum!" );
+        TEST( intersectsIndices( bvh, boxes.data(), frustums[3], visible.data() ) == 0, "All boxes should be behind the frustum!" );
+    }
+
+    // Test degenerated input
+    {
+        BVH empty = buildBVH( (const Box*)nullptr, 0 );
+        float dist;
+        uint32 index;
+        TEST( empty.nodes.empty() && !intersects( Ray(Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f)), empty, (const Triangle*)nullptr, dist, index ),
+            "An empty BVH must not contain nodes!" );
+
+        // Equal boxes cannot be split by SAH
+        vector<Box> equal(37, Box( Vec3(0.0f), Vec3(1.0f) ));
+        BVH bvh = buildBVH( equal.data(), 37, 2 );
+        TEST( validBVH( bvh, equal.data(), 37, 2 ), "The BVH of equal boxes is invalid!" );
+
+        // A single leaf becomes a root with one used lane
+        BVH leaf = buildBVH( equal.data(), 3 );
+        BVH8 wide = collapseBVH<8>( leaf );
+        TEST( wide.nodes.size() == 1 && wide.nodes[0].count[0] == 3 && validWideBVH( wide, 3 ), "Collapsing a single leaf failed!" );
+        TEST( collapseBVH<4>( empty ).nodes.empty() && !intersects( Ray(Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f)), BVH4(), (const Triangle*)nullptr, dist, index ),
+            "An empty wide BVH must not contain nodes!" );
+        TEST( !intersects( Ray(Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f)), empty, (const Triangle*)nullptr )
+            && !intersects( Ray(Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f)), BVH8(), (const Triangle*)nullptr ), "An empty BVH must not be hit!" );
+        TEST( intersectsIndices( empty, nullptr, FastFrustum( Vec3(0.0f), Vec3(0.0f, 0.0f, 1.0f), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -1.0f, 1.0f, 0.1f, 1.0f ), nullptr ) == 0,
+            "An empty BVH must not contain visible primitives!" );
+        vector<TrianglePair> pairs(1);
+        TEST( !intersects( empty, (const Triangle*)nullptr, empty, (const Triangle*)nullptr )
+            && overlappingTriangles( empty, (const Triangle*)nullptr, empty, (const Triangle*)nullptr, pairs ) == 0 && pairs.empty(),
+            "Empty meshes must not intersect!" );
+        MeshPoint point;
+        TEST( !closestPoint( Vec3(0.0f), empty, (const Triangle*)nullptr, point ) && point.triangle == MeshPoint::NONE && point.distance == INF,
+            "An empty BVH must not have a closest point!" );
+    }
+
+    return result;
+}
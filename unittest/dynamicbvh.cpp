@@ -0,0 +1,100 @@
+#include "ei/dynamicbvh.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+
+using namespace ei;
+using namespace std;
+
+bool test_dynamicbvh()
+{
+    bool result = true;
+
+    // Insert, move and remove random boxes and compare the queries with a
+    // brute force search.
+    {
+        const uint32 num = 2000;
+        DynamicBVH tree( 0.05f );
+        tree.reserve( num );
+        vector<Box> boxes(num);
+        vector<uint32> proxies(num);
+        vector<bool> alive(num, true);
+        for(uint32 i = 0; i < num; ++i)
+        {
+            random(boxes[i]);
+            proxies[i] = tree.insert( boxes[i], i );
+        }
+        TEST( tree.size() == num, "Wrong number of objects!" );
+        TEST( tree.height() <= 2 * 11, "The tree is not balanced!" );
+
+        // Small movements must not change the tree
+        Box moved = boxes[0];
+        moved.min += Vec3(0.01f); moved.max += Vec3(0.01f);
+        TEST( !tree.move( proxies[0], moved ), "A small movement should stay inside the fat box!" );
+
+        int numReinserted = 0;
+        for(int frame = 0; frame < 10; ++frame)
+        {
+            for(uint32 i = 0; i < num; i += 3)
+            {
+                Vec3 delta; random(delta);
+                delta *= 0.1f;
+                boxes[i].min += delta;
+                boxes[i].max += delta;
+                if(tree.move( proxies[i], boxes[i], delta ))
+                    ++numReinserted;
+            }
+        }
+        TEST( numReinserted > 0, "Large movements must reinsert the objects!" );
+        for(uint32 i = 1; i < num; i += 7)
+        {
+            tree.remove( proxies[i] );
+            alive[i] = false;
+        }
+        // The last freed node is reused first
+        uint32 last = 1 + (num - 2) / 7 * 7;
+        uint32 reused = tree.insert( boxes[last], last );
+        TEST( reused == proxies[last], "The node pool should reuse freed nodes!" );
+        alive[last] = true;
+        TEST( tree.height() <= 2 * 11, "The tree is not balanced after the updates!" );
+
+        bool consistent = true;
+        for(int q = 0; q < 100; ++q)
+        {
+            Sphere sphere; random(sphere);
+            vector<int> found(num, 0);
+            tree.query( sphere, [&](uint32 _proxy, uint32 _data) {
+                if(tree.userData(_proxy) != _data) consistent = false;
+                found[_data]++;
+                return true;
+            } );
+            for(uint32 i = 0; i < num; ++i)
+            {
+                bool expected = alive[i] && intersects( sphere, tree.fatBounds(proxies[i]) );
+                if(found[i] != (expected ? 1 : 0)) consistent = false;
+                // Fat boxes are conservative
+                if(alive[i] && intersects( sphere, boxes[i] ) && !found[i]) consistent = false;
+            }
+        }
+        TEST( consistent, "Dynamic BVH query differs from the brute force search!" );
+
+        // Stop after the first object
+        int numCalls = 0;
+        tree.query( Box(Vec3(-2.0f), Vec3(2.0f)), [&](uint32, uint32) { ++numCalls; return false; } );
+        TEST( numCalls == 1, "The query should stop when the callback returns false!" );
+    }
+
+    // Remove everything
+    {
+        DynamicBVH tree;
+        uint32 a = tree.insert( Box(Vec3(0.0f), Vec3(1.0f)), 0 );
+        uint32 b = tree.insert( Box(Vec3(2.0f), Vec3(3.0f)), 1 );
+        tree.remove( a );
+        TEST( tree.height() == 0 && tree.userData(b) == 1, "The remaining object should be the root!" );
+        tree.remove( b );
+        int numCalls = 0;
+        tree.query( Box(Vec3(-10.0f), Vec3(10.0f)), [&](uint32, uint32) { ++numCalls; return true; } );
+        TEST( tree.size() == 0 && numCalls == 0, "The tree should be empty!" );
+    }
+
+    return result;
+}
@@ -0,0 +1,81 @@
+#include "ei/hashgrid.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+#include <algorithm>
+
+using namespace ei;
+using namespace std;
+
+bool test_hashgrid()
+{
+    bool result = true;
+
+    // Points against brute force
+    {
+        const uint32 num = 40000;
+        vector<Vec3> points(num);
+        for(auto& p : points) random(p);
+        HashGrid grid( 0.1f ), serialGrid( 0.1f );
+        grid.build( points.data(), num, 4 );
+        serialGrid.build( points.data(), num, 1 );
+        TEST( grid.size() == num, "Wrong number of points in the grid!" );
+
+        bool consistent = true, deterministic = true;
+        vector<uint32> found, serialFound;
+        for(int q = 0; q < 200; ++q)
+        {
+            Vec3 center; random(center);
+            // Include queries which cover the whole grid
+            float radius = q % 50 == 0 ? 3.0f : 0.1f * (q % 5 + 1) * 0.5f;
+            grid.neighbors( center, radius, found );
+            serialGrid.neighbors( center, radius, serialFound );
+            if(found != serialFound) deterministic = false;
+            sort(found.begin(), found.end());
+            vector<uint32> expected;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( Sphere(center, radius), points[i] ))
+                    expected.push_back(i);
+            if(found != expected) consistent = false;
+        }
+        TEST( consistent, "Hash grid neighbors differ from the brute force search!" );
+        TEST( deterministic, "The result must not depend on the number of threads!" );
+
+        int numCalls = 0;
+        grid.query( Sphere(Vec3(0.0f), 0.5f), [&](uint32) { ++numCalls; return false; } );
+        TEST( numCalls == 1, "The query should stop when the callback returns false!" );
+    }
+
+    // Spheres which are larger than the cells
+    {
+        const uint32 num = 3000;
+        vector<Sphere> spheres(num);
+        for(auto& s : spheres) random(s);
+        HashGrid grid( 0.05f );
+        grid.build( spheres.data(), num );
+        bool consistent = true;
+        vector<uint32> found;
+        for(int q = 0; q < 100; ++q)
+        {
+            Sphere query; random(query);
+            grid.neighbors( query.center, query.radius, found );
+            sort(found.begin(), found.end());
+            vector<uint32> expected;
+            for(uint32 i = 0; i < num; ++i)
+                if(intersects( query, spheres[i] ))
+                    expected.push_back(i);
+            if(found != expected) consistent = false;
+        }
+        TEST( consistent, "Hash grid sphere query differs from the brute force search!" );
+    }
+
+    // Empty grid
+    {
+        HashGrid grid( 1.0f );
+        grid.build( (const Vec3*)nullptr, 0 );
+        vector<uint32> found(1);
+        grid.neighbors( Vec3(0.0f), 10.0f, found );
+        TEST( found.empty(), "An empty grid must not find anything!" );
+    }
+
+    return result;
+}
@@ -260,6 +260,80 @@ bool test_3dintersections()
         performance<Ray,Box,float,bool>(intersects, "intersects");
     }
 
+    // Test box <-> ray packet intersection
+    {
+        // The packets must give the same results as the single ray test.
+        Ray rays[8];
+        for(int i = 0; i < 8; ++i) random(rays[i]);
+        rays[6] = Ray( Vec3(-1.0f, 0.25f, 0.25f), Vec3(1.0f, 0.0f, 0.0f) );   // Axis aligned hit
+        rays[7] = Ray( Vec3(0.25f, 0.25f, 0.25f), Vec3(0.0f, -1.0f, 0.0f) );  // Starts inside
+        RayPacket8 packet0( rays );
+        bool consistent = true;
+        for(int t = 0; t < 50; ++t)
+        {
+            Box box; random(box);
+            if(t == 0) box = Box( Vec3(0.0f), Vec3(0.5f) );
+            float dists[8];
+            uint32 mask = intersects( packet0, box, dists );
+            for(int i = 0; i < 8; ++i)
+            {
+                float d;
+                bool hit = intersects( FastRay(rays[i]), box, d );
+                if(hit != ((mask >> i) & 1) || (hit && d != dists[i]))
+                    consistent = false;
+            }
+        }
+        TEST( consistent, "Ray packet <-> box results differ from single ray tests!" );
+
+        float dists[8];
+        uint32 mask = intersects( packet0, Box( Vec3(0.0f), Vec3(0.5f) ), dists );
+        TEST( (mask & 0xc0) == 0xc0, "ray6 and ray7 should hit the box!" );
+        TEST( dists[6] == 1.0f && dists[7] == 0.0f, "Wrong distances for ray6 and ray7!" );
+        packet0.tMax[6] = 0.5f;
+        mask = intersects( packet0, Box( Vec3(0.0f), Vec3(0.5f) ), dists );
+        TEST( (mask & 0xc0) == 0x80, "ray6 should be discarded by tMax!" );
+    }
+
+    // Test ray <-> wide box intersection
+    {
+        // Each lane must give the same result as the single box test.
+        bool consistent = true;
+        for(int t = 0; t < 50; ++t)
+        {
+            Ray ray; random(ray);
+            if(t == 0) ray = Ray( Vec3(-1.0f, 0.25f, 0.25f), Vec3(1.0f, 0.0f, 0.0f) );
+            FastRay fray(ray);
+            Box boxes[8];
+            for(int i = 0; i < 8; ++i) random(boxes[i]);
+            Box8 wide8( boxes );
+            Box4 wide4( boxes, 3 );
+            float dists[8], dists4[4];
+            uint32 mask = intersects( fray, wide8, dists );
+            uint32 mask4 = intersects( fray, wide4, dists4 );
+            if(mask4 != (mask & 0x7)) consistent = false;
+            for(int i = 0; i < 8; ++i)
+            {
+                float d;
+                bool hit = intersects( fray, boxes[i], d );
+                if(hit != ((mask >> i) & 1) || (hit ? d != dists[i] : dists[i] != INF))
+                    consistent = false;
+                if(i < 3 && hit && d != dists4[i])
+                    consistent = false;
+            }
+        }
+        TEST( consistent, "Ray <-> wide box results differ from single box tests!" );
+
+        Box boxes[3] = { Box( Vec3(0.0f), Vec3(0.5f) ), Box( Vec3(2.0f, 0.0f, 0.0f), Vec3(2.5f) ), Box( Vec3(0.0f, 1.0f, 0.0f), Vec3(0.5f, 1.5f, 0.5f) ) };
+        Box4 wide( boxes, 3 );
+        FastRay ray( Ray( Vec3(-1.0f, 0.25f, 0.25f), Vec3(1.0f, 0.0f, 0.0f) ) );
+        float dists[4];
+        uint32 mask = intersects( ray, wide, dists );
+        TEST( mask == 0x3, "The ray should hit box0 and box1 and miss box2 and the empty lane!" );
+        TEST( dists[0] == 1.0f && dists[1] == 3.0f && dists[2] == INF && dists[3] == INF, "Wrong distances of the wide box test!" );
+        mask = intersects( ray, wide, dists, 2.0f );
+        TEST( mask == 0x1, "box1 should be discarded by tMax!" );
+    }
+
     // Test obox <-> ray intersection
     {
         OBox obo0( Vec3(0.5f, 1.0f, 2.0f), Vec3(0.5f, 1.0f, 1.5f), Quaternion(Vec3(0.0f, 0.0f, 1.0f), PI/4.0f) );
@@ -308,6 +382,79 @@ bool test_3dintersections()
         performance<Ray,FastTriangle,float,bool>(intersects, "intersects");
     }
 
+    // Test triangle <-> ray packet intersection
+    {
+        // The packets must give the same results as the single ray test.
+        // Aim the rays at the triangle's plane to get enough hits.
+        // FMA contraction changes the last bits of either path, then only
+        // approximately equal results and different decisions at the edges
+        // are expected.
+#ifdef __FP_FAST_FMAF
+        const bool exact = false;
+#else
+        const bool exact = true;
+#endif
+        auto sameHit = [exact](bool _hit, float _d, const Vec3& _bary, bool _packetHit, float _packetD, const Vec3& _packetBary) {
+            if(exact)
+                return _hit == _packetHit && (!_hit || (_d == _packetD && _bary == _packetBary));
+            if(_hit != _packetHit)
+                return min(ei::abs(_packetBary + EPSILON)) < 1e-4f || ei::abs(_packetD) < 1e-4f;
+            return !_hit || (approx(_d, _packetD, 1e-4f) && approx(_bary, _packetBary, 1e-4f));
+        };
+        bool consistent = true;
+        for(int t = 0; t < 50; ++t)
+        {
+            Triangle tri; random(tri);
+            FastTriangle ftri(tri);
+            Ray rays[8];
+            for(int i = 0; i < 8; ++i)
+            {
+                random(rays[i]);
+                Vec3 target = tri.v0 * (rnd() * 1.4f - 0.2f) + tri.v1 * (rnd() * 1.4f - 0.2f) + tri.v2 * (rnd() * 1.4f - 0.2f);
+                if(target != rays[i].origin)
+                    rays[i].direction = normalize(target - rays[i].origin);
+            }
+            // Parallel ray inside the triangle's plane and a hit exactly at a vertex
+            rays[6] = Ray( tri.v0 - (tri.v1 - tri.v0), normalize(tri.v1 - tri.v0) );
+            rays[7] = Ray( tri.v0 + ftri.normal, -ftri.normal );
+            RayPacket8 packet8( rays );
+            RayPacket4 packet4( rays + 4 );
+            float dists[8], dists4[4];
+            Vec3SoA<8> barys;
+            Vec3SoA<4> barys4;
+            uint32 mask = intersects( packet8, ftri, dists, barys );
+            uint32 mask4 = intersects( packet4, ftri, dists4, barys4 );
+            if(exact && mask4 != (mask >> 4)) consistent = false;
+            for(int i = 0; i < 8; ++i)
+            {
+                // The results of rays inside the plane only depend on
+                // rounding errors
+                if(!exact && ei::abs(dot(ftri.normal, rays[i].direction)) < 1e-4f) continue;
+                float d; Vec3 bary;
+                bool hit = intersects( rays[i], ftri, d, bary );
+                if(!sameHit( hit, d, bary, (mask >> i) & 1, dists[i], barys.get(i) ))
+                    consistent = false;
+                if(i >= 4 && !sameHit( hit, d, bary, (mask4 >> (i-4)) & 1, dists4[i-4], barys4.get(i-4) ))
+                    consistent = false;
+            }
+        }
+        TEST( consistent, "Ray packet <-> triangle results differ from single ray tests!" );
+
+        Triangle tri0( Vec3(0.0f, 0.0f, -1.0f), Vec3(0.0f, 2.0f, 1.0f), Vec3(0.0f, 2.0f, -1.0f) );
+        Ray rays[4] = { Ray( Vec3(-1.0f, 0.0f, 0.0f), normalize(Vec3(0.5f, 0.5f, 0.0f)) ),
+                        Ray( Vec3(-1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f) ),
+                        Ray( Vec3(1.0f, 1.5f, -0.9f), Vec3(1.0f, 0.0f, 0.0f) ),
+                        Ray( Vec3(1.0f, 1.5f, -0.9f), Vec3(-1.0f, 0.0f, 0.0f) ) };
+        RayPacket4 packet( rays );
+        float dists[4];
+        uint32 mask = intersects( packet, FastTriangle(tri0), dists );
+        TEST( mask == 0x9, "ray0 and ray3 should hit tri0, ray1 is parallel and ray2 points away!" );
+        TEST( dists[0] == sqrt(2.0f) && dists[3] == 1.0f, "Wrong distances for ray0 and ray3!" );
+        packet.tMax[3] = 0.5f;
+        mask = intersects( packet, FastTriangle(tri0), dists );
+        TEST( mask == 0x1, "ray3 should be discarded by tMax!" );
+    }
+
     // Test sphere <-> triangle intersection
     {
         Triangle tri( Vec3(-1.0f, 0.0f, 0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f) );
@@ -421,6 +568,48 @@ bool test_3dintersections()
         TEST( intersects( box7, ffr0 ), "box7 intersects fru0!" );
     }
 
+    // Test box <-> frustum classification
+    {
+        FastFrustum ffr0( Vec3(1.0f, 2.0f, 3.0f), normalize(Vec3(1.0f, 0.0f, 1.0f)), Vec3(0.0f, 1.0f, 0.0f), -1.0f, 1.0f, -0.5f, 0.5f, 0.5f, 2.0f );
+        Box box0( Vec3(-0.5f), Vec3(0.5f) );
+        Box box2( Vec3(0.5f), Vec3(15.5f) );
+        Box box3( Vec3(2.0f, 2.0f, 4.0f), Vec3(2.1f, 2.1f, 4.1f) );
+        TEST( classify( box0, ffr0 ) == Visibility::OUTSIDE, "box0 outside fru0!" );
+        TEST( classify( box2, ffr0 ) == Visibility::INTERSECTING, "fru0 inside box2!" );
+        TEST( classify( box3, ffr0 ) == Visibility::INSIDE, "box3 inside fru0!" );
+        uint32 planeMask = FRUSTUM_ALL_PLANES, hint = 5;
+        TEST( classify( box0, ffr0, planeMask, hint ) == Visibility::OUTSIDE && planeMask == FRUSTUM_ALL_PLANES, "box0 outside fru0!" );
+        uint32 singlePlane = 1 << hint, hint2 = hint;
+        TEST( classify( box0, ffr0, singlePlane, hint2 ) == Visibility::OUTSIDE && hint2 == hint, "The hint should be the rejecting plane!" );
+
+        // The classification must be consistent with the exact test and the
+        // children must get the same result with the reduced plane mask.
+        bool consistent = true;
+        for(int t = 0; t < 500; ++t)
+        {
+            Box box; random(box);
+            box.min = box.min * 5.0f + Vec3(2.0f, 2.0f, 3.0f);
+            box.max = box.max * 5.0f + Vec3(2.0f, 2.0f, 3.0f);
+            uint32 mask = FRUSTUM_ALL_PLANES, last = t % 6;
+            Visibility vis = classify( box, ffr0, mask, last );
+            if(vis == Visibility::OUTSIDE && intersects( box, ffr0 )) consistent = false;
+            if(vis == Visibility::INSIDE && !(intersects( box.min, ffr0 ) && intersects( box.max, ffr0 ))) consistent = false;
+            if(vis == Visibility::OUTSIDE) continue;
+            Vec3 c = (box.min + box.max) * 0.5f;
+            for(int i = 0; i < 8; ++i)
+            {
+                Box child = box;
+                if(i & 1) child.min.x = c.x; else child.max.x = c.x;
+                if(i & 2) child.min.y = c.y; else child.max.y = c.y;
+                if(i & 4) child.min.z = c.z; else child.max.z = c.z;
+                uint32 childMask = mask, childLast = 0;
+                if(classify( child, ffr0, childMask, childLast ) != classify( child, ffr0 ))
+                    consistent = false;
+            }
+        }
+        TEST( consistent, "Box <-> frustum classification is inconsistent!" );
+    }
+
     // Test (oriented) box <-> triangle intersection
     {
         Box box0(Vec3(-0.5f), Vec3(0.5f));
@@ -447,6 +636,96 @@ bool test_3dintersections()
         performance<Triangle,OBox>(intersects, "intersects");
     }
 
+    // Test triangle <-> wide box intersection (voxelization)
+    {
+        Box boxes[4] = { Box(Vec3(-0.5f), Vec3(0.5f)), Box(Vec3(1.0f), Vec3(2.0f, 3.0f, 4.0f)), Box(Vec3(1.0f), Vec3(2.0f, 3.0f, 4.0f)), Box(Vec3(0.0f), Vec3(1.0f)) };
+        Box4 wide( boxes, 3 );
+        Triangle tri3(Vec3(1.5f, 2.0f, 0.0f), Vec3(1.5f, 3.5f, 5.0f), Vec3(1.5f, 4.0f, -1.0f)); // Intersects box1
+        Triangle tri1(Vec3(0.4f), Vec3(1.5f, 10.0f, 0.4f), Vec3(1.5f, 11.0f, 2.0f)); // Intersects box0 only
+        TEST( intersects( TriangleSAT(tri3), wide ) == 0x6, "tri3 intersects box1 and box2 only!" );
+        TEST( intersects( TriangleSAT(tri1), wide ) == 0x1, "tri1 intersects box0 only!" );
+
+        // Random triangles against a voxel grid must give the same results as
+        // the single test.
+        bool consistent = true;
+        int numHits = 0;
+        for(int t = 0; t < 50; ++t)
+        {
+            Triangle tri; random(tri);
+            TriangleSAT satTri(tri);
+            for(int v = 0; v < 64; v += 8)
+            {
+                Box voxels[8];
+                for(int i = 0; i < 8; ++i)
+                {
+                    Vec3 cell(float((v + i) % 4), float((v + i) / 4 % 4), float((v + i) / 16));
+                    voxels[i] = Box(cell * 0.5f - 1.0f + 0.01f, cell * 0.5f - 0.5f + 0.01f);
+                }
+                uint32 mask = intersects( satTri, Box8(voxels) );
+                for(int i = 0; i < 8; ++i)
+                {
+                    bool hit = intersects( tri, voxels[i] );
+                    if(hit != ((mask >> i) & 1)) consistent = false;
+                    if(hit) ++numHits;
+                }
+            }
+        }
+        TEST( consistent && numHits > 0, "Triangle <-> wide box results differ from single box tests!" );
+    }
+
+    // Test triangle <-> triangle intersection
+    {
+        Triangle tri0(Vec3(0.0f), Vec3(1.0f, 0.0f, 0.0f), Vec3(0.0f, 1.0f, 0.0f));
+        Triangle tri1(Vec3(0.2f, 0.2f, -0.5f), Vec3(0.3f, 0.2f, 0.5f), Vec3(0.2f, 0.4f, 0.5f)); // Pierces tri0
+        Triangle tri2(Vec3(0.0f, 0.0f, 0.1f), Vec3(1.0f, 0.0f, 0.2f), Vec3(0.0f, 1.0f, 0.3f)); // Above tri0
+        Triangle tri3(Vec3(0.8f, 0.8f, -0.5f), Vec3(0.9f, 0.8f, 0.5f), Vec3(0.8f, 0.9f, 0.5f)); // Cuts the plane of tri0 outside of tri0
+        Triangle tri4(Vec3(1.0f, 0.0f, 0.0f), Vec3(2.0f, 0.0f, 1.0f), Vec3(2.0f, 1.0f, -1.0f)); // Touches a vertex of tri0
+        Triangle tri5(Vec3(0.5f, 0.5f, 0.0f), Vec3(1.5f, 0.5f, 0.0f), Vec3(0.5f, 1.5f, 0.0f)); // Coplanar, overlapping edges
+        Triangle tri6(Vec3(0.1f, 0.1f, 0.0f), Vec3(0.2f, 0.1f, 0.0f), Vec3(0.1f, 0.2f, 0.0f)); // Coplanar, inside tri0
+        Triangle tri7(Vec3(0.6f, 0.6f, 0.0f), Vec3(1.5f, 0.6f, 0.0f), Vec3(0.6f, 1.5f, 0.0f)); // Coplanar, disjoint
+        TEST( intersects(tri0, tri1) && intersects(tri1, tri0), "tri1 should intersect tri0!" );
+        TEST( !intersects(tri0, tri2), "tri2 should be above tri0!" );
+        TEST( !intersects(tri0, tri3) && !intersects(tri3, tri0), "tri3 should be outside of tri0!" );
+        TEST( intersects(tri0, tri4), "tri4 should touch tri0!" );
+        TEST( intersects(tri0, tri5), "Coplanar tri5 should intersect tri0!" );
+        TEST( intersects(tri0, tri6) && intersects(tri6, tri0), "Coplanar tri6 should be inside tri0!" );
+        TEST( !intersects(tri0, tri7), "Coplanar tri7 should be outside of tri0!" );
+        TEST( intersects(FastTriangle(tri0), FastTriangle(tri1)) && !intersects(FastTriangle(tri0), FastTriangle(tri3))
+            && intersects(FastTriangle(tri0), FastTriangle(tri6)) && !intersects(FastTriangle(tri0), FastTriangle(tri7)),
+            "Fast triangle <-> triangle test failed!" );
+        // Coplanar with a tie of two normal components (normal (1,0,1))
+        Triangle tri8(Vec3(0.0f), Vec3(1.0f, 0.0f, -1.0f), Vec3(0.0f, 1.0f, 0.0f));
+        Triangle tri9(Vec3(5.0f, 0.0f, -5.0f), Vec3(6.0f, 0.0f, -6.0f), Vec3(5.0f, 1.0f, -5.0f));
+        Triangle tri10(Vec3(0.2f, 0.2f, -0.2f), Vec3(0.3f, 0.2f, -0.3f), Vec3(0.2f, 0.3f, -0.2f));
+        TEST( !intersects(tri8, tri9) && !intersects(FastTriangle(tri8), FastTriangle(tri9)), "Coplanar tri9 should be outside of tri8!" );
+        TEST( intersects(tri8, tri10) && intersects(FastTriangle(tri10), FastTriangle(tri8)), "Coplanar tri10 should be inside tri8!" );
+
+        // Random pairs against the test of each edge with the other triangle
+        auto edgeHits = [](const Triangle& _edges, const Triangle& _triangle) {
+            for(int i = 0; i < 3; ++i)
+            {
+                Vec3 edge = _edges.v((i + 1) % 3) - _edges.v(i);
+                float dist;
+                if(intersects( Ray(_edges.v(i), normalize(edge)), _triangle, dist ) && dist <= len(edge))
+                    return true;
+            }
+            return false;
+        };
+        int numMismatches = 0, numFastMismatches = 0, numHits = 0;
+        for(int i = 0; i < 10000; ++i)
+        {
+            Triangle a, b; random(a); random(b);
+            bool hit = intersects(a, b);
+            if(hit) ++numHits;
+            if(hit != (edgeHits(a, b) || edgeHits(b, a))) ++numMismatches;
+            if(hit != intersects(FastTriangle(a), FastTriangle(b))) ++numFastMismatches;
+        }
+        TEST( numHits > 0 && numMismatches == 0, "Triangle <-> triangle test differs from the edge tests!" );
+        TEST( numFastMismatches == 0, "Fast triangle <-> triangle test differs from the normal one!" );
+        performance<Triangle,Triangle>(intersects, "intersects");
+        performance<FastTriangle,FastTriangle>(intersects, "intersects");
+    }
+
     // Test (oriented) box <-> plane intersection
     {
         Box box0(Vec3(-0.5f), Vec3(0.5f));
@@ -464,6 +743,11 @@ bool test_3dintersections()
         TEST( !intersects(pla4, box0), "pla4 outside box0!" );
         TEST( intersects(pla5, box0), "pla5 intersects box0!" );
         TEST( !intersects(pla6, box0), "pla6 outside box0!" );
+        TEST( classify(pla0, box0) == PlaneSide::STRADDLING, "pla0 intersects box0!" );
+        TEST( classify(pla1, box0) == PlaneSide::STRADDLING, "pla1 touches box0!" );
+        TEST( classify(pla2, box0) == PlaneSide::FRONT, "box0 is in front of pla2!" );
+        TEST( classify(pla6, box0) == PlaneSide::FRONT, "box0 is in front of pla6!" );
+        TEST( classify(Plane(Vec3(-1.0f, 0.0f, 0.0f), -1.0f), box0) == PlaneSide::BACK, "box0 is behind the plane!" );
         performance<Plane,Box>(intersects, "intersects");
 
         OBox obo0(Vec3(1.0f, 2.0f, 1.0f), Vec3(0.5f, 0.5f, 1.0f), Quaternion(0.0f, -PI/4, 0.0f));
@@ -477,6 +761,10 @@ bool test_3dintersections()
         TEST( !intersects(pla9, obo0), "pla9 outside obo0!" );
         TEST( intersects(pla10, obo0), "pla10 intersects obo0!" );
         TEST( !intersects(pla11, obo0), "pla11 outside obo0!" );
+        TEST( classify(pla7, obo0) == PlaneSide::FRONT, "obo0 is in front of pla7!" );
+        TEST( classify(pla8, obo0) == PlaneSide::STRADDLING, "pla8 intersects obo0!" );
+        TEST( classify(pla9, obo0) == PlaneSide::BACK, "obo0 is behind pla9!" );
+        TEST( classify(pla11, obo0) == PlaneSide::FRONT, "obo0 is in front of pla11!" );
         performance<Plane,OBox>(intersects, "intersects");
     }
 
@@ -0,0 +1,148 @@
+#include "ei/kdtree.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+#include <algorithm>
+
+using namespace ei;
+using namespace std;
+
+bool test_kdtree()
+{
+    bool result = true;
+
+    const uint32 num = 20000;
+    vector<Vec3> points(num);
+    for(auto& p : points) random(p);
+    KDTree tree( points.data(), num, 8, 4 );
+    TEST( tree.size() == num, "Wrong number of points in the tree!" );
+
+    // k nearest neighbors against brute force
+    {
+        bool consistent = true, sorted = true;
+        uint32 indices[16];
+        float distancesSq[16];
+        vector<float> all(num);
+        for(int q = 0; q < 300; ++q)
+        {
+            Vec3 query; random(query);
+            uint32 k = q % 3 == 0 ? 1 : (q % 3 == 1 ? 5 : 16);
+            for(uint32 i = 0; i < num; ++i)
+                all[i] = lensq(points[i] - query);
+            sort(all.begin(), all.end());
+            uint32 found = tree.kNearest( query, k, indices, distancesSq );
+            if(found != k) consistent = false;
+            for(uint32 j = 0; j < found; ++j)
+            {
+                if(distancesSq[j] != all[j]) consistent = false;
+                if(distancesSq[j] != lensq(points[indices[j]] - query)) consistent = false;
+                if(j > 0 && distancesSq[j] < distancesSq[j - 1]) sorted = false;
+            }
+        }
+        TEST( consistent, "k nearest neighbors differ from the brute force search!" );
+        TEST( sorted, "k nearest neighbors must be sorted by distance!" );
+    }
+
+    // Nearest neighbor with limited distance
+    {
+        bool consistent = true;
+        for(int q = 0; q < 300; ++q)
+        {
+            Vec3 query; random(query);
+            float maxDistance = 0.02f;
+            uint32 expected = KDTree::NONE;
+            float expectedDistSq = maxDistance * maxDistance;
+            for(uint32 i = 0; i < num; ++i)
+            {
+                float d = lensq(points[i] - query);
+                if(d <= expectedDistSq) { expected = i; expectedDistSq = d; }
+            }
+            float distSq;
+            uint32 index = tree.nearest( query, distSq, maxDistance );
+            if(expected == KDTree::NONE)
+            {
+                if(index != KDTree::NONE || distSq != INF) consistent = false;
+            } else if(index == KDTree::NONE || distSq != expectedDistSq)
+                consistent = false;
+        }
+        TEST( consistent, "Nearest neighbor differs from the brute force search!" );
+    }
+
+    // Radius queries
+    {
+        bool consistent = true;
+        vector<uint32> found;
+        for(int q = 0; q < 100; ++q)
+        {
+            Vec3 query; random(query);
+            float radius = 0.05f * (q % 4 + 1);
+            found.clear();
+            tree.radius( query, radius, [&](uint32 _index, float _distSq) {
+                if(_distSq != lensq(points[_index] - query)) consistent = false;
+                found.push_back(_index);
+                return true;
+            } );
+            sort(found.begin(), found.end());
+            vector<uint32> expected;
+            for(uint32 i = 0; i < num; ++i)
+                if(len(points[i] - query) <= radius)
+                    expected.push_back(i);
+            if(found != expected) consistent = false;
+        }
+        TEST( consistent, "Radius query differs from the brute force search!" );
+
+        int numCalls = 0;
+        tree.radius( Vec3(0.0f), 1.0f, [&](uint32, float) { ++numCalls; return false; } );
+        TEST( numCalls == 1, "The query should stop when the callback returns false!" );
+    }
+
+    // Batched queries must match the single queries
+    {
+        const uint32 numQueries = 5000, k = 4;
+        vector<Vec3> queries(numQueries);
+        for(auto& q : queries) random(q);
+        vector<uint32> indices(numQueries * k), serialIndices(numQueries * k);
+        vector<float> distancesSq(numQueries * k), serialDistancesSq(numQueries * k);
+        tree.kNearest( queries.data(), numQueries, k, indices.data(), distancesSq.data(), INF, 4 );
+        tree.kNearest( queries.data(), numQueries, k, serialIndices.data(), serialDistancesSq.data(), INF, 1 );
+        TEST( indices == serialIndices && distancesSq == serialDistancesSq, "The result must not depend on the number of threads!" );
+        bool consistent = true;
+        uint32 single[k];
+        float singleDistSq[k];
+        for(uint32 i = 0; i < numQueries; ++i)
+        {
+            tree.kNearest( queries[i], k, single, singleDistSq );
+            for(uint32 j = 0; j < k; ++j)
+                if(single[j] != indices[i * k + j] || singleDistSq[j] != distancesSq[i * k + j])
+                    consistent = false;
+        }
+        TEST( consistent, "Batched queries differ from single queries!" );
+
+        vector<uint32> nearest(numQueries);
+        vector<float> nearestDistSq(numQueries);
+        tree.nearest( queries.data(), numQueries, nearest.data(), nearestDistSq.data(), 0.01f );
+        consistent = true;
+        for(uint32 i = 0; i < numQueries; ++i)
+        {
+            float distSq;
+            if(tree.nearest( queries[i], distSq, 0.01f ) != nearest[i] || distSq != nearestDistSq[i])
+                consistent = false;
+        }
+        TEST( consistent, "Batched nearest neighbor differs from the single query!" );
+    }
+
+    // Small and empty trees
+    {
+        KDTree small( points.data(), 3 );
+        uint32 indices[5];
+        float distancesSq[5];
+        TEST( small.kNearest( Vec3(0.0f), 5, indices, distancesSq ) == 3, "A tree with 3 points should find 3 neighbors!" );
+
+        KDTree empty;
+        float distSq;
+        TEST( empty.nearest( Vec3(0.0f), distSq ) == KDTree::NONE, "An empty tree must not find anything!" );
+        KDTree emptyBuilt( nullptr, 0 );
+        TEST( emptyBuilt.kNearest( Vec3(0.0f), 5, indices, distancesSq ) == 0, "An empty tree must not find anything!" );
+    }
+
+    return result;
+}
@@ -0,0 +1,104 @@
+#include "ei/looseoctree.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+#include <algorithm>
+
+using namespace ei;
+using namespace std;
+
+// Bounds of mixed colliders with very different sizes
+static Box randomCollider(int _type)
+{
+    switch(_type % 4)
+    {
+    case 0: { Sphere s; random(s); s.radius *= 0.2f; return Box(s); }
+    case 1: { Capsule c; random(c); return Box(Box(Sphere(c.seg.a, c.radius)), Box(Sphere(c.seg.b, c.radius))); }
+    case 2: { OBox o; random(o); return Box(o); }
+    default: { Triangle t; random(t); return Box(t); }
+    }
+}
+
+// Compare a query with the brute force test of all living objects.
+template<typename Shape>
+static bool sameObjects(const LooseOctree& _tree, const Shape& _shape, const vector<uint32>& _handles, const vector<bool>& _alive)
+{
+    vector<uint32> found, expected;
+    _tree.query( _shape, [&](uint32 _object, uint32 _data) {
+        if(_handles[_data] != _object) found.push_back(0xffffffff);
+        found.push_back(_data);
+        return true;
+    } );
+    for(uint32 i = 0; i < _handles.size(); ++i)
+        if(_alive[i] && intersects( _shape, _tree.bounds(_handles[i]) ))
+            expected.push_back(i);
+    sort(found.begin(), found.end());
+    return found == expected;
+}
+
+bool test_looseoctree()
+{
+    bool result = true;
+
+    const uint32 num = 3000;
+    LooseOctree tree( Box(Vec3(-1.0f), Vec3(1.0f)), 6 );
+    vector<uint32> handles(num);
+    vector<bool> alive(num, true);
+    for(uint32 i = 0; i < num; ++i)
+        handles[i] = tree.insert( randomCollider(i), i );
+    // Some objects outside the world
+    handles[0] = (tree.remove( handles[0] ), tree.insert( Box(Vec3(5.0f), Vec3(5.5f)), 0 ));
+    handles[1] = (tree.remove( handles[1] ), tree.insert( Box(Vec3(-0.9f), Vec3(3.0f)), 1 ));
+    TEST( tree.size() == num, "Wrong number of objects!" );
+    TEST( tree.depth( handles[0] ) == 0, "Objects outside the world belong to the root!" );
+    // Small objects go deeper
+    uint32 small = tree.insert( Box(Vec3(0.1f), Vec3(0.101f)), 0 );
+    TEST( tree.depth( small ) == 6, "A tiny object should be at the maximum depth!" );
+    tree.remove( small );
+
+    bool consistent = true;
+    for(int q = 0; q < 100; ++q)
+    {
+        Sphere sphere; random(sphere);
+        Box box; random(box);
+        Triangle triangle; random(triangle);
+        if(!sameObjects( tree, sphere, handles, alive )) consistent = false;
+        if(!sameObjects( tree, box, handles, alive )) consistent = false;
+        if(!sameObjects( tree, triangle, handles, alive )) consistent = false;
+    }
+    TEST( consistent, "Loose octree queries differ from the brute force search!" );
+
+    // Small movements stay in the node, large ones relocate
+    int numRelocated = 0, numMoved = 0;
+    for(int frame = 0; frame < 10; ++frame)
+        for(uint32 i = 2; i < num; i += 2)
+        {
+            Vec3 delta; random(delta);
+            delta *= i % 3 == 0 ? 0.3f : 0.002f;
+            Box b = tree.bounds( handles[i] );
+            b.min += delta;
+            b.max += delta;
+            if(tree.move( handles[i], b )) ++numRelocated;
+            ++numMoved;
+        }
+    TEST( numRelocated > 0 && numRelocated < numMoved / 2, "Only large movements should relocate objects!" );
+    for(uint32 i = 5; i < num; i += 3)
+    {
+        tree.remove( handles[i] );
+        alive[i] = false;
+    }
+    consistent = true;
+    for(int q = 0; q < 100; ++q)
+    {
+        Sphere sphere; random(sphere);
+        Ray ray; random(ray);
+        if(!sameObjects( tree, sphere, handles, alive )) consistent = false;
+        if(!sameObjects( tree, ray, handles, alive )) consistent = false;
+    }
+    TEST( consistent, "Loose octree queries after updates differ from the brute force search!" );
+
+    int numCalls = 0;
+    tree.query( Box(Vec3(-10.0f), Vec3(10.0f)), [&](uint32, uint32) { ++numCalls; return false; } );
+    TEST( numCalls == 1, "The query should stop when the callback returns false!" );
+
+    return result;
+}
@@ -8,6 +8,14 @@ bool test_2dtypes();
 bool test_2dintersections();
 bool test_3dtypes();
 bool test_3dintersections();
+bool test_3dbatch();
+bool test_bvh();
+bool test_quantizedbvh();
+bool test_dynamicbvh();
+bool test_sweepandprune();
+bool test_hashgrid();
+bool test_looseoctree();
+bool test_kdtree();
 bool test_stdextensions();
 bool test_primes();
 bool test_conversions();
@@ -41,6 +49,30 @@ int main()
     if( test_3dintersections() )
         cerr << "Successfully completed: 3D intersection test." << std::endl;
 
+    if( test_3dbatch() )
+        cerr << "Successfully completed: 3D batch test." << std::endl;
+
+    if( test_bvh() )
+        cerr << "Successfully completed: BVH test." << std::endl;
+
+    if( test_quantizedbvh() )
+        cerr << "Successfully completed: Quantized BVH test." << std::endl;
+
+    if( test_dynamicbvh() )
+        cerr << "Successfully completed: Dynamic BVH test." << std::endl;
+
+    if( test_sweepandprune() )
+        cerr << "Successfully completed: Sweep and prune test." << std::endl;
+
+    if( test_hashgrid() )
+        cerr << "Successfully completed: Hash grid test." << std::endl;
+
+    if( test_looseoctree() )
+        cerr << "Successfully completed: Loose octree test." << std::endl;
+
+    if( test_kdtree() )
+        cerr << "Successfully completed: kd-tree test." << std::endl;
+
     if( test_primes() )
         cerr << "Successfully completed: Primes." << std::endl;
 
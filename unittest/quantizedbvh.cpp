@@ -0,0 +1,132 @@
+#include "ei/quantizedbvh.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+
+using namespace ei;
+using namespace std;
+
+// All primitives below a lane must be inside its decoded box.
+template<typename Q>
+static bool conservative(const QuantizedBVH<Q>& _bvh, const vector<Box>& _bounds, uint32 _node, const Box& _box, Box& _union)
+{
+    const uint N = QuantizedBVHNode<Q>::N;
+    const QuantizedBVHNode<Q>& node = _bvh.nodes()[_node];
+    BoxSoA<N> children;
+    details::decodeChildren( node, _box, children );
+    uint32 child = node.firstChild, index = node.firstIndex;
+    _union = details::emptyBox();
+    for(uint i = 0; i < N; ++i)
+    {
+        if(node.meta[i] == QuantizedBVHNode<Q>::EMPTY) continue;
+        Box lane = children.get(i);
+        Box content;
+        if(node.meta[i] == QuantizedBVHNode<Q>::INNER)
+        {
+            if(!conservative( _bvh, _bounds, child++, lane, content )) return false;
+        } else {
+            content = _bounds[_bvh.indices()[index]];
+            for(uint32 j = index; j < index + node.meta[i]; ++j)
+                details::extend( content, _bounds[_bvh.indices()[j]] );
+            index += node.meta[i];
+        }
+        if(!(content.min >= lane.min && content.max <= lane.max)) return false;
+        details::extend( _union, content );
+    }
+    return true;
+}
+
+template<typename Q>
+static bool testQuantized(const BVH& _bvh, const vector<Triangle>& _triangles, const vector<Box>& _bounds, const vector<Ray>& _rays)
+{
+    bool result = true;
+    vector<uint8> data;
+    serializeBVH<Q>( _bvh, data );
+    // A copy in new memory like a loaded file
+    vector<uint32> file((data.size() + 3) / 4);
+    memcpy(file.data(), data.data(), data.size());
+    QuantizedBVH<Q> view( file.data(), data.size() );
+    TEST( view.isValid() && view.numNodes() > 0, "The serialized BVH should be valid!" );
+
+    Box content;
+    TEST( conservative( view, _bounds, 0, view.bounds(), content ), "The decoded bounds must contain all primitives!" );
+
+    bool consistent = true;
+    for(const Ray& ray : _rays)
+    {
+        float dist, expectedDist;
+        uint32 index, expectedIndex;
+        bool hit = intersects( ray, view, _triangles.data(), dist, index );
+        bool expectedHit = intersects( ray, _bvh, _triangles.data(), expectedDist, expectedIndex );
+        if(hit != expectedHit || (hit && dist != expectedDist)) consistent = false;
+    }
+    TEST( consistent, "Closest hit in the quantized BVH differs from the BVH!" );
+
+    // Damaged or foreign data
+    QuantizedBVH<Q> truncated( file.data(), data.size() - 4 );
+    TEST( !truncated.isValid(), "Truncated data must be invalid!" );
+    file[1] = QuantizedBVHHeader::VERSION + 1;
+    QuantizedBVH<Q> version( file.data(), data.size() );
+    TEST( !version.isValid(), "Data of another version must be invalid!" );
+    return result;
+}
+
+bool test_quantizedbvh()
+{
+    bool result = true;
+
+    const uint32 num = 20000;
+    vector<Triangle> triangles(num);
+    for(auto& t : triangles)
+    {
+        Vec3 c; random(c);
+        Vec3 d0, d1, d2; random(d0); random(d1); random(d2);
+        t = Triangle( c + d0 * 0.05f, c + d1 * 0.05f, c + d2 * 0.05f );
+    }
+    vector<Ray> rays(2000);
+    for(auto& r : rays) random(r);
+    vector<Box> bounds(num);
+    for(uint32 i = 0; i < num; ++i)
+        bounds[i] = Box( triangles[i] );
+    BVH bvh = buildBVH( bounds.data(), num );
+
+    TEST( testQuantized<uint16>( bvh, triangles, bounds, rays ), "16 bit quantized BVH failed!" );
+    TEST( testQuantized<uint8>( bvh, triangles, bounds, rays ), "8 bit quantized BVH failed!" );
+
+    vector<uint8> data16, data8;
+    serializeBVH<uint16>( bvh, data16 );
+    serializeBVH<uint8>( bvh, data8 );
+    size_t binarySize = bvh.nodes.size() * sizeof(BVHNode) + bvh.indices.size() * sizeof(uint32);
+    TEST( data16.size() * 3 < binarySize * 2 && data8.size() * 3 < binarySize, "The quantized BVH should be much smaller!" );
+
+    // Far from the origin the relative precision of the bounds is lower
+    for(auto& t : triangles)
+    {
+        t.v0 += Vec3(1000.0f, -3000.0f, 77.0f);
+        t.v1 += Vec3(1000.0f, -3000.0f, 77.0f);
+        t.v2 += Vec3(1000.0f, -3000.0f, 77.0f);
+    }
+    for(uint32 i = 0; i < num; ++i)
+        bounds[i] = Box( triangles[i] );
+    for(auto& r : rays)
+        r.origin += Vec3(1000.0f, -3000.0f, 77.0f);
+    BVH shifted = buildBVH( bounds.data(), num );
+    TEST( testQuantized<uint16>( shifted, triangles, bounds, rays ), "16 bit quantized BVH far from the origin failed!" );
+    TEST( testQuantized<uint8>( shifted, triangles, bounds, rays ), "8 bit quantized BVH far from the origin failed!" );
+
+    // Empty BVH
+    {
+        vector<uint8> data;
+        serializeBVH<uint16>( buildBVH( (const Box*)nullptr, 0 ), data );
+        vector<uint32> file(data.size() / 4);
+        memcpy(file.data(), data.data(), data.size());
+        QuantizedBVH16 view( file.data(), data.size() );
+        QuantizedBVH8 wrongBits( file.data(), data.size() );
+        float dist;
+        uint32 index;
+        TEST( view.isValid() && view.numNodes() == 0 && !intersects( rays[0], view, triangles.data(), dist, index ),
+            "An empty quantized BVH must not contain nodes!" );
+        TEST( !wrongBits.isValid(), "Data with 16 bits must not be used as 8 bit BVH!" );
+    }
+
+    return result;
+}
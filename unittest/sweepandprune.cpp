@@ -0,0 +1,110 @@
+#include "ei/sweepandprune.hpp"
+#include "unittest.hpp"
+#include "performance3d.hpp"
+
+using namespace ei;
+using namespace std;
+
+// Compare the pairs with a brute force test of all living boxes.
+static bool samePairs(const SweepAndPrune& _sap, const vector<Box>& _boxes, const vector<bool>& _alive)
+{
+    size_t numPairs = 0;
+    for(uint32 i = 0; i < _boxes.size(); ++i) if(_alive[i])
+        for(uint32 j = i + 1; j < _boxes.size(); ++j) if(_alive[j])
+        {
+            bool overlap = intersects( _boxes[i], _boxes[j] );
+            if(overlap != _sap.overlapping( i, j )) return false;
+            if(overlap) ++numPairs;
+        }
+    bool ordered = true;
+    _sap.forEachPair( [&](uint32 _a, uint32 _b) { if(_a >= _b) ordered = false; } );
+    return ordered && numPairs == _sap.numPairs();
+}
+
+bool test_sweepandprune()
+{
+    bool result = true;
+
+    // Random movements against brute force
+    {
+        const uint32 num = 500;
+        vector<Box> boxes(num);
+        for(auto& b : boxes)
+        {
+            random(b);
+            b.max = b.min + (b.max - b.min) * 0.5f;
+        }
+        vector<bool> alive(num, true);
+        SweepAndPrune sap( boxes.data(), num );
+        TEST( samePairs( sap, boxes, alive ), "The initial sweep found wrong pairs!" );
+
+        SweepAndPrune inserted;
+        for(uint32 i = 0; i < num; ++i)
+            TEST( inserted.insert( boxes[i] ) == i, "The proxies should be consecutive!" );
+        TEST( samePairs( inserted, boxes, alive ), "Inserting the boxes one by one found wrong pairs!" );
+
+        bool consistent = true;
+        for(int frame = 0; frame < 20; ++frame)
+        {
+            for(uint32 i = frame % 2; i < num; i += 2)
+            {
+                Vec3 delta; random(delta);
+                boxes[i].min += delta * 0.05f;
+                boxes[i].max += delta * 0.05f;
+                // Sometimes change the size, too
+                if(i % 5 == 0) boxes[i].max += Vec3(0.02f) * (delta + 1.0f);
+                sap.move( i, boxes[i] );
+            }
+            if(!samePairs( sap, boxes, alive )) consistent = false;
+        }
+        TEST( consistent, "The incremental updates found wrong pairs!" );
+
+        for(uint32 i = 3; i < num; i += 4)
+        {
+            sap.remove( i );
+            alive[i] = false;
+        }
+        TEST( samePairs( sap, boxes, alive ), "Removing boxes left wrong pairs!" );
+        TEST( sap.insert( boxes[num - 1] ) == num - 1, "The last removed proxy should be reused!" );
+        alive[num - 1] = true;
+        TEST( samePairs( sap, boxes, alive ), "Reinserting a box found wrong pairs!" );
+    }
+
+    // Touching boxes overlap like in intersects(Box, Box)
+    {
+        SweepAndPrune sap;
+        uint32 a = sap.insert( Box(Vec3(0.0f), Vec3(1.0f)) );
+        uint32 b = sap.insert( Box(Vec3(1.0f, 0.0f, 0.0f), Vec3(2.0f, 1.0f, 1.0f)) );
+        TEST( sap.overlapping( a, b ), "Touching boxes should overlap!" );
+        sap.move( b, Box(Vec3(1.5f, 0.0f, 0.0f), Vec3(2.0f, 1.0f, 1.0f)) );
+        TEST( !sap.overlapping( a, b ) && sap.numPairs() == 0, "Separated boxes must not overlap!" );
+        sap.move( b, Box(Vec3(-1.0f, 0.5f, 0.5f), Vec3(3.0f, 0.6f, 0.6f)) );
+        TEST( sap.overlapping( a, b ), "A box passing through another should overlap!" );
+        sap.remove( a );
+        TEST( sap.numPairs() == 0, "Removing a box should remove its pairs!" );
+    }
+
+    // Unbounded boxes: removed endpoints must not stop in front of other
+    // infinite endpoints
+    {
+        vector<Box> boxes = { Box(Vec3(0.0f), Vec3(INF)), Box(Vec3(1.0f), Vec3(2.0f)), Box(Vec3(5.0f), Vec3(6.0f)) };
+        vector<bool> alive(3, true);
+        SweepAndPrune sap;
+        for(const Box& box : boxes)
+            sap.insert( box );
+        sap.remove( 1 );
+        alive[1] = false;
+        TEST( samePairs( sap, boxes, alive ), "Removing a box next to an infinite one left wrong pairs!" );
+        boxes[1] = Box(Vec3(3.0f), Vec3(4.0f));
+        alive[1] = true;
+        TEST( sap.insert( boxes[1] ) == 1 && samePairs( sap, boxes, alive ) && sap.numPairs() == 2,
+            "Reinserting next to an infinite box found wrong pairs!" );
+        sap.move( 2, Box(Vec3(-INF), Vec3(INF)) );
+        boxes[2] = Box(Vec3(-INF), Vec3(INF));
+        sap.remove( 0 );
+        alive[0] = false;
+        TEST( samePairs( sap, boxes, alive ) && sap.numPairs() == 1, "Removing an infinite box left wrong pairs!" );
+    }
+
+    return result;
+}
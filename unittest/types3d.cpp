@@ -239,6 +239,7 @@ bool test_3dtypes()
         TEST( distance(poi0, tri0) == 1.0f, "Distance between poi0 and tri0 is 1.0!" );
         TEST( distance(poi1, tri0) == sqrt(1.5f), "Distance between poi1 and tri0 is sqrt(1.5)!" );
         TEST( distance(poi3, tri0) == 0.5f, "Distance between poi3 and tri0 is 0.5!" );
+        TEST( approx(distance(Vec3(2.0f, 0.0f, -1.0f), tri0), sqrt(2.0f)), "Distance between a point beyond a vertex and tri0 is sqrt(2)!" );
         TEST( distance(poi0, sph0) == -1.0f, "Distance between poi0 and sph0 is -1.0!");
         TEST( distance(poi1, sph0) == 0.0f, "Distance between poi1 and sph0 is 0.0!");
         TEST( distance(poi2, sph0) == 2.0f, "Distance between poi2 and sph0 is 2.0!");